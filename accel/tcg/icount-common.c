@@ -425,8 +425,8 @@ bool icount_configure(QemuOpts *opts, Error **errp)
     long time_shift = -1;
 
     if (qemu_opt_get_bool(opts, "precise-clocks", false)) {
-        if (option || qemu_opt_get(opts, "align") || qemu_opt_get(opts, "sleep")) {
-            error_setg(errp, "precise-clocks=on and other options are incompatible");
+        if (option || qemu_opt_get(opts, "align")) {
+            error_setg(errp, "precise-clocks=on is incompatible with shift and align");
             return false;
         }
         icount2_configure(opts, errp);
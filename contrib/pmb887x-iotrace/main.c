@@ -0,0 +1,202 @@
+/*
+ * PMB887X binary IO trace decoder
+ *
+ * Renders traces written with PMB887X_IO_TRACE=file using the same register tables as QEMU.
+ * */
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/regs_dump.h"
+
+#define READ_CHUNK		4096
+
+typedef struct {
+	uint32_t addr;
+	uint64_t reads;
+	uint64_t writes;
+} reg_stat_t;
+
+static char *opt_module = NULL;
+static char *opt_reg = NULL;
+static char *opt_pc_min = NULL;
+static char *opt_pc_max = NULL;
+static gboolean opt_histogram = false;
+static gboolean opt_quiet = false;
+
+static GOptionEntry options[] = {
+	{"module",		'm', 0, G_OPTION_ARG_STRING,	&opt_module,	"Only accesses to module, e.g. GPTU0", "NAME"},
+	{"reg",			'r', 0, G_OPTION_ARG_STRING,	&opt_reg,		"Only accesses to register, e.g. T01IRC or GPTU0_T01IRC", "NAME"},
+	{"pc-min",		0,   0, G_OPTION_ARG_STRING,	&opt_pc_min,	"Only accesses from PC >= ADDR", "ADDR"},
+	{"pc-max",		0,   0, G_OPTION_ARG_STRING,	&opt_pc_max,	"Only accesses from PC <= ADDR", "ADDR"},
+	{"histogram",	'H', 0, G_OPTION_ARG_NONE,		&opt_histogram,	"Print per-register access histogram", NULL},
+	{"quiet",		'q', 0, G_OPTION_ARG_NONE,		&opt_quiet,		"Don't print accesses", NULL},
+	{NULL}
+};
+
+static bool is_reg_match(const pmb887x_module_t *module, const pmb887x_module_reg_t *reg) {
+	if (!module || !reg)
+		return false;
+	
+	if (strcasecmp(opt_reg, reg->name) == 0)
+		return true;
+	
+	g_autofree char *full_name = g_strdup_printf("%s_%s", module->name, reg->name);
+	return strcasecmp(opt_reg, full_name) == 0;
+}
+
+static bool is_record_match(const pmb887x_io_trace_record_t *record, uint32_t pc_min, uint32_t pc_max) {
+	if (record->pc < pc_min || record->pc > pc_max)
+		return false;
+	
+	if (!opt_module && !opt_reg)
+		return true;
+	
+	const pmb887x_module_t *module = pmb887x_find_cpu_module(record->addr);
+	if (opt_module && (!module || strcasecmp(opt_module, module->name) != 0))
+		return false;
+	
+	if (opt_reg && !is_reg_match(module, module ? pmb887x_find_cpu_module_reg(module, record->addr) : NULL))
+		return false;
+	
+	return true;
+}
+
+static void print_record(const pmb887x_io_trace_record_t *record) {
+	g_autoptr(GString) s = g_string_new("");
+	
+	pmb887x_format_io(s, record->addr, record->size, record->value, (record->flags & PMB887X_IO_TRACE_WRITE) != 0);
+	
+	if (record->repeat > 1) {
+		printf("[%"PRIu64"] %s (PC: %08X, LR: %08X) x%d\n", record->icount, s->str, record->pc, record->lr, record->repeat);
+	} else {
+		printf("[%"PRIu64"] %s (PC: %08X, LR: %08X)\n", record->icount, s->str, record->pc, record->lr);
+	}
+}
+
+static void count_record(GHashTable *stats, const pmb887x_io_trace_record_t *record) {
+	reg_stat_t *stat = g_hash_table_lookup(stats, GUINT_TO_POINTER(record->addr));
+	if (!stat) {
+		stat = g_new0(reg_stat_t, 1);
+		stat->addr = record->addr;
+		g_hash_table_insert(stats, GUINT_TO_POINTER(record->addr), stat);
+	}
+	
+	if ((record->flags & PMB887X_IO_TRACE_WRITE)) {
+		stat->writes += record->repeat;
+	} else {
+		stat->reads += record->repeat;
+	}
+}
+
+static gint compare_stats(gconstpointer a, gconstpointer b) {
+	const reg_stat_t *sa = *(const reg_stat_t **) a;
+	const reg_stat_t *sb = *(const reg_stat_t **) b;
+	uint64_t ta = sa->reads + sa->writes;
+	uint64_t tb = sb->reads + sb->writes;
+	return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+static void print_histogram(GHashTable *stats) {
+	g_autoptr(GPtrArray) list = g_hash_table_get_values_as_ptr_array(stats);
+	g_ptr_array_sort(list, compare_stats);
+	
+	printf("%-32s %-8s %12s %12s %12s\n", "REGISTER", "ADDR", "TOTAL", "READS", "WRITES");
+	
+	for (guint i = 0; i < list->len; i++) {
+		const reg_stat_t *stat = g_ptr_array_index(list, i);
+		const pmb887x_module_t *module = pmb887x_find_cpu_module(stat->addr);
+		const pmb887x_module_reg_t *reg = module ? pmb887x_find_cpu_module_reg(module, stat->addr) : NULL;
+		
+		g_autofree char *name = NULL;
+		if (reg) {
+			name = g_strdup_printf("%s_%s", module->name, reg->name);
+		} else if (module) {
+			name = g_strdup_printf("%s_*", module->name);
+		} else {
+			name = g_strdup("?");
+		}
+		
+		printf("%-32s %08X %12"PRIu64" %12"PRIu64" %12"PRIu64"\n", name, stat->addr, stat->reads + stat->writes, stat->reads, stat->writes);
+	}
+}
+
+int main(int argc, char **argv) {
+	g_autoptr(GError) err = NULL;
+	g_autoptr(GOptionContext) ctx = g_option_context_new("TRACE_FILE");
+	
+	g_option_context_set_summary(ctx, "Decode PMB887X binary IO trace (PMB887X_IO_TRACE=file).");
+	g_option_context_add_main_entries(ctx, options, NULL);
+	
+	if (!g_option_context_parse(ctx, &argc, &argv, &err)) {
+		fprintf(stderr, "%s\n", err->message);
+		return 1;
+	}
+	
+	if (argc != 2) {
+		fprintf(stderr, "%s", g_option_context_get_help(ctx, true, NULL));
+		return 1;
+	}
+	
+	uint32_t pc_min = opt_pc_min ? strtoul(opt_pc_min, NULL, 16) : 0;
+	uint32_t pc_max = opt_pc_max ? strtoul(opt_pc_max, NULL, 16) : 0xFFFFFFFF;
+	
+	FILE *fp = fopen(argv[1], "rb");
+	if (!fp) {
+		fprintf(stderr, "fopen(%s): %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	
+	pmb887x_io_trace_header_t header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, PMB887X_IO_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "%s: not a pmb887x IO trace\n", argv[1]);
+		fclose(fp);
+		return 1;
+	}
+	
+	if (header.version != PMB887X_IO_TRACE_VERSION || header.record_size != sizeof(pmb887x_io_trace_record_t)) {
+		fprintf(stderr, "%s: unsupported trace version %d (record size %d)\n", argv[1], header.version, header.record_size);
+		fclose(fp);
+		return 1;
+	}
+	
+	if (header.cpu != CPU_PMB8875 && header.cpu != CPU_PMB8876) {
+		fprintf(stderr, "%s: unknown cpu %d\n", argv[1], header.cpu);
+		fclose(fp);
+		return 1;
+	}
+	
+	pmb887x_regs_format_init(pmb887x_get_cpu_meta(header.cpu), NULL);
+	
+	g_autoptr(GHashTable) stats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	g_autofree pmb887x_io_trace_record_t *records = g_new(pmb887x_io_trace_record_t, READ_CHUNK);
+	uint64_t total = 0;
+	uint64_t matched = 0;
+	size_t n;
+	
+	while ((n = fread(records, sizeof(pmb887x_io_trace_record_t), READ_CHUNK, fp)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			const pmb887x_io_trace_record_t *record = &records[i];
+			
+			total += record->repeat;
+			
+			if (!is_record_match(record, pc_min, pc_max))
+				continue;
+			
+			matched += record->repeat;
+			
+			if (!opt_quiet)
+				print_record(record);
+			
+			if (opt_histogram)
+				count_record(stats, record);
+		}
+	}
+	
+	fclose(fp);
+	
+	if (opt_histogram)
+		print_histogram(stats);
+	
+	fprintf(stderr, "%"PRIu64" accesses, %"PRIu64" matched, time in %s\n", total, matched,
+		(header.flags & PMB887X_IO_TRACE_ICOUNT) ? "instructions" : "virtual ns");
+	
+	return 0;
+}
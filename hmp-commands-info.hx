@@ -992,3 +992,81 @@ SRST
   ``info cryptodev``
     Show the crypto devices.
 ERST
+
+#if defined(CONFIG_PMB887X)
+    {
+        .name       = "pmb887x-flash",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show pmb887x flash cache state",
+    },
+
+SRST
+  ``info pmb887x-flash``
+    Show pmb887x flash cache mode and amount of modified data.
+ERST
+
+    {
+        .name       = "pmb887x-input",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show pending pmb887x input events",
+    },
+
+SRST
+  ``info pmb887x-input``
+    Show pmb887x scripted input events which are not executed yet.
+ERST
+
+    {
+        .name       = "pmb887x-mmio-profile",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show pmb887x MMIO profile",
+    },
+
+SRST
+  ``info pmb887x-mmio-profile`` [*count*]
+    Show pmb887x MMIO access counts and host time per module and the
+    *count* (default: 20) most expensive registers. Also shows number of
+    system memory map rebuilds and EBU/TCM remaps.
+ERST
+
+    {
+        .name       = "pmb887x-irq",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show pmb887x interrupt statistics",
+    },
+
+SRST
+  ``info pmb887x-irq``
+    Show per-line pmb887x NVIC assertion counts and latency from assertion
+    to CPU acknowledge (read of CURRENT_IRQ/CURRENT_FIQ), in virtual clock ns.
+ERST
+
+    {
+        .name       = "pmb887x-trace",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show pmb887x trace masks",
+    },
+
+SRST
+  ``info pmb887x-trace``
+    Show pmb887x debug log and IO dump module masks.
+ERST
+
+    {
+        .name       = "pmb887x-hle",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show pmb887x firmware routine hooks",
+    },
+
+SRST
+  ``info pmb887x-hle``
+    Show pmb887x high-level emulated firmware routines with call, decline
+    and verification counters.
+ERST
+#endif
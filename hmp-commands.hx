@@ -1862,3 +1862,75 @@ SRST
   List event channels in the guest
 ERST
 #endif
+
+#if defined(CONFIG_PMB887X)
+    {
+        .name       = "pmb887x-flash-commit",
+        .args_type  = "",
+        .params     = "",
+        .help       = "write modified flash sectors to the drive",
+    },
+
+SRST
+``pmb887x-flash-commit``
+  Write all modified flash sectors of the pmb887x machine to the backing
+  drive. In snapshot mode this is the only way the drive gets modified.
+ERST
+
+    {
+        .name       = "pmb887x-flash-export",
+        .args_type  = "filename:F",
+        .params     = "filename",
+        .help       = "save modified flash sectors to a diff file",
+    },
+
+SRST
+``pmb887x-flash-export`` *filename*
+  Save modified (not yet committed) flash sectors of the pmb887x machine
+  to *filename* as a sparse diff.
+ERST
+
+    {
+        .name       = "pmb887x-trace",
+        .args_type  = "kind:s,modules:s",
+        .params     = "log|io modules",
+        .help       = "set pmb887x trace mask (e.g. gptu:stm, all:-dif, none)",
+    },
+
+SRST
+``pmb887x-trace`` *log|io* *modules*
+  Set the pmb887x debug log (``log``) or IO dump (``io``) module mask.
+  *modules* is a list of module names separated by ``:``, ``+`` or ``,``.
+  ``all`` and ``none`` are accepted, ``-name`` removes a module.
+ERST
+
+    {
+        .name       = "pmb887x-input",
+        .args_type  = "script:S",
+        .params     = "script",
+        .help       = "schedule pmb887x keypad/GPIO/ADC input events",
+    },
+
+SRST
+``pmb887x-input`` *script*
+  Schedule pmb887x input events at virtual clock timestamps. Events are
+  separated by ``;``, each is ``<time> key <qcode> down|up|tap [hold]``,
+  ``<time> gpio <pin> 0|1`` or ``<time> adc <n> none|voltage|resistor|divider ...``.
+  *time* is in ms (or with ``ns``/``us``/``s`` suffix) from now, ``+time`` is
+  relative to the previous event. Example: ``pmb887x-input 0 key ret tap; +500 key 1 tap``.
+ERST
+
+    {
+        .name       = "pmb887x-mmio-profile",
+        .args_type  = "action:s,filename:F?",
+        .params     = "on|off|reset|csv [filename]",
+        .help       = "control pmb887x MMIO profiler",
+    },
+
+SRST
+``pmb887x-mmio-profile`` *on|off|reset|csv* [*filename*]
+  Enable, disable or reset the pmb887x MMIO profiler, which counts reads and
+  writes and host time spent in handlers per peripheral register.
+  ``csv`` saves the counters to *filename*.
+ERST
+#endif
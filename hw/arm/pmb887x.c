@@ -2,6 +2,7 @@
 #include "qapi/error.h"
 #include "cpu.h"
 #include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 #include "hw/arm/boot.h"
 #include "net/net.h"
@@ -16,6 +17,8 @@
 #include "qemu/datadir.h"
 #include "hw/loader.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/blockdev.h"
+#include "hw/sd/sd.h"
 #include "qapi/qapi-commands-machine.h"
 #include "sysemu/cpu-throttle.h"
 #include "sysemu/accel-ops.h"
@@ -31,6 +34,11 @@
 #include "hw/arm/pmb887x/dif/lcd_common.h"
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/boards.h"
+#include "hw/arm/pmb887x/trace_common.h"
+#include "hw/arm/pmb887x/input.h"
+#include "hw/arm/pmb887x/mmio_profile.h"
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/hle.h"
 
 static MemoryRegion tcm_memory[2];
 static uint32_t tcm_regs[2] = {0x10, 0x10};
@@ -43,7 +51,13 @@ static ARMCPU *cpu = NULL;
 	TCM
 */
 static void pmb8876_tcm_update(void) {
+	bool is_changed = false;
+	
+	// Both TCM are remapped with single FlatView rebuild
+	memory_region_transaction_begin();
+	
 	for (int i = 0; i < 2; ++i) {
+		MemoryRegion *region = &tcm_memory[i];
 		uint32_t base = tcm_regs[i] & 0xFFFFF000;
 		uint32_t size = (tcm_regs[i] >> 2) & 0x1F;
 		bool enabled = (tcm_regs[i] & 1) && size > 0;
@@ -51,16 +65,25 @@ static void pmb8876_tcm_update(void) {
 		if (size > 0)
 			size = (1 << (size - 1)) * 1024;
 		
+		bool is_mapped = memory_region_is_mapped(region);
+		if (is_mapped == enabled && (!enabled || (region->addr == base && memory_region_size(region) == size)))
+			continue;
+		
 		// fprintf(stderr, "TCM%d: %08X (%08X, enabled=%d)\n", i, base, size, enabled);
 		
-		if (memory_region_is_mapped(&tcm_memory[i])) 
-			memory_region_del_subregion(get_system_memory(), &tcm_memory[i]);
+		is_changed = true;
 		
-		if (enabled && !memory_region_is_mapped(&tcm_memory[i])) {
-			memory_region_set_size(&tcm_memory[i], size);
-			memory_region_add_subregion_overlap(get_system_memory(), base, &tcm_memory[i], 20002 - i);
+		if (is_mapped)
+			memory_region_del_subregion(get_system_memory(), region);
+		
+		if (enabled) {
+			memory_region_set_size(region, size);
+			memory_region_add_subregion_overlap(get_system_memory(), base, region, 20002 - i);
 		}
 	}
+	
+	memory_region_transaction_commit();
+	pmb887x_mmio_profile_remap(is_changed);
 }
 
 static uint64_t pmb8876_atcm_read(CPUARMState *env, const ARMCPRegInfo *ri) {
@@ -89,7 +112,13 @@ static const ARMCPRegInfo cp_reginfo[] = {
 		.access = PL1_RW, .type = ARM_CP_IO, .readfn = pmb8876_btcm_read, .writefn = pmb8876_btcm_write },
 };
 
-static uint32_t unk_reg_F4600040 = 1;
+typedef struct {
+	uint32_t unk_reg_F4600040;
+} pmb887x_cpu_io_t;
+
+static pmb887x_cpu_io_t cpu_io = {
+	.unk_reg_F4600040 = 1,
+};
 
 static uint64_t cpu_io_read(void *opaque, hwaddr offset, unsigned size) {
 	hwaddr addr = (size_t) opaque + offset;
@@ -105,7 +134,7 @@ static uint64_t cpu_io_read(void *opaque, hwaddr offset, unsigned size) {
 		value = 0x800000 | 0x11;
 	
 	if (addr == 0xF4600040)
-		value = unk_reg_F4600040;
+		value = cpu_io.unk_reg_F4600040;
 	
 	#ifdef PMB887X_IO_BRIDGE
 	value = pmb8876_io_bridge_read(addr, size);
@@ -131,17 +160,17 @@ static void cpu_io_write(void *opaque, hwaddr offset, uint64_t value, unsigned s
 	
 	if (addr == 0xf460001c) {
 		if (value == 0x8) {
-			unk_reg_F4600040 = 2;
+			cpu_io.unk_reg_F4600040 = 2;
 		} else {
-			unk_reg_F4600040 = 1;
+			cpu_io.unk_reg_F4600040 = 1;
 		}
 	}
 	
 	if (addr == 0xF460002C) {
 		if (value == 2) {
-			unk_reg_F4600040 = 1;
+			cpu_io.unk_reg_F4600040 = 1;
 		} else {
-			unk_reg_F4600040 = 0;
+			cpu_io.unk_reg_F4600040 = 0;
 		}
 	}
 	
@@ -165,6 +194,17 @@ static const MemoryRegionOps cpu_io_opts = {
 	}
 };
 
+// TCM registers are migrated by CPU as cp15 regs, writefn remaps TCM on load
+static const VMStateDescription cpu_io_vmstate = {
+	.name = "pmb887x-cpu-io",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(unk_reg_F4600040, pmb887x_cpu_io_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static uint64_t unmapped_io_read(void *opaque, hwaddr offset, unsigned size) {
 	uint32_t addr = (size_t) opaque + offset;
 	fprintf(stderr, "UNMAPPED READ[%d] %08X (PC: %08X)\n", size, addr, cpu->env.regs[15]);
@@ -296,6 +336,9 @@ static void pmb887x_init(MachineState *machine) {
 	#endif
 	
 	pmb887x_io_dump_init(board);
+	pmb887x_mmio_profile_init();
+	pmb887x_idle_init();
+	pmb887x_hle_init(board);
 	
 	MemoryRegion *sysmem = get_system_memory();
 	
@@ -329,6 +372,7 @@ static void pmb887x_init(MachineState *machine) {
 	MemoryRegion *io = g_new(MemoryRegion, 1);
     memory_region_init_io(io, NULL, &cpu_io_opts, (void *) 0xF0000000, "IO", 0xF000000);
 	memory_region_add_subregion(sysmem, 0xF0000000, io);
+	vmstate_register(NULL, 0, &cpu_io_vmstate, &cpu_io);
 	
 	// 0x00800000 (Internal SRAM, 96k)
 	MemoryRegion *sram = g_new(MemoryRegion, 1);
@@ -413,6 +457,20 @@ static void pmb887x_init(MachineState *machine) {
 		// MMCI
 		DeviceState *mmci = pmb887x_new_dev(board->cpu, "MMCI", nvic);
 		sysbus_realize_and_unref(SYS_BUS_DEVICE(mmci), &error_fatal);
+		
+		// MCI (PL180)
+		DeviceState *mci = pmb887x_new_dev(board->cpu, "MCI", nvic);
+		object_property_set_link(OBJECT(mci), "pll", OBJECT(pll), &error_fatal);
+		object_property_set_link(OBJECT(mci), "dmac", OBJECT(dmac), &error_fatal);
+		sysbus_realize_and_unref(SYS_BUS_DEVICE(mci), &error_fatal);
+		
+		// SD card: -drive if=sd,file=...
+		DriveInfo *sd_dinfo = drive_get(IF_SD, 0, 0);
+		if (sd_dinfo) {
+			DeviceState *card = qdev_new(TYPE_SD_CARD);
+			qdev_prop_set_drive_err(card, "drive", blk_by_legacy_dinfo(sd_dinfo), &error_fatal);
+			qdev_realize_and_unref(card, qdev_get_child_bus(mci, "sd-bus"), &error_fatal);
+		}
 	}
 	
 	// LCD panel
@@ -433,11 +491,13 @@ static void pmb887x_init(MachineState *machine) {
 	// USART0
 	DeviceState *usart0 = pmb887x_new_dev(board->cpu, "USART0", nvic);
 	qdev_prop_set_chr(DEVICE(usart0), "chardev", serial_hd(0));
+	object_property_set_link(OBJECT(usart0), "pll", OBJECT(pll), &error_fatal);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(usart0), &error_fatal);
 	
 	// USART1
 	DeviceState *usart1 = pmb887x_new_dev(board->cpu, "USART1", nvic);
 	qdev_prop_set_chr(DEVICE(usart1), "chardev", serial_hd(1));
+	object_property_set_link(OBJECT(usart1), "pll", OBJECT(pll), &error_fatal);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(usart1), &error_fatal);
 	
 	if (board->cpu == CPU_PMB8876) {
@@ -511,6 +571,9 @@ static void pmb887x_init(MachineState *machine) {
 	pmb887x_init_keymap(keypad, board->keymap, Q_KEY_CODE__MAX);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(keypad), &error_fatal);
 	
+	// Scripted keypad/GPIO/ADC input
+	pmb887x_input_init(board, keypad, pcl, adc);
+	
 	// External Bus Unit
 	DeviceState *ebuc = pmb887x_new_dev(board->cpu, "EBU", NULL);
 	
@@ -536,6 +599,51 @@ static void pmb887x_init(MachineState *machine) {
 	#endif
 }
 
+/*
+ * Trace masks: -machine pmb887x,trace=gptu:stm,trace-io=dif or qom-set /machine trace ...
+ * */
+static char *pmb887x_get_trace(Object *obj, Error **errp) {
+	return pmb887x_trace_format(pmb887x_trace_log_mask);
+}
+
+static void pmb887x_set_trace(Object *obj, const char *value, Error **errp) {
+	pmb887x_trace_parse(value, &pmb887x_trace_log_mask, errp);
+}
+
+static char *pmb887x_get_trace_io(Object *obj, Error **errp) {
+	return pmb887x_trace_format(pmb887x_trace_io_mask);
+}
+
+static void pmb887x_set_trace_io(Object *obj, const char *value, Error **errp) {
+	pmb887x_trace_parse(value, &pmb887x_trace_io_mask, errp);
+}
+
+/*
+ * Scripted input: -machine pmb887x,input-replay=file or qom-set /machine input "100 key ret tap; +1s key 1 tap"
+ * */
+static char *pmb887x_get_input(Object *obj, Error **errp) {
+	return pmb887x_input_format_pending();
+}
+
+static void pmb887x_set_input(Object *obj, const char *value, Error **errp) {
+	pmb887x_input_schedule(value, errp);
+}
+
+static void pmb887x_set_input_replay(Object *obj, const char *value, Error **errp) {
+	pmb887x_input_load(value, errp);
+}
+
+/*
+ * MMIO profiler: qom-set /machine mmio-profile true
+ * */
+static bool pmb887x_get_mmio_profile(Object *obj, Error **errp) {
+	return pmb887x_mmio_profile_enabled();
+}
+
+static void pmb887x_set_mmio_profile(Object *obj, bool value, Error **errp) {
+	pmb887x_mmio_profile_enable(value);
+}
+
 /*
  * Generic PMB887X machine
  * */
@@ -547,6 +655,17 @@ static void pmb887x_class_init(ObjectClass *oc, void *data) {
 	mc->ignore_memory_transaction_failures = true;
 	mc->default_cpu_type = ARM_CPU_TYPE_NAME("arm926");
 	mc->default_ram_size = 16 * 1024 * 1024;
+	
+	object_class_property_add_str(oc, "trace", pmb887x_get_trace, pmb887x_set_trace);
+	object_class_property_set_description(oc, "trace", "Modules with debug log enabled, e.g. gptu:stm, all:-dif, none");
+	object_class_property_add_str(oc, "trace-io", pmb887x_get_trace_io, pmb887x_set_trace_io);
+	object_class_property_set_description(oc, "trace-io", "Modules with IO dump enabled, same syntax as trace");
+	object_class_property_add_str(oc, "input", pmb887x_get_input, pmb887x_set_input);
+	object_class_property_set_description(oc, "input", "Schedule keypad/GPIO/ADC input events, see pmb887x/input.h");
+	object_class_property_add_str(oc, "input-replay", NULL, pmb887x_set_input_replay);
+	object_class_property_set_description(oc, "input-replay", "Schedule input events from file");
+	object_class_property_add_bool(oc, "mmio-profile", pmb887x_get_mmio_profile, pmb887x_set_mmio_profile);
+	object_class_property_set_description(oc, "mmio-profile", "Count MMIO accesses and host time per register");
 }
 
 static const TypeInfo pmb887x_type = {
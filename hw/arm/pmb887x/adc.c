@@ -16,6 +16,7 @@
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/adc.h"
 #include "hw/arm/pmb887x/pll.h"
@@ -341,6 +342,21 @@ static void adc_realize(DeviceState *dev, Error **errp) {
 	// pmb887x_pll_add_freq_update_callback(p->pll, adc_update_state_callback, p);
 }
 
+static const VMStateDescription adc_vmstate = {
+	.name = TYPE_PMB887X_ADC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_INT32(measure_mode, pmb887x_adc_t),
+		VMSTATE_PMB887X_CLC(clc, pmb887x_adc_t),
+		VMSTATE_PMB887X_SRC_ARRAY(src, pmb887x_adc_t, 2),
+		VMSTATE_UINT32(pllcon, pmb887x_adc_t),
+		VMSTATE_UINT32(con0, pmb887x_adc_t),
+		VMSTATE_UINT32(con1, pmb887x_adc_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property adc_properties[] = {
 	DEFINE_PROP_LINK("pll", pmb887x_adc_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
     DEFINE_PROP_END_OF_LIST(),
@@ -350,6 +366,7 @@ static void adc_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, adc_properties);
 	dc->realize = adc_realize;
+	dc->vmsd = &adc_vmstate;
 }
 
 static const TypeInfo adc_info = {
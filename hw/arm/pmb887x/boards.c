@@ -348,6 +348,48 @@ static bool _parse_keyboard(pmb887x_board_t *board, pmb887x_cfg_section_t *secti
 	return true;
 }
 
+static bool _parse_hle(pmb887x_board_t *board, pmb887x_cfg_section_t *section) {
+	for (size_t i = 0; i < section->items_count; i++) {
+		pmb887x_cfg_item_t *item = &section->items[i];
+		
+		if (strcmp(item->key, "verify") == 0) {
+			board->hle_verify = strtol(item->value, NULL, 10) != 0;
+			continue;
+		}
+		
+		g_autoptr(GMatchInfo) hle_match = _regexp_match("^(\\w+):([a-f0-9]+)(:([a-f0-9]*))?$", item->value);
+		if (!hle_match) {
+			error_report("Invalid [hle] config %s=%s, expected type:addr[:signature]", item->key, item->value);
+			return false;
+		}
+		
+		g_autofree char *type = g_match_info_fetch(hle_match, 1);
+		g_autofree char *addr = g_match_info_fetch(hle_match, 2);
+		g_autofree char *signature = g_match_info_fetch(hle_match, 4);
+		size_t signature_len = signature ? strlen(signature) : 0;
+		
+		if ((signature_len % 2) != 0) {
+			error_report("Invalid [hle] signature %s=%s", item->key, item->value);
+			return false;
+		}
+		
+		board->hle_count++;
+		board->hle = g_realloc_n(board->hle, board->hle_count, sizeof(pmb887x_board_hle_t));
+		
+		pmb887x_board_hle_t *hle = &board->hle[board->hle_count - 1];
+		memset(hle, 0, sizeof(*hle));
+		strncpy(hle->name, item->key, sizeof(hle->name) - 1);
+		strncpy(hle->type, type, sizeof(hle->type) - 1);
+		hle->addr = strtoul(addr, NULL, 16);
+		
+		hle->signature_size = signature_len / 2;
+		hle->signature = signature_len ? g_malloc(hle->signature_size) : NULL;
+		for (uint32_t j = 0; j < hle->signature_size; j++)
+			hle->signature[j] = (g_ascii_xdigit_value(signature[j * 2]) << 4) | g_ascii_xdigit_value(signature[j * 2 + 1]);
+	}
+	return true;
+}
+
 const pmb887x_board_t *pmb887x_get_board(const char *config_file) {
 	pmb887x_board_t *board = g_new0(pmb887x_board_t, 1);
 	
@@ -368,6 +410,7 @@ const pmb887x_board_t *pmb887x_get_board(const char *config_file) {
 		{"gpio-aliases", _parse_gpio_aliases, false},
 		{"gpio-inputs", _parse_gpio_inputs, false},
 		{"keyboard", _parse_keyboard, false},
+		{"hle", _parse_hle, false},
 	};
 	
 	for (size_t i = 0; i < ARRAY_SIZE(parsers); i++) {		
@@ -40,6 +40,14 @@ typedef struct {
 	uint8_t addr;
 } pmb887x_board_i2c_dev_t;
 
+typedef struct {
+	char name[64];
+	char type[32];
+	uint32_t addr;				// bit 0 - thumb
+	uint8_t *signature;			// expected code bytes at addr
+	uint32_t signature_size;
+} pmb887x_board_hle_t;
+
 typedef struct {
 	char vendor[64];
 	char model[64];
@@ -60,6 +68,11 @@ typedef struct {
 	
 	pmb887x_board_gpio_t *gpios;
 	uint32_t gpios_count;
+	
+	// Native firmware routines
+	pmb887x_board_hle_t *hle;
+	uint32_t hle_count;
+	bool hle_verify;
 } pmb887x_board_t;
 
 const pmb887x_board_t *pmb887x_get_board(const char *config);
@@ -16,6 +16,7 @@
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/regs.h"
@@ -347,6 +348,42 @@ static void capcom_realize(DeviceState *dev, Error **errp) {
 	capcom_update_state(p);
 }
 
+static int capcom_post_load(void *opaque, int version_id) {
+	capcom_update_state((struct pmb887x_capcom_t *) opaque);
+	return 0;
+}
+
+static const VMStateDescription capcom_vmstate = {
+	.name = TYPE_PMB887X_CAPCOM,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = capcom_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_SRC_ARRAY(t_src, struct pmb887x_capcom_t, 2),
+		VMSTATE_PMB887X_SRC_ARRAY(cc_src, struct pmb887x_capcom_t, 8),
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(pisel, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t01con, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(ccm0, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(ccm1, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(out, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(ioc, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(sem, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(see, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(drm, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(whbssee, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(whbcsee, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t0, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t0rel, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t1, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t1rel, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(t01ocr, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(whbsout, struct pmb887x_capcom_t),
+		VMSTATE_UINT32(whbcout, struct pmb887x_capcom_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property capcom_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -355,6 +392,7 @@ static void capcom_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, capcom_properties);
 	dc->realize = capcom_realize;
+	dc->vmsd = &capcom_vmstate;
 }
 
 static const TypeInfo capcom_info = {
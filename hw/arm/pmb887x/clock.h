@@ -0,0 +1,52 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+
+/*
+ * Precomputed ns <-> ticks conversion for module counters.
+ * Recalculated only when module frequency changes, so conversion on timer reads is a multiply and shift.
+ * */
+#define PMB887X_CLOCK_TICKS_SHIFT	56		// ticks per ns, fixed point
+#define PMB887X_CLOCK_NS_SHIFT		32		// ns per tick, fixed point
+
+typedef struct {
+	uint32_t freq;
+	uint64_t ticks_per_ns;
+	uint64_t ns_per_tick;
+} pmb887x_clock_scale_t;
+
+static inline void pmb887x_clock_scale_set(pmb887x_clock_scale_t *scale, uint32_t freq) {
+	scale->freq = freq;
+	
+	if (!freq) {
+		scale->ticks_per_ns = 0;
+		scale->ns_per_tick = 0;
+		return;
+	}
+	
+	uint64_t lo = (uint64_t) freq << PMB887X_CLOCK_TICKS_SHIFT;
+	uint64_t hi = (uint64_t) freq >> (64 - PMB887X_CLOCK_TICKS_SHIFT);
+	divu128(&lo, &hi, NANOSECONDS_PER_SECOND);
+	scale->ticks_per_ns = lo;
+	
+	// Rounded up: timer deadlines never fire before the counter reaches the target
+	scale->ns_per_tick = DIV_ROUND_UP(NANOSECONDS_PER_SECOND << PMB887X_CLOCK_NS_SHIFT, freq);
+}
+
+static inline uint64_t pmb887x_clock_scale_mul(uint64_t value, uint64_t mult, int shift) {
+	uint64_t lo, hi;
+	mulu64(&lo, &hi, value, mult);
+	if (hi >> shift)
+		return UINT64_MAX;
+	return (hi << (64 - shift)) | (lo >> shift);
+}
+
+static inline uint64_t pmb887x_clock_ns_to_ticks(const pmb887x_clock_scale_t *scale, uint64_t ns) {
+	return pmb887x_clock_scale_mul(ns, scale->ticks_per_ns, PMB887X_CLOCK_TICKS_SHIFT);
+}
+
+static inline uint64_t pmb887x_clock_ticks_to_ns(const pmb887x_clock_scale_t *scale, uint64_t ticks) {
+	return pmb887x_clock_scale_mul(ticks, scale->ns_per_tick, PMB887X_CLOCK_NS_SHIFT);
+}
@@ -10,6 +10,7 @@
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
+#include "hw/arm/pmb887x/mmio_profile.h"
 
 struct  pmb887x_i2c_dev_map {
 	const char *type;
@@ -282,6 +283,15 @@ static const struct pmb887x_dev pmb8876_devices[] = {
 		.irqs	= {
 			0
 		}
+	},
+	{
+		.name	= "MCI",
+		.dev	= "pmb887x-mci",
+		.base	= PMB8876_MCI_BASE,
+		.irqs	= {
+			PMB8876_MCI_IRQ,
+			0
+		}
 	}
 };
 
@@ -583,6 +593,7 @@ DeviceState *pmb887x_new_dev(uint32_t cpu_type, const char *name, DeviceState *n
 			qdev_prop_set_uint32(dev, "cpu_type", cpu_type);
 		
 		sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, device->base);
+		pmb887x_mmio_profile_attach(sysbus_mmio_get_region(SYS_BUS_DEVICE(dev), 0), device->name, device->base);
 		
 		return dev;
 	}
@@ -12,6 +12,7 @@
 #include "qemu/timer.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/bswap.h"
 #include "qom/object.h"
 #include "hw/qdev-properties.h"
 
@@ -52,6 +53,24 @@ static void dif_update_state(pmb887x_dif_t *p) {
 	
 }
 
+static uint32_t dif_get_burst_size(pmb887x_dif_t *p) {
+	return ((p->fifocfg & DIF_FIFOCFG_BS) >> DIF_FIFOCFG_BS_SHIFT) + 1;
+}
+
+static void dif_dma_sink(void *opaque, const uint8_t *data, uint32_t size, uint32_t width) {
+	pmb887x_dif_t *p = (pmb887x_dif_t *) opaque;
+	uint32_t burst_size = dif_get_burst_size(p);
+	
+	if (burst_size == width && pmb887x_lcd_is_ram_write(p->lcd)) {
+		pmb887x_lcd_write_pixels(p->lcd, data, size);
+		return;
+	}
+	
+	// Commands or partial FIFO words
+	for (uint32_t i = 0; i < size; i += width)
+		pmb887x_lcd_write(p->lcd, ldn_le_p(&data[i], width), burst_size);
+}
+
 static int dif_get_index_from_reg(uint32_t reg) {
 	switch (reg) {
 		case DIF_PROG0:		return 0;
@@ -190,7 +209,7 @@ static void dif_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 		break;
 		
 		case DIF_FIFO ... (DIF_FIFO + DIF_FIFO_SIZE - 1):
-			pmb887x_lcd_write(p->lcd, value, ((p->fifocfg & DIF_FIFOCFG_BS) >> DIF_FIFOCFG_BS_SHIFT) + 1);
+			pmb887x_lcd_write(p->lcd, value, dif_get_burst_size(p));
 		break;
 		
 		case DIF_PROG0:
@@ -279,8 +298,27 @@ static void dif_realize(DeviceState *dev, Error **errp) {
 	pmb887x_dif_t *p = PMB887X_DIF(dev);
 	pmb887x_clc_init(&p->clc);
 	pmb887x_srb_init(&p->srb, p->irq, ARRAY_SIZE(p->irq));
+	
+	if (p->dmac)
+		pmb887x_dmac_set_sink(p->dmac, p->dmac_tx_periph_id, &p->mmio, DIF_FIFO, DIF_FIFO_SIZE, dif_dma_sink, p);
 }
 
+static const VMStateDescription dif_vmstate = {
+	.name = TYPE_PMB887X_DIF,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(runctrl, pmb887x_dif_t),
+		VMSTATE_UINT32_ARRAY(prog, pmb887x_dif_t, 6),
+		VMSTATE_UINT32_ARRAY(con, pmb887x_dif_t, 15),
+		VMSTATE_UINT32(fifocfg, pmb887x_dif_t),
+		VMSTATE_UINT32(tx_size, pmb887x_dif_t),
+		VMSTATE_PMB887X_CLC(clc, pmb887x_dif_t),
+		VMSTATE_PMB887X_SRB(srb, pmb887x_dif_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property dif_properties[] = {
 	DEFINE_PROP_LINK("dmac", pmb887x_dif_t, dmac, "pmb887x-dmac", pmb887x_dmac_t *),
 	DEFINE_PROP_LINK("lcd", pmb887x_dif_t, lcd, "pmb887x-lcd", pmb887x_lcd_t *),
@@ -292,6 +330,7 @@ static void dif_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, dif_properties);
 	dc->realize = dif_realize;
+	dc->vmsd = &dif_vmstate;
 }
 
 static const TypeInfo dif_info = {
@@ -0,0 +1,307 @@
+/*
+ * Headless LCD frame capture
+ *
+ * Frames are taken from the LCD buffer on a virtual clock timer and converted/encoded in a worker thread.
+ *
+ * Properties (for example: -global pmb887x-lcd.capture=frames.bin):
+ *   capture=path				output file
+ *   capture-chardev=id			output chardev (socket, pipe, ...)
+ *   capture-format=raw|png|hash
+ *   capture-interval=ms		virtual time between frames, default: 40
+ *   capture-on-change=on|off	skip frames without LCD writes, default: on
+ *
+ * raw/png: stream of pmb887x_lcd_capture_hdr_t + payload (RGB888 rows or PNG file).
+ * hash: one text line per frame: "<frame> <vtime_ns> <icount> <width>x<height> <hash>".
+ * Hash is 64-bit FNV-1a of RGB888 pixels, so it doesn't depend on the panel pixel format.
+ * */
+#define PMB887X_TRACE_ID		LCD
+#define PMB887X_TRACE_PREFIX	"pmb887x-lcd-capture"
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
+#include "block/aio.h"
+#include "sysemu/cpu-timers.h"
+#include "hw/arm/pmb887x/trace.h"
+#include "hw/arm/pmb887x/dif/lcd_common.h"
+
+#include <zlib.h>
+
+#define CAPTURE_MAX_PENDING	8
+
+enum {
+	CAPTURE_FORMAT_RAW,
+	CAPTURE_FORMAT_PNG,
+	CAPTURE_FORMAT_HASH,
+};
+
+typedef struct QEMU_PACKED {
+	char magic[4]; // PMBF
+	uint16_t version;
+	uint16_t format;
+	uint32_t width;
+	uint32_t height;
+	uint64_t vtime;
+	uint64_t icount;
+	uint64_t hash;
+	uint32_t size;
+} pmb887x_lcd_capture_hdr_t;
+
+typedef struct {
+	pmb887x_lcd_t *lcd;
+	uint64_t frame;
+	uint64_t vtime;
+	uint64_t icount;
+	pixman_format_code_t format;
+	uint32_t width;
+	uint32_t height;
+	uint8_t *pixels;
+	GByteArray *out;
+} pmb887x_lcd_capture_job_t;
+
+struct pmb887x_lcd_capture_t {
+	int format;
+	FILE *fp;
+	QEMUTimer *timer;
+	QemuThread thread;
+	GAsyncQueue *queue;
+	uint32_t pending;
+	uint64_t frames;
+	uint64_t dropped;
+};
+
+static void capture_rgb888(pmb887x_lcd_capture_job_t *job, uint8_t *rgb) {
+	uint32_t stride = job->width * (PIXMAN_FORMAT_BPP(job->format) / 8);
+	pixman_image_t *src = pixman_image_create_bits(job->format, job->width, job->height, (uint32_t *) job->pixels, stride);
+	pixman_image_t *dst = pixman_image_create_bits(PIXMAN_x8r8g8b8, job->width, job->height, NULL, job->width * 4);
+	
+	pixman_image_composite(PIXMAN_OP_SRC, src, NULL, dst, 0, 0, 0, 0, 0, 0, job->width, job->height);
+	
+	uint32_t *px = pixman_image_get_data(dst);
+	for (uint32_t i = 0; i < job->width * job->height; i++) {
+		*rgb++ = (px[i] >> 16) & 0xFF;
+		*rgb++ = (px[i] >> 8) & 0xFF;
+		*rgb++ = px[i] & 0xFF;
+	}
+	
+	pixman_image_unref(src);
+	pixman_image_unref(dst);
+}
+
+static uint64_t capture_hash(const uint8_t *data, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static void capture_png_chunk(GByteArray *out, const char *type, const uint8_t *data, uint32_t size) {
+	uint32_t be_size = cpu_to_be32(size);
+	g_byte_array_append(out, (const uint8_t *) &be_size, 4);
+	g_byte_array_append(out, (const uint8_t *) type, 4);
+	if (size)
+		g_byte_array_append(out, data, size);
+	
+	uint32_t crc = crc32(0, (const Bytef *) type, 4);
+	if (size)
+		crc = crc32(crc, data, size);
+	crc = cpu_to_be32(crc);
+	g_byte_array_append(out, (const uint8_t *) &crc, 4);
+}
+
+static void capture_png(GByteArray *out, const uint8_t *rgb, uint32_t width, uint32_t height) {
+	static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint32_t row_size = width * 3;
+	
+	// Filter type 0 for every row
+	g_autofree uint8_t *raw = g_malloc(height * (row_size + 1));
+	for (uint32_t y = 0; y < height; y++) {
+		raw[y * (row_size + 1)] = 0;
+		memcpy(&raw[y * (row_size + 1) + 1], &rgb[y * row_size], row_size);
+	}
+	
+	uLongf zsize = compressBound(height * (row_size + 1));
+	g_autofree uint8_t *zdata = g_malloc(zsize);
+	if (compress2(zdata, &zsize, raw, height * (row_size + 1), Z_BEST_SPEED) != Z_OK) {
+		error_report("[pmb887x-lcd-capture] PNG compression failed");
+		exit(1);
+	}
+	
+	uint8_t ihdr[13];
+	stl_be_p(&ihdr[0], width);
+	stl_be_p(&ihdr[4], height);
+	ihdr[8] = 8;	// bit depth
+	ihdr[9] = 2;	// RGB
+	ihdr[10] = 0;	// deflate
+	ihdr[11] = 0;	// adaptive filter
+	ihdr[12] = 0;	// no interlace
+	
+	g_byte_array_append(out, signature, sizeof(signature));
+	capture_png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+	capture_png_chunk(out, "IDAT", zdata, zsize);
+	capture_png_chunk(out, "IEND", NULL, 0);
+}
+
+static void capture_encode(pmb887x_lcd_capture_t *c, pmb887x_lcd_capture_job_t *job) {
+	size_t rgb_size = job->width * job->height * 3;
+	g_autofree uint8_t *rgb = g_malloc(rgb_size);
+	
+	capture_rgb888(job, rgb);
+	uint64_t hash = capture_hash(rgb, rgb_size);
+	
+	job->out = g_byte_array_new();
+	
+	if (c->format == CAPTURE_FORMAT_HASH) {
+		g_autofree char *line = g_strdup_printf("%"PRIu64" %"PRIu64" %"PRIu64" %ux%u %016"PRIx64"\n",
+			job->frame, job->vtime, job->icount, job->width, job->height, hash);
+		g_byte_array_append(job->out, (const uint8_t *) line, strlen(line));
+		return;
+	}
+	
+	pmb887x_lcd_capture_hdr_t hdr = {
+		.magic		= { 'P', 'M', 'B', 'F' },
+		.version	= 1,
+		.format		= c->format,
+		.width		= job->width,
+		.height		= job->height,
+		.vtime		= job->vtime,
+		.icount		= job->icount,
+		.hash		= hash,
+	};
+	
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	if (c->format == CAPTURE_FORMAT_PNG) {
+		capture_png(payload, rgb, job->width, job->height);
+	} else {
+		g_byte_array_append(payload, rgb, rgb_size);
+	}
+	
+	hdr.size = payload->len;
+	g_byte_array_append(job->out, (const uint8_t *) &hdr, sizeof(hdr));
+	g_byte_array_append(job->out, payload->data, payload->len);
+}
+
+static void capture_job_free(pmb887x_lcd_capture_job_t *job) {
+	if (job->out)
+		g_byte_array_unref(job->out);
+	g_free(job->pixels);
+	g_free(job);
+}
+
+// Chardev is not thread safe, write from the main loop
+static void capture_write_chr(void *opaque) {
+	pmb887x_lcd_capture_job_t *job = (pmb887x_lcd_capture_job_t *) opaque;
+	pmb887x_lcd_t *lcd = job->lcd;
+	
+	qemu_chr_fe_write_all(&lcd->capture_chr, job->out->data, job->out->len);
+	qatomic_dec(&lcd->capture->pending);
+	capture_job_free(job);
+}
+
+static void *capture_thread(void *arg) {
+	pmb887x_lcd_capture_t *c = (pmb887x_lcd_capture_t *) arg;
+	
+	while (true) {
+		pmb887x_lcd_capture_job_t *job = g_async_queue_pop(c->queue);
+		
+		capture_encode(c, job);
+		
+		if (c->fp) {
+			if (fwrite(job->out->data, job->out->len, 1, c->fp) != 1) {
+				error_report("[pmb887x-lcd-capture] write error: %s", strerror(errno));
+				exit(1);
+			}
+			fflush(c->fp);
+		}
+		
+		if (qemu_chr_fe_backend_connected(&job->lcd->capture_chr)) {
+			aio_bh_schedule_oneshot(qemu_get_aio_context(), capture_write_chr, job);
+			continue;
+		}
+		
+		qatomic_dec(&c->pending);
+		capture_job_free(job);
+	}
+	return NULL;
+}
+
+static void capture_timer(void *opaque) {
+	pmb887x_lcd_t *lcd = (pmb887x_lcd_t *) opaque;
+	pmb887x_lcd_capture_t *c = lcd->capture;
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	
+	timer_mod(c->timer, now + (int64_t) lcd->capture_interval * SCALE_MS);
+	
+	if (!lcd->buffer || (lcd->capture_on_change && !lcd->capture_changed))
+		return;
+	
+	if (qatomic_read(&c->pending) >= CAPTURE_MAX_PENDING) {
+		c->dropped++;
+		WPRINTF("frame %"PRIu64" dropped, worker is too slow\n", c->frames);
+		return;
+	}
+	
+	// Surface size, width/height can be swapped by mirror_xy after surface was created
+	pmb887x_lcd_capture_job_t *job = g_new0(pmb887x_lcd_capture_job_t, 1);
+	job->lcd = lcd;
+	job->frame = c->frames++;
+	job->vtime = now;
+	job->icount = icount_enabled() ? icount_get_raw() : 0;
+	job->format = lcd->format;
+	job->width = lcd->dirty_width;
+	job->height = lcd->buffer_size / (lcd->dirty_width * lcd->byte_pp);
+	job->pixels = g_memdup2(lcd->buffer, lcd->buffer_size);
+	
+	lcd->capture_changed = false;
+	
+	qatomic_inc(&c->pending);
+	g_async_queue_push(c->queue, job);
+}
+
+void pmb887x_lcd_capture_init(pmb887x_lcd_t *lcd) {
+	if (!lcd->capture_path && !qemu_chr_fe_backend_connected(&lcd->capture_chr))
+		return;
+	
+	pmb887x_lcd_capture_t *c = g_new0(pmb887x_lcd_capture_t, 1);
+	
+	if (!lcd->capture_format || strcmp(lcd->capture_format, "raw") == 0) {
+		c->format = CAPTURE_FORMAT_RAW;
+	} else if (strcmp(lcd->capture_format, "png") == 0) {
+		c->format = CAPTURE_FORMAT_PNG;
+	} else if (strcmp(lcd->capture_format, "hash") == 0) {
+		c->format = CAPTURE_FORMAT_HASH;
+	} else {
+		error_report("Invalid capture-format=%s, expected: raw, png, hash", lcd->capture_format);
+		exit(1);
+	}
+	
+	if (!lcd->capture_interval) {
+		error_report("capture-interval must be > 0");
+		exit(1);
+	}
+	
+	if (lcd->capture_path) {
+		c->fp = fopen(lcd->capture_path, c->format == CAPTURE_FORMAT_HASH ? "w" : "wb");
+		if (!c->fp) {
+			error_report("fopen(%s): %s", lcd->capture_path, strerror(errno));
+			exit(1);
+		}
+	}
+	
+	lcd->capture = c;
+	lcd->capture_changed = true;
+	
+	c->queue = g_async_queue_new();
+	qemu_thread_create(&c->thread, "lcd_capture", capture_thread, c, QEMU_THREAD_DETACHED);
+	
+	c->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, capture_timer, lcd);
+	timer_mod(c->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + (int64_t) lcd->capture_interval * SCALE_MS);
+	
+	DPRINTF("capture to %s, format: %s, every %u ms\n", lcd->capture_path ? lcd->capture_path : "chardev",
+		lcd->capture_format ? lcd->capture_format : "raw", lcd->capture_interval);
+}
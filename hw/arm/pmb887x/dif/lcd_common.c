@@ -3,9 +3,11 @@
 
 #include "qemu/osdep.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "qemu/error-report.h"
+#include "qemu/bitmap.h"
 #include "migration/vmstate.h"
 #include "hw/arm/pmb887x/trace.h"
 #include "hw/arm/pmb887x/fifo.h"
@@ -17,6 +19,9 @@
 
 #define LCD_CMD_MAX_PARAMS 64
 
+// Dirty tracking granularity: 16x16 px
+#define LCD_DIRTY_TILE_SHIFT	4
+
 #define __SWAP_VALUES(a, b)		\
 	do {						\
 		typeof(a) temp = a;		\
@@ -48,16 +53,36 @@ static const char *pmb887x_lcd_get_mode_name(enum pmb887x_lcd_pixel_mode_t mode)
 	return "UNKNOWN";
 }
 
-void pmb887x_lcd_set_mode(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_mode_t mode) {
-	if (lcd->mode == mode)
-		return;
-	
+static void pmb887x_lcd_free_surface(pmb887x_lcd_t *lcd) {
 	if (lcd->surface)
 		qemu_free_displaysurface(lcd->surface);
 	
 	if (lcd->buffer)
 		g_free(lcd->buffer);
 	
+	if (lcd->dirty)
+		g_free(lcd->dirty);
+	
+	lcd->surface = NULL;
+	lcd->buffer = NULL;
+	lcd->dirty = NULL;
+}
+
+static void pmb887x_lcd_create_surface(pmb887x_lcd_t *lcd, uint32_t width, uint32_t height) {
+	uint32_t linesize = (width * lcd->byte_pp);
+	lcd->surface = qemu_create_displaysurface_from(width, height, lcd->format, linesize, lcd->buffer);
+	dpy_gfx_replace_surface(lcd->console, lcd->surface);
+	
+	lcd->dirty_width = width;
+	lcd->dirty_cols = DIV_ROUND_UP(width, 1 << LCD_DIRTY_TILE_SHIFT);
+	lcd->dirty_rows = DIV_ROUND_UP(height, 1 << LCD_DIRTY_TILE_SHIFT);
+	lcd->dirty = bitmap_new(lcd->dirty_cols * lcd->dirty_rows);
+	lcd->dirty_any = false;
+	lcd->invalidate = true;
+	lcd->capture_changed = true;
+}
+
+static void pmb887x_lcd_set_format(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_mode_t mode) {
 	switch (mode) {
 		case LCD_MODE_BGR565:
 			lcd->bpp = 16;
@@ -100,14 +125,19 @@ void pmb887x_lcd_set_mode(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_mode_t mode
 			exit(1);
 		break;
 	}
+}
+
+void pmb887x_lcd_set_mode(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_mode_t mode) {
+	if (lcd->mode == mode)
+		return;
+	
+	pmb887x_lcd_free_surface(lcd);
+	pmb887x_lcd_set_format(lcd, mode);
 	
 	lcd->mode = mode;
 	lcd->buffer_size = (lcd->width * lcd->height * lcd->byte_pp);
 	lcd->buffer = g_new0(uint8_t, lcd->buffer_size);
-	
-	uint32_t linesize = (lcd->width * lcd->byte_pp);
-	lcd->surface = qemu_create_displaysurface_from(lcd->width, lcd->height, lcd->format, linesize, lcd->buffer);
-	dpy_gfx_replace_surface(lcd->console, lcd->surface);
+	pmb887x_lcd_create_surface(lcd, lcd->width, lcd->height);
 	
 	DPRINTF("mode %s, bpp: %d [%dB], buffer: %d\n", pmb887x_lcd_get_mode_name(lcd->mode), lcd->bpp, lcd->byte_pp, lcd->buffer_size);
 }
@@ -148,6 +178,35 @@ static void pmb887x_lcd_incr_px(pmb887x_lcd_t *lcd) {
 	}
 }
 
+static inline void pmb887x_lcd_mark_dirty(pmb887x_lcd_t *lcd, uint32_t pixel_index) {
+	// Surface coordinates, width/height can be swapped by mirror_xy after surface was created
+	uint32_t x = pixel_index % lcd->dirty_width;
+	uint32_t y = pixel_index / lcd->dirty_width;
+	set_bit((y >> LCD_DIRTY_TILE_SHIFT) * lcd->dirty_cols + (x >> LCD_DIRTY_TILE_SHIFT), lcd->dirty);
+	lcd->dirty_any = true;
+	lcd->capture_changed = true;
+}
+
+// Conservative: rows first..last, columns between both ends (full rows if span crosses rows with different x)
+static void pmb887x_lcd_mark_dirty_range(pmb887x_lcd_t *lcd, uint32_t first, uint32_t last) {
+	uint32_t y1 = first / lcd->dirty_width;
+	uint32_t y2 = last / lcd->dirty_width;
+	uint32_t x1 = MIN(first % lcd->dirty_width, last % lcd->dirty_width);
+	uint32_t x2 = MAX(first % lcd->dirty_width, last % lcd->dirty_width);
+	
+	if (y1 != y2 && x1 != x2) {
+		x1 = 0;
+		x2 = lcd->dirty_width - 1;
+	}
+	
+	uint32_t col = x1 >> LCD_DIRTY_TILE_SHIFT;
+	uint32_t cols = (x2 >> LCD_DIRTY_TILE_SHIFT) - col + 1;
+	for (uint32_t row = y1 >> LCD_DIRTY_TILE_SHIFT; row <= (y2 >> LCD_DIRTY_TILE_SHIFT); row++)
+		bitmap_set(lcd->dirty, row * lcd->dirty_cols + col, cols);
+	lcd->dirty_any = true;
+	lcd->capture_changed = true;
+}
+
 static void pmb887x_lcd_write_pixel_byte(pmb887x_lcd_t *lcd, uint8_t byte) {
 	uint32_t pixel_index = pmb887x_lcd_get_px_index(lcd);
 	lcd->buffer[pixel_index * lcd->byte_pp + lcd->tmp_index] = byte;
@@ -155,11 +214,77 @@ static void pmb887x_lcd_write_pixel_byte(pmb887x_lcd_t *lcd, uint8_t byte) {
 	
 	if (lcd->tmp_index == lcd->byte_pp) {
 		lcd->tmp_index = 0;
-		lcd->invalidate = true;
+		pmb887x_lcd_mark_dirty(lcd, pixel_index);
 		pmb887x_lcd_incr_px(lcd);
 	}
 }
 
+/*
+ * Write whole pixels to the current window position.
+ * Pixels are written in runs up to the end of current window line, horizontal increment is a single memcpy.
+ * */
+static uint32_t pmb887x_lcd_write_pixels_run(pmb887x_lcd_t *lcd, const uint8_t *data, uint32_t count) {
+	uint32_t pixel_index = pmb887x_lcd_get_px_index(lcd);
+	uint32_t *pos;
+	uint32_t pos_end;
+	int32_t step;
+	
+	if (lcd->am == LCD_AM_VERTICAL) {
+		pos = &lcd->buffer_y;
+		pos_end = lcd->window_y2;
+		step = lcd->ac_y == LCD_AC_INC ? (int32_t) lcd->width : -(int32_t) lcd->width;
+	} else {
+		pos = &lcd->buffer_x;
+		pos_end = lcd->window_x2;
+		step = lcd->ac_x == LCD_AC_INC ? 1 : -1;
+	}
+	
+	// Outside of window: single pixel, pmb887x_lcd_incr_px() wraps it back
+	uint32_t n = *pos <= pos_end ? MIN(pos_end - *pos + 1, count) : 1;
+	uint32_t last_index = pixel_index + (n - 1) * step;
+	
+	if (step == 1) {
+		memcpy(&lcd->buffer[pixel_index * lcd->byte_pp], data, n * lcd->byte_pp);
+	} else {
+		for (uint32_t i = 0; i < n; i++)
+			memcpy(&lcd->buffer[(pixel_index + i * step) * lcd->byte_pp], &data[i * lcd->byte_pp], lcd->byte_pp);
+	}
+	
+	pmb887x_lcd_mark_dirty_range(lcd, MIN(pixel_index, last_index), MAX(pixel_index, last_index));
+	
+	*pos += n - 1;
+	pmb887x_lcd_incr_px(lcd);
+	
+	return n;
+}
+
+void pmb887x_lcd_write_pixels(pmb887x_lcd_t *lcd, const uint8_t *data, uint32_t size) {
+	if (!lcd->buffer) {
+		DPRINTF("pixel data ignored, mode is not set\n");
+		return;
+	}
+	
+	// Finish previous partial pixel
+	while (lcd->tmp_index != 0 && size > 0) {
+		pmb887x_lcd_write_pixel_byte(lcd, *data++);
+		size--;
+	}
+	
+	uint32_t count = size / lcd->byte_pp;
+	while (count > 0) {
+		uint32_t n = pmb887x_lcd_write_pixels_run(lcd, data, count);
+		data += n * lcd->byte_pp;
+		size -= n * lcd->byte_pp;
+		count -= n;
+	}
+	
+	// Start of the next partial pixel
+	while (size > 0) {
+		pmb887x_lcd_write_pixel_byte(lcd, *data++);
+		size--;
+	}
+}
+
 static void pmb887x_lcd_write_control_byte(pmb887x_lcd_t *lcd, uint8_t value) {
 	pmb887x_lcd_class_t *k = PMB887X_LCD_GET_CLASS(lcd);
 	
@@ -219,6 +344,14 @@ void pmb887x_lcd_write(pmb887x_lcd_t *lcd, uint32_t value, uint32_t size) {
 	if (lcd->cd && lcd->wr_state == LCD_WR_STATE_RAM)
 		pmb887x_lcd_set_ram_mode(lcd, false);
 	
+	if (lcd->wr_state == LCD_WR_STATE_RAM) {
+		uint8_t bytes[4];
+		for (uint32_t i = 0; i < size; i++)
+			bytes[i] = (value >> (i * 8)) & 0xFF;
+		pmb887x_lcd_write_pixels(lcd, bytes, size);
+		return;
+	}
+	
 	for (uint32_t i = 0; i < size; i++) {
 		if (lcd->wr_state == LCD_WR_STATE_RAM) {
 			pmb887x_lcd_write_pixel_byte(lcd, (value >> (i * 8)) & 0xFF);
@@ -259,13 +392,44 @@ static void pmb887x_lcd_clear_fifo(pmb887x_lcd_t *lcd) {
 static void pmb887x_lcd_update_display(void *opaque) {
 	pmb887x_lcd_t *lcd = (pmb887x_lcd_t *) opaque;
 	
-	if (!lcd->invalidate || !lcd->surface)
+	if (!lcd->surface)
+		return;
+	
+	int surface_w = surface_width(lcd->surface);
+	int surface_h = surface_height(lcd->surface);
+	
+	if (lcd->invalidate) {
+		dpy_gfx_update(lcd->console, 0, 0, surface_w, surface_h);
+		bitmap_zero(lcd->dirty, lcd->dirty_cols * lcd->dirty_rows);
+		lcd->invalidate = false;
+		lcd->dirty_any = false;
+		return;
+	}
+	
+	if (!lcd->dirty_any)
 		return;
 	
-	dpy_gfx_update(lcd->console, 0, 0, lcd->width, lcd->height);
+	// One rectangle per horizontal run of dirty tiles
+	for (uint32_t row = 0; row < lcd->dirty_rows; row++) {
+		unsigned long *bits = lcd->dirty;
+		uint32_t start = row * lcd->dirty_cols;
+		uint32_t end = start + lcd->dirty_cols;
+		uint32_t col = find_next_bit(bits, end, start);
+		
+		while (col < end) {
+			uint32_t run_end = find_next_zero_bit(bits, end, col);
+			int x = (col - start) << LCD_DIRTY_TILE_SHIFT;
+			int y = row << LCD_DIRTY_TILE_SHIFT;
+			int w = MIN((run_end - start) << LCD_DIRTY_TILE_SHIFT, surface_w) - x;
+			int h = MIN(1 << LCD_DIRTY_TILE_SHIFT, surface_h - y);
+			
+			dpy_gfx_update(lcd->console, x, y, w, h);
+			col = find_next_bit(bits, end, run_end);
+		}
+	}
 	
-	// TODO: partial update
-	lcd->invalidate = false;
+	bitmap_zero(lcd->dirty, lcd->dirty_cols * lcd->dirty_rows);
+	lcd->dirty_any = false;
 }
 
 static void pmb887x_lcd_invalidate_display(void *opaque) {
@@ -338,8 +502,6 @@ void pmb887x_lcd_set_ram_mode(pmb887x_lcd_t *lcd, bool flag) {
 	DPRINTF("write mode: %s\n", flag ? "ram" : "cmd");
 	lcd->wr_state = flag ? LCD_WR_STATE_RAM : LCD_WR_STATE_NONE;
 	lcd->tmp_index = 0;
-	if (!flag)
-		lcd->invalidate = true;
 	pmb887x_lcd_clear_fifo(lcd);
 }
 
@@ -359,14 +521,80 @@ void pmb887x_lcd_init(pmb887x_lcd_t *lcd, DeviceState *dev) {
 	
 	pmb887x_lcd_set_window_x2(lcd, lcd->width - 1);
 	pmb887x_lcd_set_window_y2(lcd, lcd->height - 1);
+	
+	pmb887x_lcd_capture_init(lcd);
+}
+
+static int pmb887x_lcd_pre_load(void *opaque) {
+	pmb887x_lcd_t *lcd = (pmb887x_lcd_t *) opaque;
+	// Buffer is allocated by the loader
+	pmb887x_lcd_free_surface(lcd);
+	return 0;
+}
+
+static int pmb887x_lcd_post_load(void *opaque, int version_id) {
+	pmb887x_lcd_t *lcd = (pmb887x_lcd_t *) opaque;
+	
+	if (lcd->mode == LCD_MODE_NONE) {
+		dpy_gfx_replace_surface(lcd->console, NULL);
+		return 0;
+	}
+	
+	pmb887x_lcd_set_format(lcd, lcd->mode);
+	
+	// Surface size is fixed at the moment of set_mode(), width/height can be swapped by mirror_xy later
+	uint32_t linesize = lcd->dirty_width * lcd->byte_pp;
+	if (!linesize || (lcd->buffer_size % linesize) != 0)
+		return -EINVAL;
+	
+	pmb887x_lcd_create_surface(lcd, lcd->dirty_width, lcd->buffer_size / linesize);
+	return 0;
 }
 
+const VMStateDescription vmstate_pmb887x_lcd = {
+	.name = TYPE_PMB887X_LCD,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.pre_load = pmb887x_lcd_pre_load,
+	.post_load = pmb887x_lcd_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_FIFO8(fifo, pmb887x_lcd_t),
+		VMSTATE_BOOL(cd, pmb887x_lcd_t),
+		VMSTATE_UINT32(width, pmb887x_lcd_t),
+		VMSTATE_UINT32(height, pmb887x_lcd_t),
+		VMSTATE_UINT32(mode, pmb887x_lcd_t),
+		VMSTATE_BOOL(mirror_xy, pmb887x_lcd_t),
+		VMSTATE_UINT32(tmp_index, pmb887x_lcd_t),
+		VMSTATE_UINT32(buffer_size, pmb887x_lcd_t),
+		VMSTATE_VBUFFER_ALLOC_UINT32(buffer, pmb887x_lcd_t, 0, NULL, buffer_size),
+		VMSTATE_UINT32(buffer_x, pmb887x_lcd_t),
+		VMSTATE_UINT32(buffer_y, pmb887x_lcd_t),
+		VMSTATE_UINT32(window_x1, pmb887x_lcd_t),
+		VMSTATE_UINT32(window_x2, pmb887x_lcd_t),
+		VMSTATE_UINT32(window_y1, pmb887x_lcd_t),
+		VMSTATE_UINT32(window_y2, pmb887x_lcd_t),
+		VMSTATE_UINT32(wr_state, pmb887x_lcd_t),
+		VMSTATE_UINT32(current_cmd, pmb887x_lcd_t),
+		VMSTATE_UINT32(current_cmd_params, pmb887x_lcd_t),
+		VMSTATE_UINT32(ac_x, pmb887x_lcd_t),
+		VMSTATE_UINT32(ac_y, pmb887x_lcd_t),
+		VMSTATE_UINT32(am, pmb887x_lcd_t),
+		VMSTATE_UINT32(dirty_width, pmb887x_lcd_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property pmb887x_lcd_props[] = {
 	DEFINE_PROP_UINT32("width", pmb887x_lcd_t, width, 240),
 	DEFINE_PROP_UINT32("height", pmb887x_lcd_t, height, 320),
 	DEFINE_PROP_UINT32("rotation", pmb887x_lcd_t, rotation, 0),
 	DEFINE_PROP_BOOL("flip_horizontal", pmb887x_lcd_t, flip_horizontal, false),
 	DEFINE_PROP_BOOL("flip_vertical", pmb887x_lcd_t, flip_vertical, false),
+	DEFINE_PROP_STRING("capture", pmb887x_lcd_t, capture_path),
+	DEFINE_PROP_CHR("capture-chardev", pmb887x_lcd_t, capture_chr),
+	DEFINE_PROP_STRING("capture-format", pmb887x_lcd_t, capture_format),
+	DEFINE_PROP_UINT32("capture-interval", pmb887x_lcd_t, capture_interval, 40),
+	DEFINE_PROP_BOOL("capture-on-change", pmb887x_lcd_t, capture_on_change, true),
 	DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "hw/qdev-core.h"
+#include "migration/vmstate.h"
 #include "qom/object.h"
 #include "ui/pixel_ops.h"
 #include "ui/console.h"
+#include "chardev/char-fe.h"
 #include "hw/arm/pmb887x/fifo.h"
 
 #define TYPE_PMB887X_LCD	"pmb887x-lcd"
@@ -11,6 +13,8 @@ OBJECT_DECLARE_TYPE(pmb887x_lcd_t, pmb887x_lcd_class_t, PMB887X_LCD);
 
 #define LCD_DATA_IS_CMD (1 << 8)
 
+typedef struct pmb887x_lcd_capture_t pmb887x_lcd_capture_t;
+
 enum pmb887x_lcd_ac_t {
 	LCD_AC_DEC,
 	LCD_AC_INC,
@@ -89,6 +93,22 @@ struct pmb887x_lcd_t {
     QemuConsole *console;
 	
 	bool invalidate;
+	
+	// Dirty tiles since last update
+	unsigned long *dirty;
+	uint32_t dirty_width;
+	uint32_t dirty_cols;
+	uint32_t dirty_rows;
+	bool dirty_any;
+	
+	// Headless capture, see lcd_capture.c
+	pmb887x_lcd_capture_t *capture;
+	char *capture_path;
+	char *capture_format;
+	CharBackend capture_chr;
+	uint32_t capture_interval;
+	bool capture_on_change;
+	bool capture_changed;
 };
 
 struct pmb887x_lcd_class_t {
@@ -100,8 +120,15 @@ struct pmb887x_lcd_class_t {
 	void (*on_cmd_with_params)(pmb887x_lcd_t *, uint32_t, const uint32_t *, uint32_t);
 };
 
+extern const VMStateDescription vmstate_pmb887x_lcd;
+
+#define VMSTATE_PMB887X_LCD(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_lcd, pmb887x_lcd_t)
+
 void pmb887x_lcd_init(pmb887x_lcd_t *lcd, DeviceState *dev);
+void pmb887x_lcd_capture_init(pmb887x_lcd_t *lcd);
 void pmb887x_lcd_write(pmb887x_lcd_t *lcd, uint32_t value, uint32_t size);
+void pmb887x_lcd_write_pixels(pmb887x_lcd_t *lcd, const uint8_t *data, uint32_t size);
 void pmb887x_lcd_set_mode(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_mode_t mode);
 void pmb887x_lcd_set_cd(pmb887x_lcd_t *lcd, bool value);
 void pmb887x_lcd_set_ram_mode(pmb887x_lcd_t *lcd, bool flag);
@@ -158,3 +185,7 @@ static inline void pmb887x_lcd_set_y(pmb887x_lcd_t *lcd, uint32_t value) {
 static inline bool pmb887x_lcd_get_cd(pmb887x_lcd_t *lcd) {
 	return lcd->cd;
 }
+
+static inline bool pmb887x_lcd_is_ram_write(pmb887x_lcd_t *lcd) {
+	return !lcd->cd && lcd->wr_state == LCD_WR_STATE_RAM;
+}
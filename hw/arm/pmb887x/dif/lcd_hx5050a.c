@@ -9,6 +9,7 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "migration/vmstate.h"
 #include "hw/arm/pmb887x/trace.h"
 #include "hw/arm/pmb887x/dif/lcd_common.h"
 
@@ -101,6 +102,17 @@ static void lcd_realize(DeviceState *dev, Error **errp) {
 	lcd_update_state(lcd);
 }
 
+static const VMStateDescription lcd_vmstate = {
+	.name = TYPE_PMB887X_LCD_HX5050A,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_LCD(parent, pmb887x_lcd_hx5050a_t),
+		VMSTATE_UINT16_ARRAY(regs, pmb887x_lcd_hx5050a_t, HX5050A_MAX_REGS),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property lcd_properties[] = {
 	DEFINE_PROP_END_OF_LIST(),
 };
@@ -109,6 +121,7 @@ static void lcd_class_init(ObjectClass *oc, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(oc);
 	device_class_set_props(dc, lcd_properties);
 	dc->realize = lcd_realize;
+	dc->vmsd = &lcd_vmstate;
 	
 	pmb887x_lcd_class_t *k = PMB887X_LCD_CLASS(oc);
 	k->cmd_width = 1;
@@ -13,8 +13,10 @@
 #include "cpu.h"
 #include "qapi/error.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
@@ -40,6 +42,22 @@ typedef struct {
 	uint32_t config;
 } pmb887x_dmac_ch_t;
 
+typedef struct {
+	pmb887x_dmac_sink_cb_t cb;
+	void *opaque;
+	MemoryRegion *mr;
+	hwaddr offset;
+	hwaddr size;
+} pmb887x_dmac_sink_t;
+
+typedef struct {
+	pmb887x_dmac_source_cb_t cb;
+	void *opaque;
+	MemoryRegion *mr;
+	hwaddr offset;
+	hwaddr size;
+} pmb887x_dmac_source_t;
+
 struct pmb887x_dmac_t {
 	SysBusDevice parent_obj;
 	MemoryRegion mmio;
@@ -60,6 +78,8 @@ struct pmb887x_dmac_t {
 	uint32_t used_peripherals;
 	
 	uint32_t periph_request[16];
+	pmb887x_dmac_sink_t sinks[16];
+	pmb887x_dmac_source_t sources[16];
 };
 
 static uint32_t dmac_get_width(uint32_t s) {
@@ -68,6 +88,107 @@ static uint32_t dmac_get_width(uint32_t s) {
 	return 1 << s;
 }
 
+static bool dmac_is_periph_range(pmb887x_dmac_t *p, MemoryRegion *periph_mr, hwaddr offset, hwaddr periph_size, hwaddr addr, hwaddr size, bool is_write) {
+	RCU_READ_LOCK_GUARD();
+	hwaddr xlat;
+	hwaddr len = size;
+	MemoryRegion *mr = address_space_translate(&p->downstream_as, addr, &xlat, &len, is_write, MEMTXATTRS_UNSPECIFIED);
+	return mr == periph_mr && len == size && xlat >= offset && xlat + size <= offset + periph_size;
+}
+
+static bool dmac_is_direct_range(pmb887x_dmac_t *p, hwaddr addr, hwaddr size, bool is_write) {
+	RCU_READ_LOCK_GUARD();
+	hwaddr xlat;
+	hwaddr len = size;
+	MemoryRegion *mr = address_space_translate(&p->downstream_as, addr, &xlat, &len, is_write, MEMTXATTRS_UNSPECIFIED);
+	return len == size && memory_access_is_direct(mr, is_write);
+}
+
+/*
+ * RAM -> peripheral FIFO: pass source memory to the peripheral sink without per-element dispatch.
+ * Returns false if transfer is not suitable, nothing is transferred in this case.
+ * */
+static bool dmac_channel_run_sink(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch, uint8_t dst_periph, uint32_t src_width, uint32_t dst_width, uint32_t tx_size) {
+	pmb887x_dmac_sink_t *sink = &p->sinks[dst_periph];
+	
+	if (!sink->cb || !(ch->control & DMAC_CH_CONTROL_SI))
+		return false;
+	
+	// Source is a contiguous byte stream, the tail which doesn't fill dst element is dropped (same as element loop)
+	hwaddr src_size = (hwaddr) tx_size * src_width;
+	hwaddr dst_size = src_size - (src_size % dst_width);
+	
+	if (!dst_size || !dmac_is_periph_range(p, sink->mr, sink->offset, sink->size, ch->dst_addr, (ch->control & DMAC_CH_CONTROL_DI) ? dst_size : dst_width, true))
+		return false;
+	
+	if (!dmac_is_direct_range(p, ch->src_addr, src_size, false))
+		return false;
+	
+	hwaddr len = src_size;
+	void *data = address_space_map(&p->downstream_as, ch->src_addr, &len, false, MEMTXATTRS_UNSPECIFIED);
+	if (!data)
+		return false;
+	
+	if (len != src_size) {
+		address_space_unmap(&p->downstream_as, data, len, false, 0);
+		return false;
+	}
+	
+	sink->cb(sink->opaque, data, dst_size, dst_width);
+	address_space_unmap(&p->downstream_as, data, len, false, len);
+	
+	ch->src_addr += src_size;
+	if ((ch->control & DMAC_CH_CONTROL_DI))
+		ch->dst_addr += dst_size;
+	ch->control &= ~DMAC_CH_CONTROL_TRANSFER_SIZE;
+	
+	return true;
+}
+
+/*
+ * Peripheral FIFO -> RAM: let the peripheral fill destination memory without per-element dispatch.
+ * Returns false if transfer is not suitable, nothing is transferred in this case.
+ * */
+static bool dmac_channel_run_source(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch, uint8_t src_periph, uint32_t src_width, uint32_t dst_width, uint32_t tx_size) {
+	pmb887x_dmac_source_t *source = &p->sources[src_periph];
+	
+	if (!source->cb || !(ch->control & DMAC_CH_CONTROL_DI))
+		return false;
+	
+	// Partial dst elements are left to the element loop
+	hwaddr src_size = (hwaddr) tx_size * src_width;
+	hwaddr dst_size = src_size - (src_size % dst_width);
+	
+	if (!dst_size || dst_size != src_size)
+		return false;
+	
+	if (!dmac_is_periph_range(p, source->mr, source->offset, source->size, ch->src_addr, (ch->control & DMAC_CH_CONTROL_SI) ? src_size : src_width, false))
+		return false;
+	
+	if (!dmac_is_direct_range(p, ch->dst_addr, dst_size, true))
+		return false;
+	
+	hwaddr len = dst_size;
+	void *data = address_space_map(&p->downstream_as, ch->dst_addr, &len, true, MEMTXATTRS_UNSPECIFIED);
+	if (!data)
+		return false;
+	
+	if (len != dst_size) {
+		address_space_unmap(&p->downstream_as, data, len, true, 0);
+		return false;
+	}
+	
+	source->cb(source->opaque, data, dst_size, src_width);
+	address_space_unmap(&p->downstream_as, data, len, true, len);
+	
+	if ((ch->control & DMAC_CH_CONTROL_SI))
+		ch->src_addr += src_size;
+	ch->dst_addr += dst_size;
+	ch->control &= ~DMAC_CH_CONTROL_TRANSFER_SIZE;
+	
+	return true;
+}
+
 static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 	if (!(ch->config & DMAC_CH_CONFIG_ENABLE) || !(p->config & DMAC_CONFIG_ENABLE))
 		return;
@@ -78,6 +199,8 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 	uint8_t dst_periph = (ch->config & DMAC_CH_CONFIG_DST_PERIPH) >> DMAC_CH_CONFIG_DST_PERIPH_SHIFT;
 	uint32_t tx_size = 0;
 	bool is_periph_controlled = false;
+	bool is_mem2per = false;
+	bool is_per2mem = false;
 	
 	switch ((ch->config & DMAC_CH_CONFIG_FLOW_CTRL)) {
 		case DMAC_CH_CONFIG_FLOW_CTRL_MEM2MEM:
@@ -86,6 +209,7 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 		
 		case DMAC_CH_CONFIG_FLOW_CTRL_MEM2PER:
 			tx_size = (ch->config & DMAC_CH_CONTROL_TRANSFER_SIZE) >> DMAC_CH_CONTROL_TRANSFER_SIZE_SHIFT;
+			is_mem2per = true;
 			
 			if (!p->periph_request[dst_periph])
 				return;
@@ -95,6 +219,7 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 		
 		case DMAC_CH_CONFIG_FLOW_CTRL_PER2MEM:
 			tx_size = (ch->config & DMAC_CH_CONTROL_TRANSFER_SIZE) >> DMAC_CH_CONTROL_TRANSFER_SIZE_SHIFT;
+			is_per2mem = true;
 			
 			if (!p->periph_request[src_periph])
 				return;
@@ -104,6 +229,7 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 		
 		case DMAC_CH_CONFIG_FLOW_CTRL_MEM2PER_PER:
 			is_periph_controlled = true;
+			is_mem2per = true;
 			
 			if (!p->periph_request[dst_periph])
 				return;
@@ -115,6 +241,7 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 		
 		case DMAC_CH_CONFIG_FLOW_CTRL_PER2MEM_PER:
 			is_periph_controlled = true;
+			is_per2mem = true;
 			
 			if (!p->periph_request[src_periph])
 				return;
@@ -134,9 +261,16 @@ static void dmac_channel_run(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 	
 	DPRINTF("CH%d: %08X [%dx%d] -> %08X [%dx%d]\n", ch->id, ch->src_addr, src_width, tx_size, ch->dst_addr, dst_width, tx_size);
 	
+	if (is_mem2per && dmac_channel_run_sink(p, ch, dst_periph, src_width, dst_width, tx_size))
+		tx_size = 0;
+	
+	if (is_per2mem && dmac_channel_run_source(p, ch, src_periph, src_width, dst_width, tx_size))
+		tx_size = 0;
+	
 	uint8_t buffer[4];
 	uint8_t buffer_size = 0;
 	
+	// Generic element loop (MMIO source or peripheral without sink)
 	while (tx_size > 0) {
 		if (dst_width >= src_width) {
 			address_space_read(&p->downstream_as, ch->src_addr, MEMTXATTRS_UNSPECIFIED, buffer + buffer_size, src_width);
@@ -217,6 +351,28 @@ static void dmac_update(pmb887x_dmac_t *p) {
 	pmb887x_srb_set_imsc(&p->srb_err, err_mask);
 }
 
+void pmb887x_dmac_set_sink(pmb887x_dmac_t *p, int per_id, MemoryRegion *mr, hwaddr offset, hwaddr size, pmb887x_dmac_sink_cb_t cb, void *opaque) {
+	g_assert(per_id >= 0 && per_id < ARRAY_SIZE(p->sinks));
+	p->sinks[per_id] = (pmb887x_dmac_sink_t) {
+		.cb			= cb,
+		.opaque		= opaque,
+		.mr			= mr,
+		.offset		= offset,
+		.size		= size,
+	};
+}
+
+void pmb887x_dmac_set_source(pmb887x_dmac_t *p, int per_id, MemoryRegion *mr, hwaddr offset, hwaddr size, pmb887x_dmac_source_cb_t cb, void *opaque) {
+	g_assert(per_id >= 0 && per_id < ARRAY_SIZE(p->sources));
+	p->sources[per_id] = (pmb887x_dmac_source_t) {
+		.cb			= cb,
+		.opaque		= opaque,
+		.mr			= mr,
+		.offset		= offset,
+		.size		= size,
+	};
+}
+
 void pmb887x_dmac_request(pmb887x_dmac_t *p, int per_id, uint32_t size) {
 	p->periph_request[per_id] = size;
 	
@@ -517,6 +673,36 @@ static void dmac_realize(DeviceState *dev, Error **errp) {
 	pmb887x_srb_set_irq_router(&p->srb_tc, p, dmac_tc_irq_router);
 }
 
+static const VMStateDescription dmac_ch_vmstate = {
+	.name = TYPE_PMB887X_DMAC "-ch",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(src_addr, pmb887x_dmac_ch_t),
+		VMSTATE_UINT32(dst_addr, pmb887x_dmac_ch_t),
+		VMSTATE_UINT32(lli, pmb887x_dmac_ch_t),
+		VMSTATE_UINT32(control, pmb887x_dmac_ch_t),
+		VMSTATE_UINT32(config, pmb887x_dmac_ch_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static const VMStateDescription dmac_vmstate = {
+	.name = TYPE_PMB887X_DMAC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_SRB(srb_tc, pmb887x_dmac_t),
+		VMSTATE_PMB887X_SRB(srb_err, pmb887x_dmac_t),
+		VMSTATE_STRUCT_ARRAY(ch, pmb887x_dmac_t, DMAC_CHANNELS, 1, dmac_ch_vmstate, pmb887x_dmac_ch_t),
+		VMSTATE_UINT32(config, pmb887x_dmac_t),
+		VMSTATE_UINT32(enabled_channels, pmb887x_dmac_t),
+		VMSTATE_UINT32(used_peripherals, pmb887x_dmac_t),
+		VMSTATE_UINT32_ARRAY(periph_request, pmb887x_dmac_t, 16),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property dmac_properties[] = {
 	DEFINE_PROP_LINK("downstream", pmb887x_dmac_t, downstream, TYPE_MEMORY_REGION, MemoryRegion *),
     DEFINE_PROP_END_OF_LIST(),
@@ -526,6 +712,7 @@ static void dmac_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, dmac_properties);
 	dc->realize = dmac_realize;
+	dc->vmsd = &dmac_vmstate;
 }
 
 static const TypeInfo dmac_info = {
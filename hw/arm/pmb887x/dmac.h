@@ -1,7 +1,18 @@
 #pragma once
 #include "qemu/osdep.h"
+#include "exec/hwaddr.h"
 
 struct pmb887x_dmac_t;
 typedef struct pmb887x_dmac_t pmb887x_dmac_t;
 
 void pmb887x_dmac_request(pmb887x_dmac_t *p, int per_id, uint32_t size);
+
+// Bulk receiver for MEM2PER transfers into peripheral window [offset, offset + size) of mr
+typedef void (*pmb887x_dmac_sink_cb_t)(void *opaque, const uint8_t *data, uint32_t size, uint32_t width);
+
+void pmb887x_dmac_set_sink(pmb887x_dmac_t *p, int per_id, MemoryRegion *mr, hwaddr offset, hwaddr size, pmb887x_dmac_sink_cb_t cb, void *opaque);
+
+// Bulk producer for PER2MEM transfers from peripheral window [offset, offset + size) of mr, fills RAM directly
+typedef void (*pmb887x_dmac_source_cb_t)(void *opaque, uint8_t *data, uint32_t size, uint32_t width);
+
+void pmb887x_dmac_set_source(pmb887x_dmac_t *p, int per_id, MemoryRegion *mr, hwaddr offset, hwaddr size, pmb887x_dmac_source_cb_t cb, void *opaque);
@@ -16,6 +16,7 @@
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/regs.h"
@@ -33,7 +34,7 @@ struct pmb887x_dsp_t {
 	MemoryRegion mmio;
 	
 	uint32_t unk[2];
-	uint8_t ram[DSP_RAM_SIZE];
+	pmb887x_ram_window_t ram;
 	
 	pmb887x_clc_reg_t clc;
 };
@@ -42,37 +43,6 @@ static void dsp_update_state(struct pmb887x_dsp_t *p) {
 	// TODO
 }
 
-static uint32_t dsp_ram_read(struct pmb887x_dsp_t *p, uint32_t offset, unsigned size) {
-	uint8_t *data = p->ram;
-	switch (size) {
-		case 1:		return data[offset];
-		case 2:		return data[offset] | (data[offset + 1] << 8);
-		case 4:		return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | (data[offset + 3] << 24);
-	}
-    return 0;
-}
-
-static void dsp_ram_write(struct pmb887x_dsp_t *p, uint32_t offset, uint32_t value, unsigned size) {
-	uint8_t *data = p->ram;
-	switch (size) {
-		case 1:
-			data[offset] = value & 0xFF;
-		break;
-		
-		case 2:
-			data[offset] = value & 0xFF;
-			data[offset + 1] = (value >> 8) & 0xFF;
-		break;
-		
-		case 4:
-			data[offset] = value & 0xFF;
-			data[offset + 1] = (value >> 8) & 0xFF;
-			data[offset + 2] = (value >> 16) & 0xFF;
-			data[offset + 3] = (value >> 24) & 0xFF;
-		break;
-	}
-}
-
 static uint64_t dsp_io_read(void *opaque, hwaddr haddr, unsigned size) {
 	struct pmb887x_dsp_t *p = (struct pmb887x_dsp_t *) opaque;
 	
@@ -95,10 +65,6 @@ static uint64_t dsp_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			value = p->unk[1];
 		break;
 		
-		case DSP_RAM0 ... (DSP_RAM0 + DSP_RAM_SIZE):
-			value = dsp_ram_read(p, haddr - DSP_RAM0, size);
-		break;
-		
 		default:
 			IO_DUMP(haddr + p->mmio.addr, size, 0xFFFFFFFF, false);
 			EPRINTF("unknown reg access: %02"PRIX64"\n", haddr);
@@ -129,10 +95,6 @@ static void dsp_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 			p->unk[1] = value;
 		break;
 		
-		case DSP_RAM0 ... (DSP_RAM0 + DSP_RAM_SIZE):
-			dsp_ram_write(p, haddr - DSP_RAM0, value, size);
-		break;
-		
 		default:
 			EPRINTF("unknown reg access: %02"PRIX64"\n", haddr);
 			//exit(1);
@@ -161,16 +123,30 @@ static void dsp_init(Object *obj) {
 static void dsp_realize(DeviceState *dev, Error **errp) {
 	struct pmb887x_dsp_t *p = PMB887X_DSP(dev);
 	
+	if (!pmb887x_ram_window_init(&p->ram, OBJECT(dev), "pmb887x-dsp-ram", &p->mmio, DSP_RAM0, DSP_RAM_SIZE, errp))
+		return;
+	
 	pmb887x_clc_init(&p->clc);
 	
 	p->unk[0] = 0x01;
 	p->unk[1] = 0x00;
 	
-	dsp_ram_write(p, 0, 0x0801, 2);
+	stw_le_p(p->ram.ptr, 0x0801);
 	
 	dsp_update_state(p);
 }
 
+static const VMStateDescription dsp_vmstate = {
+	.name = TYPE_PMB887X_DSP,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32_ARRAY(unk, struct pmb887x_dsp_t, 2),
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_dsp_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property dsp_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -179,6 +155,7 @@ static void dsp_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, dsp_properties);
 	dc->realize = dsp_realize;
+	dc->vmsd = &dsp_vmstate;
 }
 
 static const TypeInfo dsp_info = {
@@ -11,11 +11,13 @@
 #include "exec/memory.h"
 #include "hw/qdev-properties.h"
 #include "cpu.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/mod.h"
+#include "hw/arm/pmb887x/mmio_profile.h"
 #include "hw/arm/pmb887x/trace.h"
 
 #define TYPE_PMB887X_EBU	"pmb887x-ebu"
@@ -55,6 +57,10 @@ struct pmb887x_ebu_t {
 
 static void ebu_update_state(struct pmb887x_ebu_t *p) {
 	bool is_ebu_enabled = pmb887x_clc_is_enabled(&p->clc);
+	bool is_changed = false;
+	
+	// All CS changes are applied with single FlatView rebuild
+	memory_region_transaction_begin();
 	
 	for (int i = 0; i < 8; ++i) {
 		MemoryRegion *region = &p->regions[i];
@@ -71,6 +77,8 @@ static void ebu_update_state(struct pmb887x_ebu_t *p) {
 			region->enabled != is_enabled || region->readonly != is_ro;
 		
 		if (state_changed) {
+			is_changed = true;
+			
 			if (is_enabled && !region->enabled) {
 				DPRINTF("CS%d enable region %08X-%08X%s [%dM]\n", i, addr, addr + size - 1, is_ro ? " [RO]" : " [RW]", size / 1024 / 1024);
 			} else if (!is_enabled && region->enabled) {
@@ -94,6 +102,9 @@ static void ebu_update_state(struct pmb887x_ebu_t *p) {
 			}
 		}
 	}
+	
+	memory_region_transaction_commit();
+	pmb887x_mmio_profile_remap(is_changed);
 }
 
 static int ebu_get_index_from_reg(hwaddr haddr) {
@@ -391,6 +402,8 @@ static void ebu_realize(DeviceState *dev, Error **errp) {
 	pmb887x_clc_init(&p->clc);
 	
 	char memory_region_name[32];
+	
+	memory_region_transaction_begin();
 	for (int i = 0; i < 8; i++) {
 		sprintf(memory_region_name, "EBU_CS%d", i);
 		
@@ -407,8 +420,35 @@ static void ebu_realize(DeviceState *dev, Error **errp) {
 	}
 	
 	ebu_update_state(p);
+	memory_region_transaction_commit();
 }
 
+static int ebu_post_load(void *opaque, int version_id) {
+	ebu_update_state((struct pmb887x_ebu_t *) opaque);
+	return 0;
+}
+
+static const VMStateDescription ebu_vmstate = {
+	.name = TYPE_PMB887X_EBU,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = ebu_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_ebu_t),
+		VMSTATE_UINT32(con, struct pmb887x_ebu_t),
+		VMSTATE_UINT32(bfcon, struct pmb887x_ebu_t),
+		VMSTATE_UINT32(emuovl, struct pmb887x_ebu_t),
+		VMSTATE_UINT32(usercon, struct pmb887x_ebu_t),
+		VMSTATE_UINT32_ARRAY(addrsel, struct pmb887x_ebu_t, 8),
+		VMSTATE_UINT32_ARRAY(buscon, struct pmb887x_ebu_t, 8),
+		VMSTATE_UINT32_ARRAY(busap, struct pmb887x_ebu_t, 8),
+		VMSTATE_UINT32_ARRAY(sdrmcon, struct pmb887x_ebu_t, 2),
+		VMSTATE_UINT32_ARRAY(sdrmref, struct pmb887x_ebu_t, 2),
+		VMSTATE_UINT32_ARRAY(sdrmod, struct pmb887x_ebu_t, 2),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property ebu_properties[] = {
 	DEFINE_PROP_LINK("cs0", struct pmb887x_ebu_t, cs[0], TYPE_MEMORY_REGION, MemoryRegion *),
 	DEFINE_PROP_LINK("cs1", struct pmb887x_ebu_t, cs[1], TYPE_MEMORY_REGION, MemoryRegion *),
@@ -425,6 +465,7 @@ static void ebu_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, ebu_properties);
 	dc->realize = ebu_realize;
+	dc->vmsd = &ebu_vmstate;
 }
 
 static const TypeInfo ebu_info = {
@@ -41,3 +41,49 @@ void pmb887x_fifo_base_read(pmb887x_fifo_base_t *fifo, void *buffer, void *items
 		fifo->count -= items_count;
 	}
 }
+
+static const VMStateDescription vmstate_pmb887x_fifo_base = {
+	.name = "pmb887x-fifo-base",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32_EQUAL(total, pmb887x_fifo_base_t, NULL),
+		VMSTATE_UINT32(read, pmb887x_fifo_base_t),
+		VMSTATE_UINT32(write, pmb887x_fifo_base_t),
+		VMSTATE_UINT32(count, pmb887x_fifo_base_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+const VMStateDescription vmstate_pmb887x_fifo8 = {
+	.name = "pmb887x-fifo8",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_STRUCT(base, pmb887x_fifo8_t, 0, vmstate_pmb887x_fifo_base, pmb887x_fifo_base_t),
+		VMSTATE_VARRAY_UINT32(buffer, pmb887x_fifo8_t, base.total, 0, vmstate_info_uint8, uint8_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+const VMStateDescription vmstate_pmb887x_fifo16 = {
+	.name = "pmb887x-fifo16",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_STRUCT(base, pmb887x_fifo16_t, 0, vmstate_pmb887x_fifo_base, pmb887x_fifo_base_t),
+		VMSTATE_VARRAY_UINT32(buffer, pmb887x_fifo16_t, base.total, 0, vmstate_info_uint16, uint16_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+const VMStateDescription vmstate_pmb887x_fifo32 = {
+	.name = "pmb887x-fifo32",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_STRUCT(base, pmb887x_fifo32_t, 0, vmstate_pmb887x_fifo_base, pmb887x_fifo_base_t),
+		VMSTATE_VARRAY_UINT32(buffer, pmb887x_fifo32_t, base.total, 0, vmstate_info_uint32, uint32_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "qemu/osdep.h"
+#include "migration/vmstate.h"
 
 typedef struct {
 	uint32_t total;
@@ -168,3 +169,19 @@ static inline void pmb887x_fifo32_free(pmb887x_fifo32_t *fifo) {
 	g_free(fifo->buffer);
 	fifo->buffer = NULL;
 }
+
+/*
+ * VMState
+ * */
+extern const VMStateDescription vmstate_pmb887x_fifo8;
+extern const VMStateDescription vmstate_pmb887x_fifo16;
+extern const VMStateDescription vmstate_pmb887x_fifo32;
+
+#define VMSTATE_PMB887X_FIFO8(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_fifo8, pmb887x_fifo8_t)
+
+#define VMSTATE_PMB887X_FIFO16(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_fifo16, pmb887x_fifo16_t)
+
+#define VMSTATE_PMB887X_FIFO32(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_fifo32, pmb887x_fifo32_t)
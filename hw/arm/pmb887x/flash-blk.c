@@ -4,23 +4,77 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/bitmap.h"
+#include "qemu/timer.h"
 #include "hw/sysbus.h"
 #include "hw/qdev-properties.h"
 #include "hw/qdev-properties-system.h"
 #include "sysemu/block-backend.h"
+#include "block/block_int.h"
 #include "sysemu/blockdev.h"
+#include "sysemu/runstate.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "qapi/qmp/qdict.h"
 #include "hw/arm/pmb887x/trace.h"
 #include "hw/arm/pmb887x/flash-blk.h"
 
 #define TYPE_PMB887X_FLASH_BLK	"pmb887x-flash-blk"
 #define PMB887X_FLASH_BLK(obj)	OBJECT_CHECK(struct pmb887x_flash_blk_t, (obj), TYPE_PMB887X_FLASH_BLK)
 
+// Dirty tracking granularity, must be a divisor of the smallest erase sector
+#define FLASH_BLK_WB_CHUNK_BITS		12
+#define FLASH_BLK_WB_CHUNK			(1 << FLASH_BLK_WB_CHUNK_BITS)
+// Max size of one coalesced write request
+#define FLASH_BLK_WB_MAX_RUN		(256 * 1024)
+
+/*
+ * Overlay diff file:
+ *   header:	"PMBFDIFF", u32 version, u32 chunk size, u64 drive size
+ *   records:	u64 offset, u64 size, data[size]
+ * All values are little endian.
+ * */
+#define FLASH_BLK_DIFF_MAGIC		"PMBFDIFF"
+#define FLASH_BLK_DIFF_VERSION		1
+
+struct pmb887x_flash_blk_region_t {
+	int64_t offset;
+	int64_t size;
+	uint8_t *storage;
+};
+
+struct pmb887x_flash_blk_req_t {
+	struct pmb887x_flash_blk_t *flash;
+	QEMUIOVector qiov;
+	void *buffer;
+	int64_t offset;
+	int64_t size;
+};
+
 struct pmb887x_flash_blk_t {
 	SysBusDevice parent_obj;
 	DeviceState *dev;
 	BlockBackend *blk;
+	
+	bool write_back;
+	bool snapshot;
+	bool mmap;
+	int mmap_fd;
+	uint32_t write_back_delay;
+	
+	struct pmb887x_flash_blk_region_t *regions;
+	int regions_count;
+	
+	unsigned long *dirty;
+	int64_t dirty_chunks;
+	int64_t dirty_count;
+	uint32_t inflight;
+	QEMUTimer *flush_timer;
 };
 
+typedef struct pmb887x_flash_blk_region_t pmb887x_flash_blk_region_t;
+typedef struct pmb887x_flash_blk_req_t pmb887x_flash_blk_req_t;
+
 int pmb887x_flash_blk_pread(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, void *storage) {
 	return blk_pread(flash->blk, offset, size, storage, 0);
 }
@@ -41,6 +95,333 @@ pmb887x_flash_blk_t *pmb887x_flash_blk_self(DeviceState *dev) {
 	return PMB887X_FLASH_BLK(dev);
 }
 
+int pmb887x_flash_blk_mmap_fd(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	if (flash->mmap_fd < 0)
+		return -1;
+	if ((offset % qemu_real_host_page_size()) != 0 || (size % qemu_real_host_page_size()) != 0)
+		return -1;
+	if (offset + size > pmb887x_flash_blk_size(flash))
+		return -1;
+	return flash->mmap_fd;
+}
+
+static int flash_blk_open_raw_file(pmb887x_flash_blk_t *flash) {
+	BlockDriverState *bs = blk_bs(flash->blk);
+	
+	if (!bs || !bs->drv)
+		return -1;
+	
+	// Plain raw format without offset/size options on top of a file
+	if (strcmp(bs->drv->format_name, "raw") == 0) {
+		if (!bs->file || qdict_haskey(bs->options, "offset") || qdict_haskey(bs->options, "size"))
+			return -1;
+		bs = bs->file->bs;
+	}
+	
+	if (!bs || !bs->drv || strcmp(bs->drv->format_name, "file") != 0)
+		return -1;
+	
+	int fd = qemu_open(bs->filename, O_RDONLY, NULL);
+	if (fd < 0) {
+		WPRINTF("Can't open %s, fallback to pread\n", bs->filename);
+		return -1;
+	}
+	
+	DPRINTF("Using private file mapping of %s\n", bs->filename);
+	
+	return fd;
+}
+
+static pmb887x_flash_blk_region_t *flash_blk_find_region(pmb887x_flash_blk_t *flash, int64_t offset) {
+	for (int i = 0; i < flash->regions_count; i++) {
+		pmb887x_flash_blk_region_t *region = &flash->regions[i];
+		if (offset >= region->offset && offset < region->offset + region->size)
+			return region;
+	}
+	return NULL;
+}
+
+void pmb887x_flash_blk_map(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, void *storage) {
+	// Dirty chunk must never be shared by two regions
+	if ((offset % FLASH_BLK_WB_CHUNK) != 0) {
+		EPRINTF("Flash region at %08"PRIX64" is not aligned to %d bytes\n", offset, FLASH_BLK_WB_CHUNK);
+		exit(1);
+	}
+	
+	flash->regions = g_realloc(flash->regions, (flash->regions_count + 1) * sizeof(pmb887x_flash_blk_region_t));
+	flash->regions[flash->regions_count].offset = offset;
+	flash->regions[flash->regions_count].size = size;
+	flash->regions[flash->regions_count].storage = storage;
+	flash->regions_count++;
+}
+
+static void flash_blk_write_cb(void *opaque, int ret) {
+	pmb887x_flash_blk_req_t *req = (pmb887x_flash_blk_req_t *) opaque;
+	pmb887x_flash_blk_t *flash = req->flash;
+	
+	if (ret < 0) {
+		EPRINTF("Can't write to flash file [offset=%08"PRIX64", size=%08"PRIX64"]: %d, %s\n", req->offset, req->size, ret, strerror(-ret));
+		exit(1);
+	}
+	
+	flash->inflight--;
+	
+	qemu_iovec_destroy(&req->qiov);
+	qemu_vfree(req->buffer);
+	g_free(req);
+}
+
+static void flash_blk_write_async(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+	g_assert(region != NULL);
+	
+	// Data is copied, guest can modify storage while request is in flight
+	pmb887x_flash_blk_req_t *req = g_new0(pmb887x_flash_blk_req_t, 1);
+	req->flash = flash;
+	req->offset = offset;
+	req->size = size;
+	req->buffer = blk_blockalign(flash->blk, size);
+	memcpy(req->buffer, region->storage + (offset - region->offset), size);
+	
+	qemu_iovec_init(&req->qiov, 1);
+	qemu_iovec_add(&req->qiov, req->buffer, size);
+	
+	flash->inflight++;
+	blk_aio_pwritev(flash->blk, offset, &req->qiov, 0, flash_blk_write_cb, req);
+}
+
+static void flash_blk_write_dirty(pmb887x_flash_blk_t *flash) {
+	if (!flash->dirty_count)
+		return;
+	
+	int64_t chunk = find_next_bit(flash->dirty, flash->dirty_chunks, 0);
+	while (chunk < flash->dirty_chunks) {
+		int64_t offset = chunk << FLASH_BLK_WB_CHUNK_BITS;
+		pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+		g_assert(region != NULL);
+		
+		// Coalesce adjacent dirty chunks, but never cross region boundary
+		int64_t end_chunk = find_next_zero_bit(flash->dirty, flash->dirty_chunks, chunk);
+		int64_t end = MIN(end_chunk << FLASH_BLK_WB_CHUNK_BITS, region->offset + region->size);
+		end = MIN(end, offset + FLASH_BLK_WB_MAX_RUN);
+		end_chunk = DIV_ROUND_UP(end, FLASH_BLK_WB_CHUNK);
+		
+		bitmap_clear(flash->dirty, chunk, end_chunk - chunk);
+		flash->dirty_count -= end_chunk - chunk;
+		
+		flash_blk_write_async(flash, offset, end - offset);
+		
+		chunk = find_next_bit(flash->dirty, flash->dirty_chunks, end_chunk);
+	}
+	
+	g_assert(flash->dirty_count == 0);
+	timer_del(flash->flush_timer);
+}
+
+// Overlapping plain writes are not ordered by block layer, so previous requests must complete first
+static void flash_blk_write_dirty_sync(pmb887x_flash_blk_t *flash) {
+	blk_drain(flash->blk);
+	flash_blk_write_dirty(flash);
+	blk_drain(flash->blk);
+}
+
+void pmb887x_flash_blk_flush(pmb887x_flash_blk_t *flash) {
+	// Overlay is written only by explicit commit
+	if (flash->snapshot)
+		return;
+	flash_blk_write_dirty_sync(flash);
+}
+
+static void flash_blk_mark_dirty(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	int64_t first = offset >> FLASH_BLK_WB_CHUNK_BITS;
+	int64_t last = (offset + size - 1) >> FLASH_BLK_WB_CHUNK_BITS;
+	
+	for (int64_t chunk = first; chunk <= last; chunk++) {
+		if (!test_and_set_bit(chunk, flash->dirty))
+			flash->dirty_count++;
+	}
+}
+
+int pmb887x_flash_blk_update(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	// Keep all changes in memory, the drive is never touched
+	if (flash->snapshot) {
+		flash_blk_mark_dirty(flash, offset, size);
+		return 0;
+	}
+	
+	if (!pmb887x_flash_blk_is_rw(flash))
+		return 0;
+	
+	if (!flash->write_back) {
+		pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+		g_assert(region != NULL);
+		return pmb887x_flash_blk_pwrite(flash, offset, size, region->storage + (offset - region->offset));
+	}
+	
+	flash_blk_mark_dirty(flash, offset, size);
+	
+	if (!timer_pending(flash->flush_timer))
+		timer_mod(flash->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + flash->write_back_delay);
+	
+	return 0;
+}
+
+bool pmb887x_flash_blk_commit(pmb887x_flash_blk_t *flash, Error **errp) {
+	if (!pmb887x_flash_blk_is_rw(flash)) {
+		error_setg(errp, "flash drive is read-only");
+		return false;
+	}
+	
+	if (flash->snapshot) {
+		if (blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, BLK_PERM_ALL, errp) < 0)
+			return false;
+	}
+	
+	flash_blk_write_dirty_sync(flash);
+	int ret = blk_flush(flash->blk);
+	
+	if (flash->snapshot)
+		blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ, BLK_PERM_ALL, &error_abort);
+	
+	if (ret < 0) {
+		error_setg_errno(errp, -ret, "failed to flush flash drive");
+		return false;
+	}
+	
+	return true;
+}
+
+static bool flash_blk_write_le(FILE *fp, uint64_t value, int size) {
+	uint8_t buffer[8];
+	for (int i = 0; i < size; i++)
+		buffer[i] = (value >> (i * 8)) & 0xFF;
+	return fwrite(buffer, size, 1, fp) == 1;
+}
+
+bool pmb887x_flash_blk_export_diff(pmb887x_flash_blk_t *flash, const char *file, Error **errp) {
+	FILE *fp = fopen(file, "wb");
+	if (!fp) {
+		error_setg_errno(errp, errno, "fopen(%s)", file);
+		return false;
+	}
+	
+	bool ok = (
+		fwrite(FLASH_BLK_DIFF_MAGIC, 8, 1, fp) == 1 &&
+		flash_blk_write_le(fp, FLASH_BLK_DIFF_VERSION, 4) &&
+		flash_blk_write_le(fp, FLASH_BLK_WB_CHUNK, 4) &&
+		flash_blk_write_le(fp, pmb887x_flash_blk_size(flash), 8)
+	);
+	
+	int64_t chunk = find_next_bit(flash->dirty, flash->dirty_chunks, 0);
+	while (ok && chunk < flash->dirty_chunks) {
+		int64_t offset = chunk << FLASH_BLK_WB_CHUNK_BITS;
+		pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+		g_assert(region != NULL);
+		
+		int64_t end_chunk = find_next_zero_bit(flash->dirty, flash->dirty_chunks, chunk);
+		int64_t end = MIN(end_chunk << FLASH_BLK_WB_CHUNK_BITS, region->offset + region->size);
+		end_chunk = DIV_ROUND_UP(end, FLASH_BLK_WB_CHUNK);
+		
+		ok = (
+			flash_blk_write_le(fp, offset, 8) &&
+			flash_blk_write_le(fp, end - offset, 8) &&
+			fwrite(region->storage + (offset - region->offset), end - offset, 1, fp) == 1
+		);
+		
+		chunk = find_next_bit(flash->dirty, flash->dirty_chunks, end_chunk);
+	}
+	
+	if (fclose(fp) != 0)
+		ok = false;
+	
+	if (!ok) {
+		error_setg_errno(errp, errno, "failed to write %s", file);
+		return false;
+	}
+	
+	return true;
+}
+
+static pmb887x_flash_blk_t *flash_blk_find_instance(Monitor *mon) {
+	Object *obj = object_resolve_path_type("", TYPE_PMB887X_FLASH_BLK, NULL);
+	if (!obj) {
+		monitor_printf(mon, "pmb887x-flash-blk not found\n");
+		return NULL;
+	}
+	return PMB887X_FLASH_BLK(obj);
+}
+
+static void hmp_pmb887x_flash_commit(Monitor *mon, const QDict *qdict) {
+	pmb887x_flash_blk_t *flash = flash_blk_find_instance(mon);
+	Error *err = NULL;
+	
+	if (!flash)
+		return;
+	
+	int64_t dirty_count = flash->dirty_count;
+	if (pmb887x_flash_blk_commit(flash, &err))
+		monitor_printf(mon, "Committed %"PRId64" KiB\n", (dirty_count * FLASH_BLK_WB_CHUNK) / 1024);
+	
+	hmp_handle_error(mon, err);
+}
+
+static void hmp_pmb887x_flash_export(Monitor *mon, const QDict *qdict) {
+	pmb887x_flash_blk_t *flash = flash_blk_find_instance(mon);
+	Error *err = NULL;
+	
+	if (!flash)
+		return;
+	
+	pmb887x_flash_blk_export_diff(flash, qdict_get_str(qdict, "filename"), &err);
+	hmp_handle_error(mon, err);
+}
+
+static void hmp_info_pmb887x_flash(Monitor *mon, const QDict *qdict) {
+	pmb887x_flash_blk_t *flash = flash_blk_find_instance(mon);
+	
+	if (!flash)
+		return;
+	
+	const char *mode = "write-through";
+	if (flash->snapshot) {
+		mode = "snapshot";
+	} else if (!pmb887x_flash_blk_is_rw(flash)) {
+		mode = "read-only";
+	} else if (flash->write_back) {
+		mode = "write-back";
+	}
+	
+	monitor_printf(mon, "mode: %s\n", mode);
+	monitor_printf(mon, "size: %"PRId64" KiB\n", pmb887x_flash_blk_size(flash) / 1024);
+	monitor_printf(mon, "dirty: %"PRId64" KiB (%"PRId64" chunks)\n", (flash->dirty_count * FLASH_BLK_WB_CHUNK) / 1024, flash->dirty_count);
+	monitor_printf(mon, "inflight: %u\n", flash->inflight);
+}
+
+static void flash_blk_flush_timer(void *opaque) {
+	pmb887x_flash_blk_t *flash = (pmb887x_flash_blk_t *) opaque;
+	
+	if (flash->snapshot)
+		return;
+	
+	// Dirty chunks can overlap with previous flush, retry after it completes
+	if (flash->inflight) {
+		timer_mod(flash->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + flash->write_back_delay);
+		return;
+	}
+	
+	flash_blk_write_dirty(flash);
+}
+
+static void flash_blk_vm_state_change(void *opaque, bool running, RunState state) {
+	// Called right before bdrv_drain_all() on stop/shutdown/savevm
+	if (!running)
+		pmb887x_flash_blk_flush((pmb887x_flash_blk_t *) opaque);
+}
+
+static void flash_blk_reset(DeviceState *dev) {
+	pmb887x_flash_blk_flush(PMB887X_FLASH_BLK(dev));
+}
+
 static void flash_blk_realize(DeviceState *dev, Error **errp) {
 	pmb887x_flash_blk_t *flash = PMB887X_FLASH_BLK(dev);
 	
@@ -51,7 +432,7 @@ static void flash_blk_realize(DeviceState *dev, Error **errp) {
 	
 	DPRINTF("Drive size: %08"PRIX64"\n", blk_co_getlength(flash->blk));
 	
-	if (pmb887x_flash_blk_is_rw(flash)) {
+	if (pmb887x_flash_blk_is_rw(flash) && !flash->snapshot) {
 		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, BLK_PERM_ALL, errp);
 		if (ret < 0) {
 			EPRINTF("Failed to set block dev permissions");
@@ -64,10 +445,21 @@ static void flash_blk_realize(DeviceState *dev, Error **errp) {
 			exit(1);
 		}
 	}
+	
+	flash->mmap_fd = flash->mmap ? flash_blk_open_raw_file(flash) : -1;
+	
+	flash->dirty_chunks = DIV_ROUND_UP(pmb887x_flash_blk_size(flash), FLASH_BLK_WB_CHUNK);
+	flash->dirty = bitmap_new(flash->dirty_chunks);
+	flash->flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME, flash_blk_flush_timer, flash);
+	qemu_add_vm_change_state_handler(flash_blk_vm_state_change, flash);
 }
 
 static Property flash_blk_properties[] = {
 	DEFINE_PROP_DRIVE("drive", pmb887x_flash_blk_t, blk),
+	DEFINE_PROP_BOOL("write-back", pmb887x_flash_blk_t, write_back, true),
+	DEFINE_PROP_BOOL("snapshot", pmb887x_flash_blk_t, snapshot, false),
+	DEFINE_PROP_BOOL("mmap", pmb887x_flash_blk_t, mmap, true),
+	DEFINE_PROP_UINT32("write-back-delay", pmb887x_flash_blk_t, write_back_delay, 100),
 	DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -75,6 +467,7 @@ static void flash_blk_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, flash_blk_properties);
 	dc->realize = flash_blk_realize;
+	dc->reset = flash_blk_reset;
 	set_bit(DEVICE_CATEGORY_STORAGE, dc->categories);
 }
 
@@ -87,5 +480,8 @@ static const TypeInfo flash_blk_info = {
 
 static void flash_blk_register_types(void) {
 	type_register_static(&flash_blk_info);
+	monitor_register_hmp("pmb887x-flash-commit", false, hmp_pmb887x_flash_commit);
+	monitor_register_hmp("pmb887x-flash-export", false, hmp_pmb887x_flash_export);
+	monitor_register_hmp("pmb887x-flash", true, hmp_info_pmb887x_flash);
 }
 type_init(flash_blk_register_types)
@@ -10,3 +10,13 @@ int pmb887x_flash_blk_pwrite(pmb887x_flash_blk_t *flash, int64_t offset, int64_t
 bool pmb887x_flash_blk_is_rw(pmb887x_flash_blk_t *flash);
 int64_t pmb887x_flash_blk_size(pmb887x_flash_blk_t *flash);
 pmb887x_flash_blk_t *pmb887x_flash_blk_self(DeviceState *dev);
+int pmb887x_flash_blk_mmap_fd(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size);
+
+// Write-back cache
+void pmb887x_flash_blk_map(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, void *storage);
+int pmb887x_flash_blk_update(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size);
+void pmb887x_flash_blk_flush(pmb887x_flash_blk_t *flash);
+
+// Snapshot overlay
+bool pmb887x_flash_blk_commit(pmb887x_flash_blk_t *flash, Error **errp);
+bool pmb887x_flash_blk_export_diff(pmb887x_flash_blk_t *flash, const char *file, Error **errp);
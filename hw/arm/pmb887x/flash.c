@@ -15,11 +15,13 @@
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
+#include "qemu/host-utils.h"
 #include "hw/qdev-properties.h"
 #include "hw/qdev-properties-system.h"
 #include "hw/block/block.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/blockdev.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/trace.h"
 #include "hw/arm/pmb887x/flash.h"
@@ -53,6 +55,7 @@ struct pmb887x_flash_part_t {
 	uint8_t cmd;
 	uint32_t cmd_addr;
 	uint8_t status;
+	bool romd_mode;
 	
 	void *storage;
 	
@@ -64,6 +67,10 @@ struct pmb887x_flash_part_t {
 	uint32_t blocks_n;
 	struct pmb887x_flash_block_t *blocks;
 	
+	// Block id for every (1 << blocks_index_shift) bytes of partition
+	uint8_t blocks_index_shift;
+	uint32_t *blocks_index;
+	
 	MemoryRegion mem;
 	struct pmb887x_flash_t *flash;
 };
@@ -94,6 +101,7 @@ struct pmb887x_flash_t {
 	uint16_t *otp1_data;
 	
 	uint32_t parts_n;
+	struct pmb887x_flash_part_t *parts;
 };
 
 typedef struct pmb887x_flash_t pmb887x_flash_t;
@@ -116,27 +124,20 @@ static void flash_reset(pmb887x_flash_part_t *p) {
 
 static pmb887x_flash_block_t *flash_part_find_block(pmb887x_flash_part_t *p, uint32_t offset) {
 	offset -= p->offset;
-	for (uint32_t i = 0; i < p->blocks_n; i++) {
-		pmb887x_flash_block_t *blk = &p->blocks[i];
-		if (offset >= blk->offset && offset < blk->offset + blk->size)
-			return blk;
+	if (offset >= p->size) {
+		flash_error_part(p, "[data] Unknown addr %08X\n", p->flash->offset + p->offset + offset);
+		exit(1);
 	}
-	flash_error_part(p, "[data] Unknown addr %08X\n", p->flash->offset + p->offset + offset);
-	exit(1);
-	return NULL;
+	return &p->blocks[p->blocks_index[offset >> p->blocks_index_shift]];
 }
 
 static uint32_t flash_find_sector_size(pmb887x_flash_part_t *p, uint32_t offset) {
 	offset -= p->offset;
-	
-	for (int i = 0; i < p->cfg->erase_regions_cnt; i++) {
-		const pmb887x_flash_erase_region_t *region = &p->cfg->erase_regions[i];
-		if (offset >= region->offset && offset < region->offset + region->size)
-			return region->sector;
+	if (offset >= p->size) {
+		flash_error_part(p, "[data] Unknown sector size for addr %08X\n", p->flash->offset + p->offset + offset);
+		exit(1);
 	}
-	
-	flash_error_part(p, "[data] Unknown sector size for addr %08X\n", p->flash->offset + p->offset + offset);
-	exit(1);
+	return p->blocks[p->blocks_index[offset >> p->blocks_index_shift]].size;
 }
 
 /*
@@ -163,7 +164,7 @@ static uint32_t flash_data_read(pmb887x_flash_part_t *p, uint32_t offset, unsign
 }
 */
 
-static void flash_data_write(pmb887x_flash_part_t *p, uint32_t offset, uint32_t value, unsigned size) {
+static void flash_data_program(pmb887x_flash_part_t *p, uint32_t offset, uint32_t value, unsigned size) {
 	uint8_t *data = p->storage;
 	
 	if (offset < p->offset || (offset + size) > p->offset + p->size) {
@@ -195,16 +196,21 @@ static void flash_data_write(pmb887x_flash_part_t *p, uint32_t offset, uint32_t
 			exit(1);
 		break;
 	}
-	
-	if (pmb887x_flash_blk_is_rw(p->flash->blk)) {
-		int ret = pmb887x_flash_blk_pwrite(p->flash->blk, p->flash->offset + p->offset + offset, size, p->storage + offset);
-		if (ret < 0) {
-			flash_error_part(p, "Can't read to flash file: %d, %s\n", ret, strerror(ret));
-			exit(1);
-		}
+}
+
+static void flash_data_sync(pmb887x_flash_part_t *p, uint32_t offset, uint32_t size) {
+	int ret = pmb887x_flash_blk_update(p->flash->blk, p->flash->offset + offset, size);
+	if (ret < 0) {
+		flash_error_part(p, "Can't write to flash file: %d, %s\n", ret, strerror(-ret));
+		exit(1);
 	}
 }
 
+static void flash_data_write(pmb887x_flash_part_t *p, uint32_t offset, uint32_t value, unsigned size) {
+	flash_data_program(p, offset, value, size);
+	flash_data_sync(p, offset, size);
+}
+
 static uint64_t flash_io_read(void *opaque, hwaddr part_offset, unsigned size) {
 	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
 	const pmb887x_flash_cfg_t *cfg = p->flash->cfg;
@@ -480,14 +486,7 @@ static void flash_io_write(void *opaque, hwaddr part_offset, uint64_t value, uns
 					// fill sector with 0xFF's
 					uint32_t erase_offset = (base - p->offset);
 					memset(p->storage + erase_offset, 0xFF, sector_size);
-					
-					if (pmb887x_flash_blk_is_rw(p->flash->blk)) {
-						int ret = pmb887x_flash_blk_pwrite(p->flash->blk, p->flash->offset + p->offset + erase_offset, sector_size, p->storage + erase_offset);
-						if (ret < 0) {
-							flash_error_part(p, "Can't read to flash file: %d, %s\n", ret, strerror(ret));
-							exit(1);
-						}
-					}
+					flash_data_sync(p, base, sector_size);
 					
 					valid_cmd = true;
 					p->wcycle = 0;
@@ -561,8 +560,17 @@ static void flash_io_write(void *opaque, hwaddr part_offset, uint64_t value, uns
 			case 0xE9:	// buffered program
 			case 0xE8:	// buffered program
 				if (value == 0xD0) {
-					for (uint32_t i = 0; i < p->buffer_size; i++)
-						flash_data_write(p, p->buffer[i].offset, p->buffer[i].value, p->buffer[i].size);
+					uint32_t start = p->buffer[0].offset;
+					uint32_t end = p->buffer[0].offset;
+					
+					for (uint32_t i = 0; i < p->buffer_size; i++) {
+						flash_data_program(p, p->buffer[i].offset, p->buffer[i].value, p->buffer[i].size);
+						start = MIN(start, p->buffer[i].offset);
+						end = MAX(end, p->buffer[i].offset + p->buffer[i].size);
+					}
+					
+					// Whole program buffer is synced with one request
+					flash_data_sync(p, start, end - start);
 					
 					g_free(p->buffer);
 					p->buffer = NULL;
@@ -645,30 +653,76 @@ static bool fill_data_from_hex(uint8_t *dst, uint32_t max_size, const char *src_
 	return true;
 }
 
-static void flash_init_part(pmb887x_flash_t *flash, const pmb887x_flash_cfg_part_t *part_cfg) {
-	pmb887x_flash_part_t *p = g_new0(pmb887x_flash_part_t, 1);
+static void flash_init_part_index(pmb887x_flash_part_t *p) {
+	// Smallest sector is an index granule
+	uint32_t min_sector = p->size;
+	for (uint32_t i = 0; i < p->blocks_n; i++)
+		min_sector = MIN(min_sector, p->blocks[i].size);
+	
+	if (!is_power_of_2(min_sector)) {
+		flash_error_part(p, "invalid sector size: %08X", min_sector);
+		exit(1);
+	}
+	
+	p->blocks_index_shift = ctz32(min_sector);
+	p->blocks_index = g_new0(uint32_t, p->size >> p->blocks_index_shift);
+	
+	for (uint32_t i = 0; i < p->blocks_n; i++) {
+		pmb887x_flash_block_t *blk = &p->blocks[i];
+		
+		if ((blk->offset | blk->size) & (min_sector - 1)) {
+			flash_error_part(p, "unaligned block %08X (size: %08X)", blk->offset, blk->size);
+			exit(1);
+		}
+		
+		uint32_t first = blk->offset >> p->blocks_index_shift;
+		uint32_t last = (blk->offset + blk->size) >> p->blocks_index_shift;
+		for (uint32_t j = first; j < last; j++)
+			p->blocks_index[j] = i;
+	}
+}
+
+static void flash_init_part(pmb887x_flash_t *flash, pmb887x_flash_part_t *p, const pmb887x_flash_cfg_part_t *part_cfg) {
 	p->n = flash->parts_n++;
 	p->flash = flash;
 	p->offset = part_cfg->offset;
 	p->size = part_cfg->size;
 	p->cfg = part_cfg;
 	
+	// Raw image: map file directly, pages are loaded on first access
+	int fd = -1;
+	#ifdef CONFIG_POSIX
+	fd = pmb887x_flash_blk_mmap_fd(p->flash->blk, flash->offset + p->offset, p->size);
+	#endif
+	
 	char *name = g_strdup_printf("pmb887x-flash[%s][%d]", p->flash->name, p->n);
+	#ifdef CONFIG_POSIX
+	if (fd >= 0) {
+		memory_region_init_rom_device_from_fd(&p->mem, OBJECT(p->flash->dev), &io_ops, p, name, p->size, fd, flash->offset + p->offset, &error_fatal);
+	} else {
+		memory_region_init_rom_device(&p->mem, OBJECT(p->flash->dev), &io_ops, p, name, p->size, NULL);
+	}
+	#else
 	memory_region_init_rom_device(&p->mem, OBJECT(p->flash->dev), &io_ops, p, name, p->size, NULL);
+	#endif
 	memory_region_rom_device_set_romd(&p->mem, true);
 	memory_region_add_subregion(&flash->mmio, p->offset, &p->mem);
 	g_free(name);
 	
 	p->storage = memory_region_get_ram_ptr(&p->mem);
 	
-	flash_trace_part(p, "hw partition 0x%08X ... 0x%08X", p->flash->offset + p->offset, p->flash->offset + p->offset + p->size - 1);
+	flash_trace_part(p, "hw partition 0x%08X ... 0x%08X%s", p->flash->offset + p->offset, p->flash->offset + p->offset + p->size - 1, (fd >= 0 ? " [mmap]" : ""));
 	
-	int ret = pmb887x_flash_blk_pread(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
-	if (ret < 0) {
-		flash_error(p->flash, "failed to read the initial flash content [offset=%08X, size=%08X]", p->flash->offset + p->offset, p->size);
-		exit(1);
+	if (fd < 0) {
+		int ret = pmb887x_flash_blk_pread(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
+		if (ret < 0) {
+			flash_error(p->flash, "failed to read the initial flash content [offset=%08X, size=%08X]", p->flash->offset + p->offset, p->size);
+			exit(1);
+		}
 	}
 	
+	pmb887x_flash_blk_map(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
+	
 	p->blocks_n = 0;
 	for (uint32_t i = 0; i < p->cfg->erase_regions_cnt; i++)
 		p->blocks_n += p->cfg->erase_regions[i].size / p->cfg->erase_regions[i].sector;
@@ -689,6 +743,13 @@ static void flash_init_part(pmb887x_flash_t *flash, const pmb887x_flash_cfg_part
 			block_id++;
 		}
 	}
+	
+	if (block_offset != p->size) {
+		flash_error_part(p, "erase regions size %08X != partition size %08X", block_offset, p->size);
+		exit(1);
+	}
+	
+	flash_init_part_index(p);
 }
 
 static void flash_realize(DeviceState *dev, Error **errp) {
@@ -735,8 +796,9 @@ static void flash_realize(DeviceState *dev, Error **errp) {
 	}
 	
 	// Init hw partitions
+	flash->parts = g_new0(pmb887x_flash_part_t, cfg->parts_count);
 	for (size_t i = 0; i < cfg->parts_count; i++)
-		flash_init_part(flash, &cfg->parts[i]);
+		flash_init_part(flash, &flash->parts[i], &cfg->parts[i]);
 	
 	sysbus_init_mmio(SYS_BUS_DEVICE(flash->dev), &flash->mmio);
 }
@@ -791,6 +853,111 @@ static void flash_trace(pmb887x_flash_t *flash, const char *format, ...) {
 	qemu_log_mask(LOG_TRACE, "[%s] %s %s\n", PMB887X_TRACE_PREFIX, flash->name, s->str);
 }
 
+static const VMStateDescription flash_buffer_vmstate = {
+	.name = TYPE_PMB887X_FLASH "-buffer",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(offset, pmb887x_flash_buffer_t),
+		VMSTATE_UINT32(value, pmb887x_flash_buffer_t),
+		VMSTATE_UINT8(size, pmb887x_flash_buffer_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static const VMStateDescription flash_block_vmstate = {
+	.name = TYPE_PMB887X_FLASH "-block",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32_EQUAL(offset, pmb887x_flash_block_t, NULL),
+		VMSTATE_UINT32_EQUAL(size, pmb887x_flash_block_t, NULL),
+		VMSTATE_BOOL(locked, pmb887x_flash_block_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static bool flash_part_buffer_needed(void *opaque) {
+	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
+	return p->buffer != NULL;
+}
+
+static int flash_part_buffer_pre_load(void *opaque) {
+	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
+	// buffer_size is already loaded by the parent section
+	p->buffer = g_new0(pmb887x_flash_buffer_t, p->buffer_size);
+	return 0;
+}
+
+static const VMStateDescription flash_part_buffer_vmstate = {
+	.name = TYPE_PMB887X_FLASH "-part/buffer",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.needed = flash_part_buffer_needed,
+	.pre_load = flash_part_buffer_pre_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_STRUCT_VARRAY_POINTER_UINT32(buffer, pmb887x_flash_part_t, buffer_size, flash_buffer_vmstate, pmb887x_flash_buffer_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static int flash_part_pre_save(void *opaque) {
+	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
+	p->romd_mode = p->mem.romd_mode;
+	return 0;
+}
+
+static int flash_part_pre_load(void *opaque) {
+	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
+	g_free(p->buffer);
+	p->buffer = NULL;
+	return 0;
+}
+
+static int flash_part_post_load(void *opaque, int version_id) {
+	pmb887x_flash_part_t *p = (pmb887x_flash_part_t *) opaque;
+	memory_region_rom_device_set_romd(&p->mem, p->romd_mode);
+	return 0;
+}
+
+static const VMStateDescription flash_part_vmstate = {
+	.name = TYPE_PMB887X_FLASH "-part",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.pre_save = flash_part_pre_save,
+	.pre_load = flash_part_pre_load,
+	.post_load = flash_part_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32_EQUAL(size, pmb887x_flash_part_t, NULL),
+		VMSTATE_UINT8(wcycle, pmb887x_flash_part_t),
+		VMSTATE_UINT8(cmd, pmb887x_flash_part_t),
+		VMSTATE_UINT32(cmd_addr, pmb887x_flash_part_t),
+		VMSTATE_UINT8(status, pmb887x_flash_part_t),
+		VMSTATE_BOOL(romd_mode, pmb887x_flash_part_t),
+		VMSTATE_UINT32(buffer_size, pmb887x_flash_part_t),
+		VMSTATE_UINT32(buffer_index, pmb887x_flash_part_t),
+		VMSTATE_UINT32_EQUAL(blocks_n, pmb887x_flash_part_t, NULL),
+		VMSTATE_STRUCT_VARRAY_POINTER_UINT32(blocks, pmb887x_flash_part_t, blocks_n, flash_block_vmstate, pmb887x_flash_block_t),
+		VMSTATE_END_OF_LIST()
+	},
+	.subsections = (const VMStateDescription * const []) {
+		&flash_part_buffer_vmstate,
+		NULL
+	}
+};
+
+// Flash content is a RAM block of the rom device, it is migrated together with the guest RAM
+static const VMStateDescription flash_vmstate = {
+	.name = TYPE_PMB887X_FLASH,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32_EQUAL(parts_n, pmb887x_flash_t, NULL),
+		VMSTATE_STRUCT_VARRAY_POINTER_UINT32(parts, pmb887x_flash_t, parts_n, flash_part_vmstate, pmb887x_flash_part_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property flash_properties[] = {
 	DEFINE_PROP_LINK("blk", struct pmb887x_flash_t, blk, "pmb887x-flash-blk", struct pmb887x_flash_blk_t *),
 	
@@ -813,6 +980,7 @@ static void flash_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, flash_properties);
 	dc->realize = flash_realize;
+	dc->vmsd = &flash_vmstate;
 	set_bit(DEVICE_CATEGORY_STORAGE, dc->categories);
 }
 
@@ -15,14 +15,19 @@
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-clock.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/clock.h"
+#include "hw/arm/pmb887x/timebase.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
+#include "hw/arm/pmb887x/idle.h"
 
 #define TYPE_PMB887X_GPTU	"pmb887x-gptu"
 #define PMB887X_GPTU(obj)	OBJECT_CHECK(pmb887x_gptu_t, (obj), TYPE_PMB887X_GPTU)
@@ -90,11 +95,12 @@ typedef struct {
 	MemoryRegion mmio;
 	
 	qemu_irq irq[8];
-	QEMUTimer *timer;
-	QEMUTimer *timer_t2;
+	pmb887x_timebase_event_t timer;
+	pmb887x_timebase_event_t timer_t2;
 	
 	bool enabled;
 	uint32_t freq;
+	pmb887x_clock_scale_t scale;
 	
 	int from;
 	int to;
@@ -107,6 +113,7 @@ typedef struct {
 	pmb887x_gptu_ev_t events[16];
 	int events_ssr[2][2];
 	
+	Clock *clk;
 	struct pmb887x_pll_t *pll;
 	
 	uint64_t next;
@@ -138,14 +145,11 @@ static void gptu_update_freq(pmb887x_gptu_t *p) {
 	
 	p->freq = rmc > 0 ? pmb887x_pll_get_fsys(p->pll) / rmc : 0;
 	p->enabled = pmb887x_clc_is_enabled(&p->clc) && p->freq > 0;
+	pmb887x_clock_scale_set(&p->scale, p->freq);
 	
 	DPRINTF("fgptu=%d %s\n", p->freq, p->enabled ? "[ON]" : "[OFF]");
 }
 
-static uint64_t gptu_ticks_to_ns(pmb887x_gptu_t *p, uint64_t ticks) {
-    return muldiv64(ticks, NANOSECONDS_PER_SECOND, p->freq);
-}
-
 static void gptu_trigger_ev_irq(pmb887x_gptu_t *p, int ev_id) {
 	pmb887x_gptu_ev_t *ev = &p->events[ev_id];
 	for (int i = 0; i < 8; i++) {
@@ -168,6 +172,13 @@ static int gptu_get_ssr_ev(int id, int n) {
 	return -1;
 }
 
+static void gptu_update_events_ssr(pmb887x_gptu_t *p) {
+	p->events_ssr[0][0] = (p->t01ots & GPTU_T01OTS_SSR00) >> GPTU_T01OTS_SSR00_SHIFT;
+	p->events_ssr[0][1] = (p->t01ots & GPTU_T01OTS_SSR01) >> GPTU_T01OTS_SSR01_SHIFT;
+	p->events_ssr[1][0] = ((p->t01ots & GPTU_T01OTS_SSR10) >> GPTU_T01OTS_SSR10_SHIFT) + 4;
+	p->events_ssr[1][1] = ((p->t01ots & GPTU_T01OTS_SSR11) >> GPTU_T01OTS_SSR11_SHIFT) + 4;
+}
+
 static void gptu_update_events(pmb887x_gptu_t *p) {
 	for (int i = 0; i < 16; i++) {
 		p->events[i].id = i;
@@ -180,10 +191,7 @@ static void gptu_update_events(pmb887x_gptu_t *p) {
 		p->events[event_id].mask |= (1 << source_id);
 	}
 	
-	p->events_ssr[0][0] = (p->t01ots & GPTU_T01OTS_SSR00) >> GPTU_T01OTS_SSR00_SHIFT;
-	p->events_ssr[0][1] = (p->t01ots & GPTU_T01OTS_SSR01) >> GPTU_T01OTS_SSR01_SHIFT;
-	p->events_ssr[1][0] = ((p->t01ots & GPTU_T01OTS_SSR10) >> GPTU_T01OTS_SSR10_SHIFT) + 4;
-	p->events_ssr[1][1] = ((p->t01ots & GPTU_T01OTS_SSR11) >> GPTU_T01OTS_SSR11_SHIFT) + 4;
+	gptu_update_events_ssr(p);
 	
 	for (int i = 0; i < 8; i++) {
 		for (int j = 0; j < 2; j++) {
@@ -219,7 +227,7 @@ static int64_t gptu_t2_reload_counter(pmb887x_gptu_timer_t2_t *timer, int64_t co
 static int64_t gptu_t2_get_timer_counter(pmb887x_gptu_t *p, pmb887x_gptu_timer_t2_t *timer, uint64_t now, bool real) {
 	int64_t counter = timer->counter;
 	if (timer->enabled && !timer->stopped) {
-		int64_t elapsed = muldiv64(now - timer->start, p->freq, NANOSECONDS_PER_SECOND);
+		int64_t elapsed = pmb887x_timebase_ticks(&p->scale, timer->start, now);
 		counter += timer->count_down ? -elapsed : elapsed;
 	}
 	return real ? counter : gptu_t2_reload_counter(timer, counter);
@@ -229,9 +237,9 @@ static void gptu_t2_sync_timer(pmb887x_gptu_t *p) {
 	if (!p->enabled)
 		return;
 	
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	
-	p->next_t2 = now + gptu_ticks_to_ns(p, 0xFFFFFFFF);
+	p->next_t2 = pmb887x_timebase_after(&p->scale, now, 0xFFFFFFFF);
 	
 	const int timer2ev[] = { EV_OUV_T2A, EV_OUV_T2B };
 	
@@ -259,15 +267,15 @@ static void gptu_t2_sync_timer(pmb887x_gptu_t *p) {
 			has_enabled = true;
 			
 			if (timer->count_down) {
-				p->next_t2 = MIN(p->next_t2, now + gptu_ticks_to_ns(p, counter + 1));
+				p->next_t2 = MIN(p->next_t2, pmb887x_timebase_after(&p->scale, now, counter + 1));
 			} else {
-				p->next_t2 = MIN(p->next_t2, now + gptu_ticks_to_ns(p, timer->overflow - counter));
+				p->next_t2 = MIN(p->next_t2, pmb887x_timebase_after(&p->scale, now, timer->overflow - counter));
 			}
 		}
 	}
 	
 	if (has_enabled)
-		timer_mod(p->timer_t2, p->next_t2);
+		pmb887x_timebase_mod(&p->timer_t2, p->next_t2);
 }
 
 static void gptu_t2_update_state(pmb887x_gptu_t *p) {
@@ -324,7 +332,7 @@ static void gptu_t2_update_state(pmb887x_gptu_t *p) {
 }
 
 static uint32_t gptu_t2_get_counter(pmb887x_gptu_t *p) {
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	uint32_t value = 0;
 	if ((p->t2con & GPTU_T2CON_T2SPLIT)) {
 		value |= gptu_t2_get_timer_counter(p, &p->timers_t2[0], now, false);
@@ -379,7 +387,7 @@ static uint64_t gptu_get_timer_counter(pmb887x_gptu_t *p, pmb887x_gptu_timer_t *
 		if (timer->concat) {
 			counter += gptu_get_timer_counter(p, &p->timers[timer->prev], now, true) / GPTU_OVERFLOW;
 		} else {
-			counter += muldiv64(now - timer->start, p->freq, NANOSECONDS_PER_SECOND);
+			counter += pmb887x_timebase_ticks(&p->scale, timer->start, now);
 		}
 	}
 	
@@ -393,7 +401,7 @@ static void gptu_sync_timer(pmb887x_gptu_t *p) {
 	if (p->from == -1)
 		return;
 	
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	
 	p->next = now + p->freq;
 	
@@ -426,17 +434,17 @@ static void gptu_sync_timer(pmb887x_gptu_t *p) {
 			}
 		} else {
 			if (!timer->concat && p->enabled) {
-				p->next = MIN(p->next, now + gptu_ticks_to_ns(p, GPTU_OVERFLOW - counter));
+				p->next = MIN(p->next, pmb887x_timebase_after(&p->scale, now, GPTU_OVERFLOW - counter));
 			}
 		}
 	}
 	
 	if (p->enabled)
-		timer_mod(p->timer, p->next);
+		pmb887x_timebase_mod(&p->timer, p->next);
 }
 
 static uint32_t gptu_get_counter(pmb887x_gptu_t *p, int id, int size) {
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	uint32_t value = 0;
 	for (int i = 0; i < size; i++) {
 		pmb887x_gptu_timer_t *timer = &p->timers[id * 4 + i];
@@ -597,10 +605,12 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 		break;
 		
 		case GPTU_T0DCBA:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			value = gptu_get_counter(p, 0, 4);
 		break;
 		
 		case GPTU_T0CBA:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			value = gptu_get_counter(p, 0, 3);
 		break;
 		
@@ -613,10 +623,12 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 		break;
 		
 		case GPTU_T1DCBA:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			value = gptu_get_counter(p, 1, 4);
 		break;
 		
 		case GPTU_T1CBA:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			value = gptu_get_counter(p, 1, 3);
 		break;
 		
@@ -629,6 +641,7 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 		break;
 		
 		case GPTU_T2:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			value = gptu_t2_get_counter(p);
 		break;
 		
@@ -679,6 +692,19 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 	return value;
 }
 
+static void gptu_update_clock(pmb887x_gptu_t *p) {
+	gptu_sync_timer(p);
+	gptu_update_freq(p);
+	gptu_rebuild_timers(p);
+	gptu_t2_sync_timer(p);
+	gptu_t2_update_state(p);
+}
+
+// Called only when fSYS actually changes
+static void gptu_clock_update(void *opaque, ClockEvent event) {
+	gptu_update_clock((pmb887x_gptu_t *) opaque);
+}
+
 static void gptu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned size) {
 	pmb887x_gptu_t *p = (pmb887x_gptu_t *) opaque;
 	
@@ -687,11 +713,7 @@ static void gptu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 	switch (haddr) {
 		case GPTU_CLC:
 			pmb887x_clc_set(&p->clc, value);
-			gptu_sync_timer(p);
-			gptu_update_freq(p);
-			gptu_rebuild_timers(p);
-			gptu_t2_sync_timer(p);
-			gptu_t2_update_state(p);
+			gptu_update_clock(p);
 		break;
 		
 		case GPTU_ID:
@@ -829,6 +851,8 @@ static void gptu_init(Object *obj) {
 	
 	for (int i = 0; i < ARRAY_SIZE(p->src); i++)
 		sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq[i]);
+	
+	p->clk = qdev_init_clock_in(DEVICE(obj), "clk", gptu_clock_update, p, ClockUpdate);
 }
 
 static void gptu_realize(DeviceState *dev, Error **errp) {
@@ -838,15 +862,16 @@ static void gptu_realize(DeviceState *dev, Error **errp) {
 		hw_error("PLL not found...");
 	
 	pmb887x_clc_init(&p->clc);
+	pmb887x_pll_connect_clock(p->pll, "fsys", p->clk);
 	
 	for (int i = 0; i < ARRAY_SIZE(p->src); i++) {
 		if (!p->irq[i])
 			hw_error("pmb887x-gptu: irq %d not set", i);
 		pmb887x_src_init(&p->src[i], p->irq[i]);
 	}
-	
-    p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, gptu_ptimer_reset, p);
-    p->timer_t2 = timer_new_ns(QEMU_CLOCK_VIRTUAL, gptu_t2_ptimer_reset, p);
+
+	pmb887x_timebase_event_init(&p->timer, "gptu-t01", gptu_ptimer_reset, p);
+	pmb887x_timebase_event_init(&p->timer_t2, "gptu-t2", gptu_t2_ptimer_reset, p);
     
 	gptu_update_freq(p);
 	gptu_update_events(p);
@@ -856,6 +881,95 @@ static void gptu_realize(DeviceState *dev, Error **errp) {
 	gptu_t2_sync_timer(p);
 }
 
+static const VMStateDescription gptu_ev_vmstate = {
+	.name = "pmb887x-gptu-ev",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_INT32(id, pmb887x_gptu_ev_t),
+		VMSTATE_UINT32(mask, pmb887x_gptu_ev_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static const VMStateDescription gptu_timer_vmstate = {
+	.name = "pmb887x-gptu-timer",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_INT32(id, pmb887x_gptu_timer_t),
+		VMSTATE_INT32(prev, pmb887x_gptu_timer_t),
+		VMSTATE_INT32(next, pmb887x_gptu_timer_t),
+		VMSTATE_BOOL(enabled, pmb887x_gptu_timer_t),
+		VMSTATE_BOOL(concat, pmb887x_gptu_timer_t),
+		VMSTATE_BOOL_ARRAY(ev_ssr, pmb887x_gptu_timer_t, 2),
+		VMSTATE_UINT64(start, pmb887x_gptu_timer_t),
+		VMSTATE_UINT64(counter, pmb887x_gptu_timer_t),
+		VMSTATE_UINT64(reload, pmb887x_gptu_timer_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static const VMStateDescription gptu_timer_t2_vmstate = {
+	.name = "pmb887x-gptu-timer-t2",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_BOOL(enabled, pmb887x_gptu_timer_t2_t),
+		VMSTATE_BOOL(oneshot, pmb887x_gptu_timer_t2_t),
+		VMSTATE_BOOL(count_down, pmb887x_gptu_timer_t2_t),
+		VMSTATE_BOOL(stopped, pmb887x_gptu_timer_t2_t),
+		VMSTATE_UINT64(start, pmb887x_gptu_timer_t2_t),
+		VMSTATE_INT64(counter, pmb887x_gptu_timer_t2_t),
+		VMSTATE_INT64(reload, pmb887x_gptu_timer_t2_t),
+		VMSTATE_INT64(overflow, pmb887x_gptu_timer_t2_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static int gptu_post_load(void *opaque, int version_id) {
+	pmb887x_gptu_t *p = (pmb887x_gptu_t *) opaque;
+	gptu_update_events_ssr(p);
+	pmb887x_clock_scale_set(&p->scale, p->freq);
+	return 0;
+}
+
+static const VMStateDescription gptu_vmstate = {
+	.name = TYPE_PMB887X_GPTU,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = gptu_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_TIMEBASE_EVENT(timer, pmb887x_gptu_t),
+		VMSTATE_PMB887X_TIMEBASE_EVENT(timer_t2, pmb887x_gptu_t),
+		VMSTATE_BOOL(enabled, pmb887x_gptu_t),
+		VMSTATE_UINT32(freq, pmb887x_gptu_t),
+		VMSTATE_INT32(from, pmb887x_gptu_t),
+		VMSTATE_INT32(to, pmb887x_gptu_t),
+		VMSTATE_PMB887X_CLC(clc, pmb887x_gptu_t),
+		VMSTATE_PMB887X_SRC_ARRAY(src, pmb887x_gptu_t, 8),
+		VMSTATE_STRUCT_ARRAY(timers, pmb887x_gptu_t, 8, 0, gptu_timer_vmstate, pmb887x_gptu_timer_t),
+		VMSTATE_STRUCT_ARRAY(timers_t2, pmb887x_gptu_t, 2, 0, gptu_timer_t2_vmstate, pmb887x_gptu_timer_t2_t),
+		VMSTATE_STRUCT_ARRAY(events, pmb887x_gptu_t, 16, 0, gptu_ev_vmstate, pmb887x_gptu_ev_t),
+		VMSTATE_UINT64(next, pmb887x_gptu_t),
+		VMSTATE_UINT64(next_t2, pmb887x_gptu_t),
+		VMSTATE_UINT32(t01irs, pmb887x_gptu_t),
+		VMSTATE_UINT32(t01ots, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2con, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2rccon, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2ais, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2bis, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2es, pmb887x_gptu_t),
+		VMSTATE_UINT32(osel, pmb887x_gptu_t),
+		VMSTATE_UINT32(out, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2rc0, pmb887x_gptu_t),
+		VMSTATE_UINT32(t2rc1, pmb887x_gptu_t),
+		VMSTATE_UINT32(t012run, pmb887x_gptu_t),
+		VMSTATE_UINT32(srsel, pmb887x_gptu_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property gptu_properties[] = {
 	DEFINE_PROP_LINK("pll", pmb887x_gptu_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
     DEFINE_PROP_END_OF_LIST(),
@@ -865,6 +979,7 @@ static void gptu_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, gptu_properties);
 	dc->realize = gptu_realize;
+	dc->vmsd = &gptu_vmstate;
 }
 
 static const TypeInfo gptu_info = {
@@ -0,0 +1,547 @@
+/*
+ * High-level emulation of firmware routines
+ * */
+#define PMB887X_TRACE_ID		HLE
+#define PMB887X_TRACE_PREFIX	"pmb887x-hle"
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "exec/exec-all.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "cpu.h"
+
+#include "hw/arm/pmb887x/hle.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define HLE_MAX_SIZE			(16 * 1024 * 1024)	// larger sizes are left to guest code
+#define HLE_MAX_PENDING			16
+#define HLE_MAX_REPORTS			10
+
+enum {
+	HLE_RET_R0	= 1 << 0,
+	HLE_RET_R1	= 1 << 1,
+};
+
+typedef struct {
+	CPUARMState *env;
+	int mmu_idx;
+	uintptr_t ra;
+	
+	// Result: registers and memory written by routine
+	uint32_t r0;
+	uint32_t r1;
+	uint32_t dst;
+	GByteArray *data;
+} hle_ctx_t;
+
+typedef struct {
+	const char *type;
+	bool (*run)(hle_ctx_t *ctx);
+	uint32_t ret;
+} hle_routine_t;
+
+typedef struct {
+	const char *name;
+	const hle_routine_t *routine;
+	uint32_t addr;
+	const uint8_t *signature;
+	uint32_t signature_size;
+	int signature_state;	// 0 - not checked yet, 1 - ok, -1 - mismatch
+	
+	uint64_t calls;
+	uint64_t declined;
+	uint64_t verified;
+	uint64_t mismatches;
+} hle_hook_t;
+
+// Native result waiting for guest routine return
+typedef struct {
+	hle_hook_t *hook;
+	uint32_t lr;
+	uint32_t sp;
+	uint32_t r0;
+	uint32_t r1;
+	uint32_t dst;
+	GByteArray *data;
+} hle_pending_t;
+
+static struct {
+	bool verify;
+	
+	hle_hook_t *hooks;
+	uint32_t hooks_count;
+	GHashTable *hooks_by_pc;
+	GHashTable *return_sites;
+	
+	hle_pending_t pending[HLE_MAX_PENDING];
+	int pending_n;
+	
+	GByteArray *scratch;
+} hle;
+
+/*
+ * Guest memory: plain RAM/ROM only, accessed page by page with host pointers.
+ * MMIO, unmapped pages and watchpoints decline the routine.
+ * */
+static uint32_t hle_page_left(uint32_t addr) {
+	return TARGET_PAGE_SIZE - (addr & ~TARGET_PAGE_MASK);
+}
+
+static bool hle_range_ok(uint32_t addr, uint32_t size) {
+	return size <= HLE_MAX_SIZE && (uint64_t) addr + size <= 0x100000000ULL;
+}
+
+static uint8_t *hle_page(hle_ctx_t *ctx, uint32_t addr, uint32_t size, MMUAccessType access) {
+	void *host = NULL;
+	int flags = probe_access_flags(ctx->env, addr, size, access, ctx->mmu_idx, true, &host, ctx->ra);
+	if ((flags & (TLB_INVALID_MASK | TLB_WATCHPOINT)))
+		return NULL;
+	return host;
+}
+
+static bool hle_read(hle_ctx_t *ctx, uint32_t addr, uint8_t *buf, uint32_t size) {
+	while (size > 0) {
+		uint32_t chunk = MIN(size, hle_page_left(addr));
+		uint8_t *host = hle_page(ctx, addr, chunk, MMU_DATA_LOAD);
+		if (!host)
+			return false;
+		memcpy(buf, host, chunk);
+		buf += chunk;
+		addr += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+// Whole range is checked first, nothing is written if any part of it is not RAM
+static bool hle_write(hle_ctx_t *ctx, uint32_t addr, const uint8_t *buf, uint32_t size) {
+	for (uint32_t offset = 0; offset < size; ) {
+		uint32_t chunk = MIN(size - offset, hle_page_left(addr + offset));
+		if (!hle_page(ctx, addr + offset, chunk, MMU_DATA_STORE))
+			return false;
+		offset += chunk;
+	}
+	
+	while (size > 0) {
+		uint32_t chunk = MIN(size, hle_page_left(addr));
+		uint8_t *host = hle_page(ctx, addr, chunk, MMU_DATA_STORE);
+		g_assert(host);
+		memcpy(host, buf, chunk);
+		buf += chunk;
+		addr += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+/*
+ * Routines: compute result from guest state, guest memory is written only in hle_apply()
+ * */
+static bool hle_memcpy(hle_ctx_t *ctx) {
+	uint32_t dst = ctx->env->regs[0];
+	uint32_t src = ctx->env->regs[1];
+	uint32_t size = ctx->env->regs[2];
+	
+	if (!hle_range_ok(dst, size) || !hle_range_ok(src, size))
+		return false;
+	
+	// Copied through buffer, so memmove is the same
+	g_byte_array_set_size(ctx->data, size);
+	if (!hle_read(ctx, src, ctx->data->data, size))
+		return false;
+	
+	ctx->dst = dst;
+	ctx->r0 = dst;
+	return true;
+}
+
+static bool hle_fill(hle_ctx_t *ctx, uint32_t dst, uint8_t value, uint32_t size) {
+	if (!hle_range_ok(dst, size))
+		return false;
+	
+	g_byte_array_set_size(ctx->data, size);
+	memset(ctx->data->data, value, size);
+	
+	ctx->dst = dst;
+	ctx->r0 = dst;
+	return true;
+}
+
+static bool hle_memset(hle_ctx_t *ctx) {
+	return hle_fill(ctx, ctx->env->regs[0], ctx->env->regs[1], ctx->env->regs[2]);
+}
+
+static bool hle_memclr(hle_ctx_t *ctx) {
+	return hle_fill(ctx, ctx->env->regs[0], 0, ctx->env->regs[1]);
+}
+
+static bool hle_strlen(hle_ctx_t *ctx) {
+	uint32_t str = ctx->env->regs[0];
+	
+	for (uint32_t len = 0; len < HLE_MAX_SIZE; ) {
+		uint32_t addr = str + len;
+		uint32_t chunk = hle_page_left(addr);
+		
+		if (addr < str)
+			return false;
+		
+		uint8_t *host = hle_page(ctx, addr, chunk, MMU_DATA_LOAD);
+		if (!host)
+			return false;
+		
+		uint8_t *end = memchr(host, 0, chunk);
+		if (end) {
+			ctx->r0 = len + (end - host);
+			return true;
+		}
+		
+		len += chunk;
+	}
+	return false;
+}
+
+static bool hle_divmod_u32(hle_ctx_t *ctx, uint32_t n, uint32_t d) {
+	// Division by zero handler is firmware specific
+	if (!d)
+		return false;
+	ctx->r0 = n / d;
+	ctx->r1 = n % d;
+	return true;
+}
+
+static bool hle_divmod_s32(hle_ctx_t *ctx, int32_t n, int32_t d) {
+	if (!d || (n == INT32_MIN && d == -1))
+		return false;
+	ctx->r0 = n / d;
+	ctx->r1 = n % d;
+	return true;
+}
+
+static bool hle_udiv(hle_ctx_t *ctx) {
+	return hle_divmod_u32(ctx, ctx->env->regs[0], ctx->env->regs[1]);
+}
+
+static bool hle_sdiv(hle_ctx_t *ctx) {
+	return hle_divmod_s32(ctx, ctx->env->regs[0], ctx->env->regs[1]);
+}
+
+static bool hle_rt_udiv(hle_ctx_t *ctx) {
+	return hle_divmod_u32(ctx, ctx->env->regs[1], ctx->env->regs[0]);
+}
+
+static bool hle_rt_sdiv(hle_ctx_t *ctx) {
+	return hle_divmod_s32(ctx, ctx->env->regs[1], ctx->env->regs[0]);
+}
+
+static bool hle_checksum(hle_ctx_t *ctx, bool is_xor) {
+	uint32_t addr = ctx->env->regs[0];
+	uint32_t size = ctx->env->regs[1];
+	uint32_t result = 0;
+	
+	if (!hle_range_ok(addr, size))
+		return false;
+	
+	while (size > 0) {
+		uint32_t chunk = MIN(size, hle_page_left(addr));
+		uint8_t *host = hle_page(ctx, addr, chunk, MMU_DATA_LOAD);
+		if (!host)
+			return false;
+		
+		for (uint32_t i = 0; i < chunk; i++)
+			result = is_xor ? (result ^ host[i]) : (result + host[i]);
+		
+		addr += chunk;
+		size -= chunk;
+	}
+	
+	ctx->r0 = result;
+	return true;
+}
+
+static bool hle_sum8(hle_ctx_t *ctx) {
+	return hle_checksum(ctx, false);
+}
+
+static bool hle_xor8(hle_ctx_t *ctx) {
+	return hle_checksum(ctx, true);
+}
+
+static const hle_routine_t hle_routines[] = {
+	{"memcpy",		hle_memcpy,		HLE_RET_R0},
+	{"memmove",		hle_memcpy,		HLE_RET_R0},
+	{"memset",		hle_memset,		HLE_RET_R0},
+	{"memclr",		hle_memclr,		0},
+	{"strlen",		hle_strlen,		HLE_RET_R0},
+	{"udiv",		hle_udiv,		HLE_RET_R0 | HLE_RET_R1},
+	{"sdiv",		hle_sdiv,		HLE_RET_R0 | HLE_RET_R1},
+	{"rt_udiv",		hle_rt_udiv,	HLE_RET_R0 | HLE_RET_R1},
+	{"rt_sdiv",		hle_rt_sdiv,	HLE_RET_R0 | HLE_RET_R1},
+	{"sum8",		hle_sum8,		HLE_RET_R0},
+	{"xor8",		hle_xor8,		HLE_RET_R0},
+};
+
+// Write result and return to LR (BX LR)
+static bool hle_apply(hle_ctx_t *ctx, const hle_routine_t *routine) {
+	CPUARMState *env = ctx->env;
+	
+	if (ctx->data->len && !hle_write(ctx, ctx->dst, ctx->data->data, ctx->data->len))
+		return false;
+	
+	if ((routine->ret & HLE_RET_R0))
+		env->regs[0] = ctx->r0;
+	if ((routine->ret & HLE_RET_R1))
+		env->regs[1] = ctx->r1;
+	
+	env->regs[15] = env->regs[14] & ~1;
+	env->thumb = env->regs[14] & 1;
+	return true;
+}
+
+static bool hle_check_signature(CPUARMState *env, hle_hook_t *hook) {
+	if (!hook->signature_state) {
+		g_autofree uint8_t *code = g_malloc(hook->signature_size);
+		bool is_valid = cpu_memory_rw_debug(env_cpu(env), hook->addr & ~1, code, hook->signature_size, false) == 0 &&
+			memcmp(code, hook->signature, hook->signature_size) == 0;
+		
+		hook->signature_state = is_valid ? 1 : -1;
+		
+		if (!is_valid)
+			WPRINTF("%s: code at %08X doesn't match signature, hook disabled", hook->name, hook->addr & ~1);
+	}
+	return hook->signature_state > 0;
+}
+
+/*
+ * Verify mode: native result is saved, guest routine is executed and compared on return to LR.
+ * */
+static void hle_pending_drop(int from) {
+	for (int i = from; i < hle.pending_n; i++)
+		g_byte_array_free(hle.pending[i].data, true);
+	hle.pending_n = MIN(hle.pending_n, from);
+}
+
+// Return address must be translated with hook, so existing TBs are flushed once per call site and insn is restarted
+static void hle_verify_add_return_site(CPUARMState *env, uintptr_t ra) {
+	uint32_t lr = env->regs[14];
+	
+	if (g_hash_table_contains(hle.return_sites, GUINT_TO_POINTER(lr)))
+		return;
+	
+	g_hash_table_add(hle.return_sites, GUINT_TO_POINTER(lr));
+	tb_flush(env_cpu(env));
+	cpu_loop_exit_restore(env_cpu(env), ra);
+}
+
+static void hle_verify_enter(CPUARMState *env, hle_hook_t *hook, hle_ctx_t *ctx) {
+	// Routine never returned (longjmp, task switch)
+	if (hle.pending_n == HLE_MAX_PENDING) {
+		g_byte_array_free(hle.pending[0].data, true);
+		memmove(&hle.pending[0], &hle.pending[1], sizeof(hle.pending[0]) * (HLE_MAX_PENDING - 1));
+		hle.pending_n--;
+	}
+	
+	hle_pending_t *p = &hle.pending[hle.pending_n++];
+	p->hook = hook;
+	p->lr = env->regs[14];
+	p->sp = env->regs[13];
+	p->r0 = ctx->r0;
+	p->r1 = ctx->r1;
+	p->dst = ctx->dst;
+	p->data = g_byte_array_sized_new(ctx->data->len);
+	g_byte_array_append(p->data, ctx->data->data, ctx->data->len);
+}
+
+static void hle_verify_result(CPUARMState *env, const hle_pending_t *p, uintptr_t ra) {
+	hle_hook_t *hook = p->hook;
+	bool is_report = hook->mismatches < HLE_MAX_REPORTS;
+	bool is_valid = true;
+	
+	if ((hook->routine->ret & HLE_RET_R0) && env->regs[0] != p->r0) {
+		if (is_report)
+			WPRINTF("%s: r0=%08X, native=%08X (LR=%08X)", hook->name, env->regs[0], p->r0, p->lr);
+		is_valid = false;
+	}
+	
+	if ((hook->routine->ret & HLE_RET_R1) && env->regs[1] != p->r1) {
+		if (is_report)
+			WPRINTF("%s: r1=%08X, native=%08X (LR=%08X)", hook->name, env->regs[1], p->r1, p->lr);
+		is_valid = false;
+	}
+	
+	if (p->data->len) {
+		hle_ctx_t ctx = {
+			.env		= env,
+			.mmu_idx	= cpu_mmu_index(env_cpu(env), false),
+			.ra			= ra,
+		};
+		
+		g_byte_array_set_size(hle.scratch, p->data->len);
+		if (hle_read(&ctx, p->dst, hle.scratch->data, p->data->len) && memcmp(hle.scratch->data, p->data->data, p->data->len) != 0) {
+			uint32_t offset = 0;
+			while (hle.scratch->data[offset] == p->data->data[offset])
+				offset++;
+			
+			if (is_report) {
+				WPRINTF("%s: [%08X]=%02X, native=%02X (dst=%08X, size=%u, LR=%08X)", hook->name, p->dst + offset,
+					hle.scratch->data[offset], p->data->data[offset], p->dst, p->data->len, p->lr);
+			}
+			is_valid = false;
+		}
+	}
+	
+	if (is_valid) {
+		hook->verified++;
+	} else {
+		hook->mismatches++;
+	}
+}
+
+static void hle_verify_return(CPUARMState *env, uint32_t pc, uintptr_t ra) {
+	for (int i = hle.pending_n - 1; i >= 0; i--) {
+		hle_pending_t *p = &hle.pending[i];
+		if (p->lr == pc && p->sp == env->regs[13]) {
+			hle_verify_result(env, p, ra);
+			// Nested calls which never returned are dropped too
+			hle_pending_drop(i);
+			return;
+		}
+	}
+}
+
+/*
+ * ARM translator hooks
+ * */
+static bool hle_is_hooked(uint32_t pc) {
+	if (g_hash_table_contains(hle.hooks_by_pc, GUINT_TO_POINTER(pc)))
+		return true;
+	return hle.verify && g_hash_table_contains(hle.return_sites, GUINT_TO_POINTER(pc));
+}
+
+static bool hle_call(CPUARMState *env, uint32_t pc, uintptr_t ra) {
+	if (hle.verify && hle.pending_n > 0)
+		hle_verify_return(env, pc, ra);
+	
+	hle_hook_t *hook = g_hash_table_lookup(hle.hooks_by_pc, GUINT_TO_POINTER(pc));
+	if (!hook || !hle_check_signature(env, hook))
+		return false;
+	
+	if (hle.verify)
+		hle_verify_add_return_site(env, ra);
+	
+	hle_ctx_t ctx = {
+		.env		= env,
+		.mmu_idx	= cpu_mmu_index(env_cpu(env), false),
+		.ra			= ra,
+		.data		= hle.scratch,
+	};
+	g_byte_array_set_size(ctx.data, 0);
+	
+	hook->calls++;
+	
+	if (!hook->routine->run(&ctx)) {
+		hook->declined++;
+		return false;
+	}
+	
+	if (hle.verify) {
+		hle_verify_enter(env, hook, &ctx);
+		return false;
+	}
+	
+	if (!hle_apply(&ctx, hook->routine)) {
+		hook->declined++;
+		return false;
+	}
+	
+	return true;
+}
+
+static const ARMHLEOps hle_ops = {
+	.is_hooked	= hle_is_hooked,
+	.call		= hle_call,
+};
+
+static const hle_routine_t *hle_find_routine(const char *type) {
+	for (int i = 0; i < ARRAY_SIZE(hle_routines); i++) {
+		if (strcasecmp(hle_routines[i].type, type) == 0)
+			return &hle_routines[i];
+	}
+	return NULL;
+}
+
+void pmb887x_hle_init(const pmb887x_board_t *board) {
+	if (!board->hle_count)
+		return;
+	
+	hle.verify = board->hle_verify;
+	
+	const char *verify = getenv("PMB887X_HLE_VERIFY");
+	if (verify)
+		hle.verify = strtol(verify, NULL, 10) != 0;
+	
+	hle.hooks = g_new0(hle_hook_t, board->hle_count);
+	hle.hooks_count = board->hle_count;
+	hle.hooks_by_pc = g_hash_table_new(NULL, NULL);
+	hle.return_sites = g_hash_table_new(NULL, NULL);
+	hle.scratch = g_byte_array_new();
+	
+	for (uint32_t i = 0; i < board->hle_count; i++) {
+		const pmb887x_board_hle_t *cfg = &board->hle[i];
+		hle_hook_t *hook = &hle.hooks[i];
+		
+		hook->name = cfg->name;
+		hook->addr = cfg->addr;
+		hook->signature = cfg->signature;
+		hook->signature_size = cfg->signature_size;
+		hook->signature_state = cfg->signature_size ? 0 : 1;
+		
+		if (!(hook->routine = hle_find_routine(cfg->type))) {
+			EPRINTF("%s: unknown routine type '%s'", cfg->name, cfg->type);
+			exit(1);
+		}
+		
+		if (!(cfg->addr & 1) && (cfg->addr & 3)) {
+			EPRINTF("%s: unaligned ARM routine address %08X", cfg->name, cfg->addr);
+			exit(1);
+		}
+		
+		if (g_hash_table_contains(hle.hooks_by_pc, GUINT_TO_POINTER(cfg->addr))) {
+			EPRINTF("%s: duplicate routine address %08X", cfg->name, cfg->addr);
+			exit(1);
+		}
+		
+		g_hash_table_insert(hle.hooks_by_pc, GUINT_TO_POINTER(cfg->addr), hook);
+	}
+	
+	arm_hle_ops = &hle_ops;
+	
+	DPRINTF("%u routines%s\n", hle.hooks_count, hle.verify ? ", verify mode" : "");
+}
+
+static void hmp_info_pmb887x_hle(Monitor *mon, const QDict *qdict) {
+	if (!hle.hooks_count) {
+		monitor_printf(mon, "no routines in board config [hle]\n");
+		return;
+	}
+	
+	monitor_printf(mon, "mode: %s, %d pending verifications, %u return sites\n", hle.verify ? "verify" : "native",
+		hle.pending_n, hle.return_sites ? g_hash_table_size(hle.return_sites) : 0);
+	
+	monitor_printf(mon, "%-24s %-8s %-9s %12s %12s %12s %12s\n", "NAME", "TYPE", "ADDR", "CALLS", "DECLINED", "VERIFIED", "MISMATCHES");
+	for (uint32_t i = 0; i < hle.hooks_count; i++) {
+		const hle_hook_t *hook = &hle.hooks[i];
+		monitor_printf(mon, "%-24s %-8s %08X%s %12"PRIu64" %12"PRIu64" %12"PRIu64" %12"PRIu64"%s\n",
+			hook->name, hook->routine->type, hook->addr & ~1, (hook->addr & 1) ? "T" : " ",
+			hook->calls, hook->declined, hook->verified, hook->mismatches,
+			hook->signature_state < 0 ? " (signature mismatch)" : "");
+	}
+}
+
+static void pmb887x_hle_register(void) {
+	monitor_register_hmp("pmb887x-hle", true, hmp_info_pmb887x_hle);
+}
+type_init(pmb887x_hle_register)
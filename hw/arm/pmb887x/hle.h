@@ -0,0 +1,27 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/boards.h"
+
+/*
+ * High-level emulation of hot firmware routines.
+ * Routine entry is replaced with native implementation which works directly on guest RAM and returns to LR.
+ * If arguments point to MMIO, unmapped memory or watchpoints, the routine is declined and guest code is executed.
+ *
+ * Board config:
+ *   [hle]
+ *   verify = 0|1						run guest code and compare its result with native one
+ *   name = type:addr[:signature]		addr with bit 0 for thumb, signature - expected code bytes at addr (hex)
+ *
+ * Types (arguments in r0, r1, r2):
+ *   memcpy, memmove	(dst, src, n) -> dst
+ *   memset			(dst, c, n) -> dst
+ *   memclr			(dst, n), __aeabi_memclr/__rt_memclr
+ *   strlen			(s) -> length
+ *   udiv, sdiv		(n, d) -> quotient, remainder in r1, __aeabi_uidivmod/__aeabi_idivmod
+ *   rt_udiv, rt_sdiv	(d, n) -> quotient, remainder in r1, ADS __rt_udiv/__rt_sdiv
+ *   sum8, xor8		(p, n) -> sum or xor of bytes
+ *
+ *   PMB887X_HLE_VERIFY=0|1		overrides "verify" from board config
+ * */
+void pmb887x_hle_init(const pmb887x_board_t *board);
@@ -18,6 +18,7 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "hw/i2c/i2c.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/i2c.h"
 #include "hw/arm/pmb887x/regs.h"
@@ -611,6 +612,38 @@ static void i2c_realize(DeviceState *dev, Error **errp) {
 	i2c_update_state(p);
 }
 
+static const VMStateDescription i2c_vmstate = {
+	.name = TYPE_PMB887X_I2C,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_TIMER_PTR(timer, pmb887x_i2c_t),
+		VMSTATE_PMB887X_CLC(clc, pmb887x_i2c_t),
+		VMSTATE_PMB887X_SRB(srb, pmb887x_i2c_t),
+		VMSTATE_PMB887X_SRB_EXT(srb_proto, pmb887x_i2c_t),
+		VMSTATE_PMB887X_SRB_EXT(srb_err, pmb887x_i2c_t),
+		VMSTATE_INT32(state, pmb887x_i2c_t),
+		VMSTATE_PMB887X_FIFO32(fifo, pmb887x_i2c_t),
+		VMSTATE_BOOL(last_mode, pmb887x_i2c_t),
+		VMSTATE_UINT8(last_addr, pmb887x_i2c_t),
+		VMSTATE_BOOL(busy, pmb887x_i2c_t),
+		VMSTATE_BOOL(wait_for_next_tick, pmb887x_i2c_t),
+		VMSTATE_UINT32(tx_cnt, pmb887x_i2c_t),
+		VMSTATE_UINT32(rx_cnt, pmb887x_i2c_t),
+		VMSTATE_UINT32(rx_buffer_cnt, pmb887x_i2c_t),
+		VMSTATE_UINT32(runctrl, pmb887x_i2c_t),
+		VMSTATE_UINT32(enddctrl, pmb887x_i2c_t),
+		VMSTATE_UINT32(fdivcfg, pmb887x_i2c_t),
+		VMSTATE_UINT32(fdivhighcfg, pmb887x_i2c_t),
+		VMSTATE_UINT32(addrcfg, pmb887x_i2c_t),
+		VMSTATE_UINT32(mrpsctrl, pmb887x_i2c_t),
+		VMSTATE_UINT32(fifocfg, pmb887x_i2c_t),
+		VMSTATE_UINT32(tpsctrl, pmb887x_i2c_t),
+		VMSTATE_UINT32(timcfg, pmb887x_i2c_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property i2c_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -619,6 +652,7 @@ static void i2c_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, i2c_properties);
 	dc->realize = i2c_realize;
+	dc->vmsd = &i2c_vmstate;
 }
 
 static const TypeInfo i2c_info = {
@@ -17,6 +17,7 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "hw/i2c/i2c.h"
+#include "migration/vmstate.h"
 #include "hw/arm/pmb887x/trace.h"
 
 #define TYPE_PMB887X_PMIC	"pmb887x-d1094xx"
@@ -155,6 +156,19 @@ static void pmic_realize(DeviceState *dev, Error **errp) {
 	}
 }
 
+static const VMStateDescription pmic_vmstate = {
+	.name = TYPE_PMB887X_PMIC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_I2C_SLAVE(parent_obj, pmb887x_pmic_t),
+		VMSTATE_INT32(reg_id, pmb887x_pmic_t),
+		VMSTATE_INT32(wcycle, pmb887x_pmic_t),
+		VMSTATE_UINT8_ARRAY(regs, pmb887x_pmic_t, 256),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property pmic_properties[] = {
 	DEFINE_PROP_UINT32("revision", pmb887x_pmic_t, revision, 0xAA),
     DEFINE_PROP_END_OF_LIST(),
@@ -164,6 +178,7 @@ static void pmic_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, pmic_properties);
 	dc->realize = pmic_realize;
+	dc->vmsd = &pmic_vmstate;
 	
     I2CSlaveClass *k = I2C_SLAVE_CLASS(klass);
     k->event = &pmic_event;
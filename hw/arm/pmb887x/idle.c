@@ -0,0 +1,91 @@
+/*
+ * Time source polling detection
+ * */
+#define PMB887X_TRACE_ID		STM
+#define PMB887X_TRACE_PREFIX	"pmb887x-idle"
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "sysemu/cpu-timers.h"
+#include "hw/core/cpu.h"
+#include "cpu.h"
+
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/timebase.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define POLL_DEFAULT_THRESHOLD	32
+#define POLL_DEFAULT_SKIP_MAX	100000
+#define POLL_PC_WINDOW			64
+
+static struct {
+	bool enabled;
+	uint32_t threshold;
+	int64_t skip_max;
+	
+	uint32_t addr;
+	uint32_t pc;
+	uint32_t count;
+	
+	uint64_t skips;
+	int64_t skipped_ns;
+} poll;
+
+static uint64_t idle_env_u64(const char *name, uint64_t def) {
+	const char *value = getenv(name);
+	uint64_t result;
+	
+	if (!value)
+		return def;
+	
+	if (qemu_strtou64(value, NULL, 0, &result) != 0) {
+		error_report("Invalid %s=%s", name, value);
+		exit(1);
+	}
+	
+	return result;
+}
+
+static void idle_stats(void) {
+	if (poll.skips)
+		DPRINTF("%"PRIu64" polling loops skipped, %"PRId64" ns\n", poll.skips, poll.skipped_ns);
+}
+
+void pmb887x_idle_init(void) {
+	poll.threshold = idle_env_u64("PMB887X_POLL_THRESHOLD", POLL_DEFAULT_THRESHOLD);
+	poll.skip_max = idle_env_u64("PMB887X_POLL_SKIP_MAX", POLL_DEFAULT_SKIP_MAX);
+	poll.enabled = icount2_enabled() && poll.threshold > 0 && poll.skip_max > 0;
+	atexit(idle_stats);
+}
+
+void pmb887x_idle_poll(uint32_t addr) {
+	if (!poll.enabled || !current_cpu)
+		return;
+	
+	uint32_t pc = ARM_CPU(current_cpu)->env.regs[15];
+	
+	// Any other code between reads (IRQ handler, next loop) starts counting again
+	if (addr != poll.addr || pc - poll.pc + POLL_PC_WINDOW > POLL_PC_WINDOW * 2) {
+		poll.addr = addr;
+		poll.pc = pc;
+		poll.count = 0;
+		return;
+	}
+	
+	if (++poll.count < poll.threshold)
+		return;
+	
+	// Peripheral timers share one deadline, skip never jumps over it
+	int64_t skip_max = poll.skip_max;
+	int64_t deadline = pmb887x_timebase_next_deadline();
+	if (deadline >= 0)
+		skip_max = MIN(skip_max, deadline - pmb887x_timebase_now());
+	
+	int64_t skipped = skip_max > 0 ? icount2_skip(skip_max) : 0;
+	if (skipped > 0) {
+		poll.skips++;
+		poll.skipped_ns += skipped;
+	}
+	poll.count = 0;
+}
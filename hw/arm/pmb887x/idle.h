@@ -0,0 +1,16 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+/*
+ * Busy-wait detection: firmware delay loops spin on STM/GPTU counters.
+ * When the same code keeps polling a time source, virtual clock is moved forward
+ * to the next timer deadline (but not more than PMB887X_POLL_SKIP_MAX ns).
+ *
+ * Works only with -icount precise-clocks=on,sleep=off, same as idle CPU fast-forward.
+ *
+ *   PMB887X_POLL_THRESHOLD=n		reads from the same loop before skipping, default: 32, 0 - disabled
+ *   PMB887X_POLL_SKIP_MAX=ns		max skip per poll, default: 100000
+ * */
+void pmb887x_idle_init(void);
+void pmb887x_idle_poll(uint32_t addr);
@@ -0,0 +1,426 @@
+/*
+ * Scripted input injection
+ * */
+#define PMB887X_TRACE_ID		INPUT
+#define PMB887X_TRACE_PREFIX	"pmb887x-input"
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-ui.h"
+#include "qapi/util.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+#include "qemu/module.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "hw/irq.h"
+
+#include "hw/arm/pmb887x/input.h"
+#include "hw/arm/pmb887x/keypad.h"
+#include "hw/arm/pmb887x/adc.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define INPUT_DEFAULT_TAP_MS	100
+
+enum {
+	INPUT_EVENT_KEY,
+	INPUT_EVENT_GPIO,
+	INPUT_EVENT_ADC,
+};
+
+typedef struct {
+	int64_t time;
+	int type;
+	uint32_t id;
+	uint32_t value;
+	pmb887x_adc_input_t adc;
+} pmb887x_input_event_t;
+
+static struct {
+	const pmb887x_board_t *board;
+	DeviceState *keypad;
+	DeviceState *pcl;
+	DeviceState *adc;
+	QEMUTimer *timer;
+	GQueue events; // sorted by time, same time - FIFO
+	GString *deferred; // scripts from -machine options, parsed at machine init
+	uint64_t executed;
+} input;
+
+static int64_t input_now(void) {
+	return input.timer ? qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) : 0;
+}
+
+static void input_rearm(void) {
+	pmb887x_input_event_t *next = g_queue_peek_head(&input.events);
+	
+	if (!input.timer)
+		return;
+	
+	if (next) {
+		timer_mod(input.timer, next->time);
+	} else {
+		timer_del(input.timer);
+	}
+}
+
+static gint input_event_cmp(gconstpointer a, gconstpointer b, gpointer opaque) {
+	const pmb887x_input_event_t *ea = a;
+	const pmb887x_input_event_t *eb = b;
+	// g_queue_insert_sorted() inserts before first event where cmp(existing, new) >= 0,
+	// so never 0 and -1 for the same time: new event goes after them (FIFO)
+	return ea->time <= eb->time ? -1 : 1;
+}
+
+static void input_exec(const pmb887x_input_event_t *ev) {
+	switch (ev->type) {
+		case INPUT_EVENT_KEY:
+			DPRINTF("key %s %s\n", QKeyCode_str(ev->id), ev->value ? "down" : "up");
+			pmb887x_keypad_set_key(input.keypad, ev->id, ev->value);
+		break;
+		
+		case INPUT_EVENT_GPIO:
+			DPRINTF("gpio %d = %d\n", ev->id, ev->value);
+			qemu_set_irq(qdev_get_gpio_in(input.pcl, ev->id), ev->value);
+		break;
+		
+		case INPUT_EVENT_ADC:
+			DPRINTF("adc %d = type %d, %d, %d, %d\n", ev->id, ev->adc.type, ev->adc.r1, ev->adc.r2, ev->adc.value);
+			pmb887x_adc_set_input(input.adc, ev->id, &ev->adc);
+		break;
+	}
+	input.executed++;
+}
+
+static void input_timer_cb(void *opaque) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	pmb887x_input_event_t *ev;
+	
+	while ((ev = g_queue_peek_head(&input.events)) && ev->time <= now) {
+		g_queue_pop_head(&input.events);
+		input_exec(ev);
+		g_free(ev);
+	}
+	
+	input_rearm();
+}
+
+static bool input_parse_time(const char *str, int64_t base, int64_t prev, int64_t *time, Error **errp) {
+	bool relative = false;
+	const char *suffix;
+	uint64_t value;
+	int64_t scale;
+	
+	if (str[0] == '+') {
+		relative = true;
+		str++;
+	}
+	
+	if (qemu_strtou64(str, &suffix, 10, &value) != 0) {
+		error_setg(errp, "Invalid time: %s", str);
+		return false;
+	}
+	
+	if (!*suffix || strcmp(suffix, "ms") == 0) {
+		scale = SCALE_MS;
+	} else if (strcmp(suffix, "s") == 0) {
+		scale = NANOSECONDS_PER_SECOND;
+	} else if (strcmp(suffix, "us") == 0) {
+		scale = SCALE_US;
+	} else if (strcmp(suffix, "ns") == 0) {
+		scale = SCALE_NS;
+	} else {
+		error_setg(errp, "Invalid time suffix: %s, expected: ns, us, ms, s", suffix);
+		return false;
+	}
+	
+	*time = (relative ? prev : base) + value * scale;
+	return true;
+}
+
+static bool input_parse_u32(const char *str, uint32_t *value, Error **errp) {
+	if (!str || qemu_strtoui(str, NULL, 0, value) != 0) {
+		error_setg(errp, "Invalid number: %s", str ?: "<none>");
+		return false;
+	}
+	return true;
+}
+
+static bool input_parse_gpio(const char *str, uint32_t *id, Error **errp) {
+	for (uint32_t i = 0; i < input.board->gpios_count; i++) {
+		const pmb887x_board_gpio_t *gpio = &input.board->gpios[i];
+		if (strcmp(gpio->name, str) == 0 || strcmp(gpio->func_name, str) == 0 || strcmp(gpio->full_name, str) == 0) {
+			*id = gpio->id;
+			return true;
+		}
+	}
+	
+	if (qemu_strtoui(str, NULL, 0, id) == 0 && *id < input.board->gpios_count)
+		return true;
+	
+	error_setg(errp, "Unknown GPIO: %s", str);
+	return false;
+}
+
+static bool input_parse_adc(char **args, pmb887x_input_event_t *ev, Error **errp) {
+	const char *type = args[1];
+	
+	if (!input_parse_u32(args[0], &ev->id, errp))
+		return false;
+	
+	if (ev->id >= PMB887X_ADC_MAX_INPUTS) {
+		error_setg(errp, "Invalid ADC input: %d", ev->id);
+		return false;
+	}
+	
+	if (!type) {
+		error_setg(errp, "ADC input type is required: none, voltage, resistor, divider");
+		return false;
+	} else if (strcmp(type, "none") == 0) {
+		ev->adc.type = PMB887X_ADC_INPUT_NONE;
+		return true;
+	} else if (strcmp(type, "voltage") == 0) {
+		ev->adc.type = PMB887X_ADC_INPUT_VOLTAGE;
+		return input_parse_u32(args[2], &ev->adc.value, errp);
+	} else if (strcmp(type, "resistor") == 0) {
+		ev->adc.type = PMB887X_ADC_INPUT_RESISTOR;
+		return input_parse_u32(args[2], &ev->adc.r1, errp);
+	} else if (strcmp(type, "divider") == 0) {
+		ev->adc.type = PMB887X_ADC_INPUT_RESISTOR_DIV;
+		return (
+			input_parse_u32(args[2], &ev->adc.r1, errp) &&
+			input_parse_u32(args[3], &ev->adc.r2, errp) &&
+			input_parse_u32(args[4], &ev->adc.value, errp)
+		);
+	}
+	
+	error_setg(errp, "Invalid ADC input type: %s, expected: none, voltage, resistor, divider", type);
+	return false;
+}
+
+static pmb887x_input_event_t *input_new_event(GQueue *queue, int64_t time, int type) {
+	pmb887x_input_event_t *ev = g_new0(pmb887x_input_event_t, 1);
+	ev->time = time;
+	ev->type = type;
+	g_queue_push_tail(queue, ev);
+	return ev;
+}
+
+static bool input_parse_line(char **argv, GQueue *queue, int64_t base, int64_t *prev, Error **errp) {
+	const char *cmd = argv[1];
+	int64_t time;
+	
+	if (!cmd) {
+		error_setg(errp, "Missing command after time");
+		return false;
+	}
+	
+	if (!input_parse_time(argv[0], base, *prev, &time, errp))
+		return false;
+	*prev = time;
+	
+	if (strcmp(cmd, "key") == 0) {
+		const char *action = argv[3];
+		int keycode = argv[2] ? qapi_enum_parse(&QKeyCode_lookup, argv[2], -1, NULL) : -1;
+		
+		if (keycode < 0) {
+			error_setg(errp, "Invalid key: %s", argv[2] ?: "<none>");
+			return false;
+		}
+		
+		if (!action) {
+			error_setg(errp, "Key action is required: down, up, tap");
+			return false;
+		} else if (strcmp(action, "down") == 0 || strcmp(action, "up") == 0) {
+			pmb887x_input_event_t *ev = input_new_event(queue, time, INPUT_EVENT_KEY);
+			ev->id = keycode;
+			ev->value = strcmp(action, "down") == 0;
+		} else if (strcmp(action, "tap") == 0) {
+			int64_t release = time + INPUT_DEFAULT_TAP_MS * SCALE_MS;
+			if (argv[4] && !input_parse_time(argv[4], time, time, &release, errp))
+				return false;
+			
+			pmb887x_input_event_t *down = input_new_event(queue, time, INPUT_EVENT_KEY);
+			down->id = keycode;
+			down->value = 1;
+			
+			pmb887x_input_event_t *up = input_new_event(queue, release, INPUT_EVENT_KEY);
+			up->id = keycode;
+			up->value = 0;
+			
+			// Next relative event starts after release
+			*prev = release;
+		} else {
+			error_setg(errp, "Invalid key action: %s, expected: down, up, tap", action);
+			return false;
+		}
+	} else if (strcmp(cmd, "gpio") == 0) {
+		uint32_t id, value;
+		
+		if (!argv[2]) {
+			error_setg(errp, "GPIO pin is required");
+			return false;
+		}
+		
+		if (!input_parse_gpio(argv[2], &id, errp) || !input_parse_u32(argv[3], &value, errp))
+			return false;
+		
+		pmb887x_input_event_t *ev = input_new_event(queue, time, INPUT_EVENT_GPIO);
+		ev->id = id;
+		ev->value = value ? 1 : 0;
+	} else if (strcmp(cmd, "adc") == 0) {
+		pmb887x_input_event_t *ev = input_new_event(queue, time, INPUT_EVENT_ADC);
+		if (!input_parse_adc(&argv[2], ev, errp))
+			return false;
+	} else {
+		error_setg(errp, "Unknown command: %s, expected: key, gpio, adc", cmd);
+		return false;
+	}
+	
+	return true;
+}
+
+bool pmb887x_input_schedule(const char *script, Error **errp) {
+	g_auto(GStrv) lines = g_strsplit_set(script, "\n;", -1);
+	g_autoptr(GPtrArray) argv = g_ptr_array_new();
+	GQueue queue = G_QUEUE_INIT;
+	int64_t base = input_now();
+	int64_t prev = base;
+	
+	if (!input.board) {
+		g_string_append_printf(input.deferred, "%s\n", script);
+		return true;
+	}
+	
+	for (int i = 0; lines[i]; i++) {
+		char *comment = strchr(lines[i], '#');
+		if (comment)
+			*comment = 0;
+		
+		g_auto(GStrv) tokens = g_strsplit_set(lines[i], " \t\r", -1);
+		
+		g_ptr_array_set_size(argv, 0);
+		for (int j = 0; tokens[j]; j++) {
+			if (tokens[j][0])
+				g_ptr_array_add(argv, tokens[j]);
+		}
+		
+		if (!argv->len)
+			continue;
+		
+		// Extra NULL's: optional arguments can be checked without argc
+		for (int j = 0; j < 6; j++)
+			g_ptr_array_add(argv, NULL);
+		
+		if (!input_parse_line((char **) argv->pdata, &queue, base, &prev, errp)) {
+			error_prepend(errp, "line %d: ", i + 1);
+			g_queue_clear_full(&queue, g_free);
+			return false;
+		}
+	}
+	
+	// Script is accepted only as a whole
+	pmb887x_input_event_t *ev;
+	while ((ev = g_queue_pop_head(&queue)))
+		g_queue_insert_sorted(&input.events, ev, input_event_cmp, NULL);
+	
+	input_rearm();
+	return true;
+}
+
+bool pmb887x_input_load(const char *file, Error **errp) {
+	g_autofree char *script = NULL;
+	g_autoptr(GError) gerr = NULL;
+	
+	if (!g_file_get_contents(file, &script, NULL, &gerr)) {
+		error_setg(errp, "%s", gerr->message);
+		return false;
+	}
+	
+	if (!pmb887x_input_schedule(script, errp)) {
+		error_prepend(errp, "%s: ", file);
+		return false;
+	}
+	
+	return true;
+}
+
+char *pmb887x_input_format_pending(void) {
+	g_autoptr(GString) s = g_string_new("");
+	int64_t now = input_now();
+	
+	for (GList *l = input.events.head; l; l = l->next) {
+		const pmb887x_input_event_t *ev = l->data;
+		
+		g_string_append_printf(s, "+%"PRId64"us ", (ev->time - now) / SCALE_US);
+		
+		switch (ev->type) {
+			case INPUT_EVENT_KEY:
+				g_string_append_printf(s, "key %s %s\n", QKeyCode_str(ev->id), ev->value ? "down" : "up");
+			break;
+			
+			case INPUT_EVENT_GPIO:
+				g_string_append_printf(s, "gpio %s %d\n", input.board ? input.board->gpios[ev->id].full_name : "?", ev->value);
+			break;
+			
+			case INPUT_EVENT_ADC:
+				g_string_append_printf(s, "adc %d type=%d r1=%d r2=%d value=%d\n", ev->id, ev->adc.type, ev->adc.r1, ev->adc.r2, ev->adc.value);
+			break;
+		}
+		
+		now = ev->time;
+	}
+	
+	return g_string_free(g_steal_pointer(&s), false);
+}
+
+void pmb887x_input_init(const pmb887x_board_t *board, DeviceState *keypad, DeviceState *pcl, DeviceState *adc) {
+	input.board = board;
+	input.keypad = keypad;
+	input.pcl = pcl;
+	input.adc = adc;
+	input.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, input_timer_cb, NULL);
+	
+	if (input.deferred->len) {
+		Error *err = NULL;
+		if (!pmb887x_input_schedule(input.deferred->str, &err)) {
+			error_prepend(&err, "-machine input: ");
+			error_report_err(err);
+			exit(1);
+		}
+	}
+	
+	const char *replay = getenv("PMB887X_INPUT_REPLAY");
+	if (replay) {
+		Error *err = NULL;
+		if (!pmb887x_input_load(replay, &err)) {
+			error_prepend(&err, "PMB887X_INPUT_REPLAY: ");
+			error_report_err(err);
+			exit(1);
+		}
+	}
+	
+	input_rearm();
+}
+
+static void hmp_pmb887x_input(Monitor *mon, const QDict *qdict) {
+	const char *script = qdict_get_str(qdict, "script");
+	Error *err = NULL;
+	pmb887x_input_schedule(script, &err);
+	hmp_handle_error(mon, err);
+}
+
+static void hmp_info_pmb887x_input(Monitor *mon, const QDict *qdict) {
+	g_autofree char *pending = pmb887x_input_format_pending();
+	monitor_printf(mon, "executed: %"PRIu64", pending: %d\n", input.executed, g_queue_get_length(&input.events));
+	monitor_printf(mon, "%s", pending);
+}
+
+static void pmb887x_input_register(void) {
+	g_queue_init(&input.events);
+	input.deferred = g_string_new("");
+	monitor_register_hmp("pmb887x-input", false, hmp_pmb887x_input);
+	monitor_register_hmp("pmb887x-input", true, hmp_info_pmb887x_input);
+}
+type_init(pmb887x_input_register)
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/boards.h"
+
+/*
+ * Scripted input injection (keypad, GPIO, ADC) at virtual clock timestamps.
+ *
+ * Script: one event per line (or separated by ";"), "#" starts a comment.
+ *   <time> key <qcode> down|up
+ *   <time> key <qcode> tap [hold]		press, release after hold (default: 100ms)
+ *   <time> gpio <pin> 0|1				pin: number, PIN12, KP_IN0 or GPIO_PIN0_KP_IN0
+ *   <time> adc <n> none
+ *   <time> adc <n> voltage <value>
+ *   <time> adc <n> resistor <r1>
+ *   <time> adc <n> divider <r1> <r2> <value>
+ *
+ * <time> is a number with optional suffix ns/us/ms/s (default: ms).
+ * Absolute time is counted from the moment when script was loaded, "+<time>" is relative to the previous event.
+ *
+ * Sources:
+ *   PMB887X_INPUT_REPLAY=file			loaded at machine init (virtual time 0)
+ *   -machine pmb887x,input-replay=file
+ *   qom-set /machine input "<script>"	QMP
+ *   pmb887x-input "<script>"			HMP
+ * */
+void pmb887x_input_init(const pmb887x_board_t *board, DeviceState *keypad, DeviceState *pcl, DeviceState *adc);
+bool pmb887x_input_schedule(const char *script, Error **errp);
+bool pmb887x_input_load(const char *file, Error **errp);
+char *pmb887x_input_format_pending(void);
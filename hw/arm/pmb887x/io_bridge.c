@@ -13,14 +13,45 @@
 
 #include "hw/qdev-core.h"
 #include "hw/irq.h"
+#include "qapi/error.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/atomic.h"
+#include "qemu/memfd.h"
+#include "qemu/event_notifier.h"
+#include "qemu/error-report.h"
 #include "cpu.h"
 #include "sysemu/cpu-timers.h"
 
 #include "hw/arm/pmb887x/regs.h"
 
-#define IO_BRIDGE_TIMEOUT	1000
+#define IO_BRIDGE_TIMEOUT		1000
+#define IO_BRIDGE_RING_SIZE		4096
+#define IO_BRIDGE_BATCH			64
+
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+} io_bridge_cache_range_t;
+
+static struct {
+	bool shm;
+	uint32_t batch;
+	
+	// SHM transport
+	pmb887x_io_bridge_shm_t *ring;
+	pmb887x_io_bridge_req_t *reqs;
+	int memfd;
+	EventNotifier req_event;
+	EventNotifier resp_event;
+	QEMUBH *flush_bh;
+	uint32_t posted;
+	uint32_t seq;
+	
+	// Local registers cache
+	GArray *cache_ranges;
+	GHashTable *cache;
+} io_bridge;
 
 static int sock_server_io = -1;
 static int sock_server_irq = -1;
@@ -38,6 +69,9 @@ static void _async_write(int sock, void *data, int size, int64_t timeout);
 static int _async_read_chunk(int sock, uint8_t *data, int size);
 static int _async_write_chunk(int sock, uint8_t *data, int size);
 static void *_irq_loop_thread(void *arg);
+static void _shm_init(int sock);
+static void _shm_flush_bh(void *opaque);
+static void _cache_init(const char *list);
 
 static DeviceState *nvic = NULL;
 
@@ -45,9 +79,26 @@ int current_irq = 0;
 
 static QemuThread irq_trhead_id;
 
+static const char *_getenv_default(const char *name, const char *default_value) {
+	const char *value = getenv(name);
+	return value ? value : default_value;
+}
+
 void pmb8876_io_bridge_init(void) {
-	sock_server_io = _open_unix_sock("/dev/shm/pmb8876_io_bridge.sock");
-	sock_server_irq = _open_unix_sock("/dev/shm/pmb8876_io_bridge_irq.sock");
+	const char *transport = _getenv_default("PMB887X_IO_BRIDGE_TRANSPORT", "socket");
+	if (strcmp(transport, "shm") == 0) {
+		io_bridge.shm = true;
+	} else if (strcmp(transport, "socket") != 0) {
+		error_report("Invalid PMB887X_IO_BRIDGE_TRANSPORT=%s, expected: socket, shm", transport);
+		exit(1);
+	}
+	
+	io_bridge.batch = strtoul(_getenv_default("PMB887X_IO_BRIDGE_BATCH", stringify(IO_BRIDGE_BATCH)), NULL, 0);
+	io_bridge.batch = MAX(MIN(io_bridge.batch, IO_BRIDGE_RING_SIZE), 1);
+	_cache_init(getenv("PMB887X_IO_BRIDGE_CACHE"));
+	
+	sock_server_io = _open_unix_sock(_getenv_default("PMB887X_IO_BRIDGE_SOCK", "/dev/shm/pmb8876_io_bridge.sock"));
+	sock_server_irq = _open_unix_sock(_getenv_default("PMB887X_IO_BRIDGE_IRQ_SOCK", "/dev/shm/pmb8876_io_bridge_irq.sock"));
 	
 	if (sock_server_io < 0 || sock_server_irq < 0) {
 		fprintf(stderr, "[io bridge] Can't open sockets...\r\n");
@@ -57,52 +108,212 @@ void pmb8876_io_bridge_init(void) {
 	sock_client_io = _wait_for_client(sock_server_io);
 	sock_client_irq = _wait_for_client(sock_server_irq);
 	
-	if (sock_server_io < 0 || sock_server_irq < 0) {
+	if (sock_client_io < 0 || sock_client_irq < 0) {
 		fprintf(stderr, "[io bridge] Can't wait clients...\r\n");
 		exit(1);
 	}
 	
+	if (io_bridge.shm)
+		_shm_init(sock_client_io);
+	
 	qemu_thread_create(&irq_trhead_id, "irq_loop", _irq_loop_thread, NULL, QEMU_THREAD_JOINABLE);
 	
-	fprintf(stderr, "[io bridge] IO bridge started...\r\n");
+	fprintf(stderr, "[io bridge] IO bridge started (%s)...\r\n", io_bridge.shm ? "shm" : "socket");
 }
 
-static void *_irq_loop_thread(void *arg) {
-	while (true) {
-		uint8_t irq;
-		_async_read(sock_client_irq, &irq, 1, 0);
+static void _cache_init(const char *list) {
+	if (!list)
+		return;
+	
+	g_auto(GStrv) tokens = g_strsplit_set(list, ", ", -1);
+	
+	io_bridge.cache_ranges = g_array_new(false, false, sizeof(io_bridge_cache_range_t));
+	io_bridge.cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+	
+	for (int i = 0; tokens[i]; i++) {
+		io_bridge_cache_range_t range;
+		char *end;
 		
-		bool locked = bql_locked();
-		if (!locked)
-			bql_lock();
+		if (!tokens[i][0])
+			continue;
 		
-		if (irq) {
-			qemu_set_irq(qdev_get_gpio_in(nvic, irq), 100000);
-			current_irq = irq;
+		range.start = strtoul(tokens[i], &end, 16);
+		range.end = range.start;
+		if (*end == '-')
+			range.end = strtoul(end + 1, &end, 16);
+		
+		if (*end || range.end < range.start) {
+			error_report("Invalid PMB887X_IO_BRIDGE_CACHE entry: %s", tokens[i]);
+			exit(1);
 		}
 		
-		if (!locked)
-			bql_unlock();
+		g_array_append_val(io_bridge.cache_ranges, range);
 	}
-	return NULL;
 }
 
-void pmb8876_io_bridge_set_nvic(DeviceState *nvic_ref) {
-	nvic = nvic_ref;
+static bool _cache_is_enabled(uint32_t addr) {
+	if (!io_bridge.cache_ranges)
+		return false;
+	
+	for (guint i = 0; i < io_bridge.cache_ranges->len; i++) {
+		io_bridge_cache_range_t *range = &g_array_index(io_bridge.cache_ranges, io_bridge_cache_range_t, i);
+		if (addr >= range->start && addr <= range->end)
+			return true;
+	}
+	return false;
 }
 
-unsigned int pmb8876_io_bridge_read(unsigned int addr, unsigned int size) {
-	cpu_disable_ticks();
+static bool _cache_lookup(uint32_t addr, unsigned int size, uint32_t *value) {
+	gpointer v;
+	if (size != 4 || !_cache_is_enabled(addr))
+		return false;
+	if (!g_hash_table_lookup_extended(io_bridge.cache, GUINT_TO_POINTER(addr), NULL, &v))
+		return false;
+	*value = GPOINTER_TO_UINT(v);
+	return true;
+}
+
+static void _cache_update(uint32_t addr, unsigned int size, uint32_t value) {
+	if (!_cache_is_enabled(addr))
+		return;
+	
+	// Partial access: value of the whole register is unknown
+	if (size == 4) {
+		g_hash_table_insert(io_bridge.cache, GUINT_TO_POINTER(addr), GUINT_TO_POINTER(value));
+	} else {
+		g_hash_table_remove(io_bridge.cache, GUINT_TO_POINTER(addr & ~3));
+	}
+}
+
+static void _send_fds(int sock, const int *fds, int fds_n) {
+	char tag = 'S';
+	struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+	char control[CMSG_SPACE(sizeof(int) * 3)] = {};
+	struct msghdr msg = {
+		.msg_iov		= &iov,
+		.msg_iovlen		= 1,
+		.msg_control	= control,
+		.msg_controllen	= CMSG_SPACE(sizeof(int) * fds_n),
+	};
 	
-	uint32_t from = ARM_CPU(qemu_get_cpu(0))->env.regs[15];
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_n);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_n);
 	
-	cpu_disable_ticks();
+	int ret;
+	do {
+		ret = sendmsg(sock, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
 	
-	if (from % 4 == 0)
-		from -= 4;
-	else
-		from -= 2;
+	if (ret != 1) {
+		perror("[io bridge] sendmsg");
+		exit(1);
+	}
+}
+
+static void _shm_init(int sock) {
+	size_t size = sizeof(pmb887x_io_bridge_shm_t) + sizeof(pmb887x_io_bridge_req_t) * IO_BRIDGE_RING_SIZE;
+	
+	io_bridge.ring = qemu_memfd_alloc("pmb887x-io-bridge", size, 0, &io_bridge.memfd, &error_fatal);
+	io_bridge.reqs = (pmb887x_io_bridge_req_t *) (io_bridge.ring + 1);
+	
+	memcpy(io_bridge.ring->magic, PMB887X_IO_BRIDGE_SHM_MAGIC, sizeof(io_bridge.ring->magic));
+	io_bridge.ring->version = PMB887X_IO_BRIDGE_SHM_VERSION;
+	io_bridge.ring->ring_size = IO_BRIDGE_RING_SIZE;
+	
+	if (event_notifier_init(&io_bridge.req_event, false) < 0 || event_notifier_init(&io_bridge.resp_event, false) < 0) {
+		fprintf(stderr, "[io bridge] Can't create eventfd...\r\n");
+		exit(1);
+	}
+	
+	int fds[3] = {
+		io_bridge.memfd,
+		event_notifier_get_fd(&io_bridge.req_event),
+		event_notifier_get_fd(&io_bridge.resp_event),
+	};
+	_send_fds(sock, fds, ARRAY_SIZE(fds));
+	
+	io_bridge.flush_bh = qemu_bh_new(_shm_flush_bh, NULL);
+}
+
+static void _shm_kick(void) {
+	if (!io_bridge.posted)
+		return;
+	io_bridge.posted = 0;
+	event_notifier_set(&io_bridge.req_event);
+}
+
+// Posted writes must reach the other side even if guest only waits for IRQ after them (WFI, idle loop)
+static void _shm_flush_bh(void *opaque) {
+	_shm_kick();
+}
+
+static void _shm_wait(void) {
+	struct pollfd pfd = {
+		.fd = event_notifier_get_fd(&io_bridge.resp_event),
+		.events = POLLIN,
+	};
+	
+	int ret;
+	do {
+		ret = poll(&pfd, 1, IO_BRIDGE_TIMEOUT);
+	} while (ret < 0 && errno == EINTR);
+	
+	if (ret <= 0) {
+		fprintf(stderr, "[io bridge] %s\r\n", ret ? strerror(errno) : "timeout");
+		exit(1);
+	}
+	
+	event_notifier_test_and_clear(&io_bridge.resp_event);
+}
+
+static uint32_t _shm_push(uint8_t cmd, uint32_t addr, uint32_t size, uint32_t value, uint32_t from) {
+	uint32_t head = io_bridge.ring->req_head;
+	
+	while (head - qatomic_load_acquire(&io_bridge.ring->req_tail) >= IO_BRIDGE_RING_SIZE) {
+		_shm_kick();
+		_shm_wait();
+	}
+	
+	pmb887x_io_bridge_req_t *req = &io_bridge.reqs[head % IO_BRIDGE_RING_SIZE];
+	req->cmd = cmd;
+	req->size = size;
+	req->addr = addr;
+	req->value = value;
+	req->from = from;
+	req->seq = ++io_bridge.seq;
+	
+	qatomic_store_release(&io_bridge.ring->req_head, head + 1);
+	io_bridge.posted++;
 	
+	return req->seq;
+}
+
+static void _shm_write(uint32_t addr, uint32_t size, uint32_t value, uint32_t from) {
+	_shm_push(cmd_w_size[size], addr, size, value, from);
+	
+	// IRQ ACK releases next IRQ on the other side, it can't wait for batch
+	if (io_bridge.posted >= io_bridge.batch || addr == PMB8876_NVIC_BASE + NVIC_IRQ_ACK) {
+		_shm_kick();
+	} else if (io_bridge.posted == 1) {
+		// Flush the rest from main loop, it runs when vCPU leaves MMIO or halts
+		qemu_bh_schedule(io_bridge.flush_bh);
+	}
+}
+
+static uint32_t _shm_read(uint32_t addr, uint32_t size, uint32_t from) {
+	uint32_t seq = _shm_push(cmd_r_size[size], addr, size, 0, from);
+	
+	_shm_kick();
+	while (qatomic_load_acquire(&io_bridge.ring->resp_seq) != seq)
+		_shm_wait();
+	
+	return io_bridge.ring->resp_value;
+}
+
+static uint32_t _sock_read(uint32_t addr, uint32_t size, uint32_t from) {
 	_async_write(sock_client_io, &cmd_r_size[size], 1, IO_BRIDGE_TIMEOUT);
 	_async_write(sock_client_io, &addr, 4, IO_BRIDGE_TIMEOUT);
 	_async_write(sock_client_io, &from, 4, IO_BRIDGE_TIMEOUT);
@@ -115,14 +326,25 @@ unsigned int pmb8876_io_bridge_read(unsigned int addr, unsigned int size) {
 		exit(1);
 	}
 	
-	cpu_enable_ticks();
-	
 	return buf[4] << 24 | buf[3] << 16 | buf[2] << 8 | buf[1];
 }
 
-void pmb8876_io_bridge_write(unsigned int addr, unsigned int size, unsigned int value) {
-	cpu_disable_ticks();
+static void _sock_write(uint32_t addr, uint32_t size, uint32_t value, uint32_t from) {
+	_async_write(sock_client_io, &cmd_w_size[size], 1, IO_BRIDGE_TIMEOUT);
+	_async_write(sock_client_io, &addr, 4, IO_BRIDGE_TIMEOUT);
+	_async_write(sock_client_io, &value, 4, IO_BRIDGE_TIMEOUT);
+	_async_write(sock_client_io, &from, 4, IO_BRIDGE_TIMEOUT);
 	
+	uint8_t buf;
+	_async_read(sock_client_io, &buf, 1, IO_BRIDGE_TIMEOUT);
+	
+	if (buf != 0x21) {
+		fprintf(stderr, "[io bridge] invalid ACK: %02X\n", buf);
+		exit(1);
+	}
+}
+
+static uint32_t _get_caller_pc(void) {
 	uint32_t from = ARM_CPU(qemu_get_cpu(0))->env.regs[15];
 	
 	if (from % 4 == 0)
@@ -130,6 +352,55 @@ void pmb8876_io_bridge_write(unsigned int addr, unsigned int size, unsigned int
 	else
 		from -= 2;
 	
+	return from;
+}
+
+static void *_irq_loop_thread(void *arg) {
+	while (true) {
+		uint8_t irq;
+		_async_read(sock_client_irq, &irq, 1, 0);
+		
+		bool locked = bql_locked();
+		if (!locked)
+			bql_lock();
+		
+		if (irq) {
+			qemu_set_irq(qdev_get_gpio_in(nvic, irq), 100000);
+			current_irq = irq;
+		}
+		
+		if (!locked)
+			bql_unlock();
+	}
+	return NULL;
+}
+
+void pmb8876_io_bridge_set_nvic(DeviceState *nvic_ref) {
+	nvic = nvic_ref;
+}
+
+unsigned int pmb8876_io_bridge_read(unsigned int addr, unsigned int size) {
+	uint32_t value;
+	
+	if (_cache_lookup(addr, size, &value))
+		return value;
+	
+	cpu_disable_ticks();
+	
+	if (io_bridge.shm) {
+		value = _shm_read(addr, size, _get_caller_pc());
+	} else {
+		value = _sock_read(addr, size, _get_caller_pc());
+	}
+	
+	cpu_enable_ticks();
+	
+	_cache_update(addr, size, value);
+	
+	return value;
+}
+
+void pmb8876_io_bridge_write(unsigned int addr, unsigned int size, unsigned int value) {
 	/*
 	if (addr == 0xF280020C && value)
 		value = 1;
@@ -146,20 +417,16 @@ void pmb8876_io_bridge_write(unsigned int addr, unsigned int size, unsigned int
 		value = 0x100;
 	}
 	
-	_async_write(sock_client_io, &cmd_w_size[size], 1, IO_BRIDGE_TIMEOUT);
-	_async_write(sock_client_io, &addr, 4, IO_BRIDGE_TIMEOUT);
-	_async_write(sock_client_io, &value, 4, IO_BRIDGE_TIMEOUT);
-	_async_write(sock_client_io, &from, 4, IO_BRIDGE_TIMEOUT);
-	
-	uint8_t buf;
-	_async_read(sock_client_io, &buf, 1, IO_BRIDGE_TIMEOUT);
+	_cache_update(addr, size, value);
 	
-	if (buf != 0x21) {
-		fprintf(stderr, "[io bridge] invalid ACK: %02X\n", buf);
-		exit(1);
+	if (io_bridge.shm) {
+		// Posted write, virtual clock keeps running
+		_shm_write(addr, size, value, _get_caller_pc());
+	} else {
+		cpu_disable_ticks();
+		_sock_write(addr, size, value, _get_caller_pc());
+		cpu_enable_ticks();
 	}
-	
-	cpu_enable_ticks();
 }
 
 static int _open_unix_sock(const char *name) {
@@ -172,6 +439,12 @@ static int _open_unix_sock(const char *name) {
 	struct sockaddr_un sock_un;
 	memset(&sock_un, 0, sizeof(struct sockaddr_un));
 	
+	if (strlen(name) >= sizeof(sock_un.sun_path)) {
+		fprintf(stderr, "[io bridge] socket path is too long: %s\r\n", name);
+		close(sock);
+		return -1;
+	}
+	
 	sock_un.sun_family = AF_UNIX;
 	strcpy(sock_un.sun_path, name);
 	
@@ -3,6 +3,52 @@
 #include "qemu/osdep.h"
 // #define PMB887X_IO_BRIDGE
 
+/*
+ * Configuration (env):
+ *   PMB887X_IO_BRIDGE_SOCK=path		IO socket, default: /dev/shm/pmb8876_io_bridge.sock
+ *   PMB887X_IO_BRIDGE_IRQ_SOCK=path	IRQ socket, default: /dev/shm/pmb8876_io_bridge_irq.sock
+ *   PMB887X_IO_BRIDGE_TRANSPORT=shm	use shared memory ring instead of socket round trips
+ *   PMB887X_IO_BRIDGE_BATCH=n			max posted writes before the ring is kicked, default: 64
+ *   PMB887X_IO_BRIDGE_CACHE=list		registers served from local cache after first access:
+ *   									"F4400020,F1300000-F13000FF"
+ * */
+
+/*
+ * Shared memory transport.
+ *
+ * After the IO socket is accepted, QEMU sends one byte 'S' with SCM_RIGHTS: memfd, req eventfd, resp eventfd.
+ * memfd contains pmb887x_io_bridge_shm_t followed by ring_size x pmb887x_io_bridge_req_t.
+ *
+ * QEMU -> peer: requests are appended at req_head, req eventfd is kicked before every read,
+ * when batch limit is reached or when ring is full. Writes are posted: no response.
+ *
+ * Peer -> QEMU: peer advances req_tail after executing the request. For reads it also stores
+ * resp_value and then resp_seq = req.seq. Peer kicks resp eventfd after every read and whenever
+ * it consumes the ring to the end.
+ * */
+#define PMB887X_IO_BRIDGE_SHM_MAGIC		"PMBIOBRG"
+#define PMB887X_IO_BRIDGE_SHM_VERSION	1
+
+typedef struct {
+	uint8_t cmd; // same as socket protocol: o/w/O/W - write, i/r/I/R - read
+	uint8_t size;
+	uint16_t reserved;
+	uint32_t addr;
+	uint32_t value;
+	uint32_t from;
+	uint32_t seq;
+} pmb887x_io_bridge_req_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t ring_size;
+	uint32_t req_head;
+	uint32_t req_tail;
+	uint32_t resp_seq;
+	uint32_t resp_value;
+} pmb887x_io_bridge_shm_t;
+
 void pmb8876_io_bridge_init(void);
 void pmb8876_io_bridge_write(unsigned int addr, unsigned int size, unsigned int value);
 unsigned int pmb8876_io_bridge_read(unsigned int addr, unsigned int size);
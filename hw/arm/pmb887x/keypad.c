@@ -10,14 +10,15 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "ui/input.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
+#include "hw/arm/pmb887x/keypad.h"
 
-#define TYPE_PMB887X_KEYPAD	"pmb887x-keypad"
 #define PMB887X_KEYPAD(obj)	OBJECT_CHECK(struct pmb887x_keypad_t, (obj), TYPE_PMB887X_KEYPAD)
 
 #define KEYPAD_PORTS	3
@@ -49,13 +50,10 @@ struct pmb887x_keypad_t {
 	uint32_t map_size;
 };
 
-static void keypad_handle_event(DeviceState *dev, QemuConsole *src, InputEvent *evt) {
+void pmb887x_keypad_set_key(DeviceState *dev, int keycode, bool pressed) {
 	struct pmb887x_keypad_t *p = PMB887X_KEYPAD(dev);
 	
-	bool pressed = evt->u.key.data->down;
-	int keycode = qemu_input_key_value_to_qcode(evt->u.key.data->key);
-	
-	if (keycode >= p->map_size || !p->map)
+	if (keycode < 0 || keycode >= p->map_size || !p->map)
 		return;
 	
 	if (p->pressed[keycode] == pressed)
@@ -91,6 +89,11 @@ static void keypad_handle_event(DeviceState *dev, QemuConsole *src, InputEvent *
 	}
 }
 
+static void keypad_handle_event(DeviceState *dev, QemuConsole *src, InputEvent *evt) {
+	int keycode = qemu_input_key_value_to_qcode(evt->u.key.data->key);
+	pmb887x_keypad_set_key(dev, keycode, evt->u.key.data->down);
+}
+
 static int get_reg_index_by_addr(hwaddr haddr) {
 	switch (haddr) {
 		case KEYPAD_PORT0:			return 0;
@@ -216,6 +219,20 @@ static void keypad_realize(DeviceState *dev, Error **errp) {
     qemu_input_handler_register(dev, &keypad_input_handler);
 }
 
+static const VMStateDescription keypad_vmstate = {
+	.name = TYPE_PMB887X_KEYPAD,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_SRC_ARRAY(src, struct pmb887x_keypad_t, 4),
+		VMSTATE_UINT8(extension, struct pmb887x_keypad_t),
+		VMSTATE_UINT8_2DARRAY(state, struct pmb887x_keypad_t, KEYPAD_MAX_OUT, KEYPAD_MAX_IN),
+		VMSTATE_UINT32_ARRAY(port, struct pmb887x_keypad_t, KEYPAD_PORTS),
+		VMSTATE_UINT32(con, struct pmb887x_keypad_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property keypad_properties[] = {
 	DEFINE_PROP_ARRAY("map", struct pmb887x_keypad_t, map_size, map, qdev_prop_uint32, uint32_t),
     DEFINE_PROP_END_OF_LIST(),
@@ -225,6 +242,7 @@ static void keypad_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, keypad_properties);
 	dc->realize = keypad_realize;
+	dc->vmsd = &keypad_vmstate;
 }
 
 static const TypeInfo keypad_info = {
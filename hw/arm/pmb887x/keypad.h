@@ -0,0 +1,8 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#define TYPE_PMB887X_KEYPAD	"pmb887x-keypad"
+
+// keycode is QKeyCode, mapped to the keypad matrix with "map" property
+void pmb887x_keypad_set_key(DeviceState *dev, int keycode, bool pressed);
@@ -0,0 +1,621 @@
+/*
+ * MultiMedia Card Interface (AMBA PL180)
+ * Card is attached to the QEMU SD bus ("sd-bus"), see -drive if=sd
+ * */
+#define PMB887X_TRACE_ID		MMCI
+#define PMB887X_TRACE_PREFIX	"pmb887x-mci"
+
+#include "qemu/osdep.h"
+#include "hw/sysbus.h"
+#include "hw/hw.h"
+#include "hw/irq.h"
+#include "hw/sd/sd.h"
+#include "qemu/timer.h"
+#include "exec/memory.h"
+#include "hw/qdev-properties.h"
+#include "qapi/error.h"
+#include "migration/vmstate.h"
+
+#include "hw/arm/pmb887x/regs.h"
+#include "hw/arm/pmb887x/io_bridge.h"
+#include "hw/arm/pmb887x/regs_dump.h"
+#include "hw/arm/pmb887x/fifo.h"
+#include "hw/arm/pmb887x/dmac.h"
+#include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define TYPE_PMB887X_MCI	"pmb887x-mci"
+#define PMB887X_MCI(obj)	OBJECT_CHECK(pmb887x_mci_t, (obj), TYPE_PMB887X_MCI)
+
+#define MCI_FIFO_WORDS		16
+#define MCI_FIFO_SIZE		(MCI_FIFO15 + 4 - MCI_FIFO0)
+#define MCI_DMA_SLICE		4096	// max bytes requested from DMAC per data engine step
+
+#define MCI_STATUS_STATIC	0x7FF	// bits cleared only by MCI_CLEAR
+
+#define MCI_STATUS_TX_FIFO	(MCI_STATUS_TXACTIVE | MCI_STATUS_TXFIFOHALFEMPTY | MCI_STATUS_TXFIFOFULL | MCI_STATUS_TXFIFOEMPTY | MCI_STATUS_TXDATAAVLBL)
+#define MCI_STATUS_RX_FIFO	(MCI_STATUS_RXACTIVE | MCI_STATUS_RXFIFOHALFFULL | MCI_STATUS_RXFIFOFULL | MCI_STATUS_RXFIFOEMPTY | MCI_STATUS_RXDATAAVLBL)
+
+static const uint32_t PERIPH_ID = 0x00041180;
+static const uint32_t PCELL_ID = 0xB105F00D;
+
+typedef struct {
+	SysBusDevice parent_obj;
+	MemoryRegion mmio;
+	qemu_irq irq;
+	SDBus sdbus;
+	
+	struct pmb887x_pll_t *pll;
+	pmb887x_dmac_t *dmac;
+	uint32_t dmac_periph_id;
+	bool turbo;
+	
+	QEMUTimer *data_timer;
+	pmb887x_fifo32_t fifo;
+	
+	uint32_t power;
+	uint32_t clock;
+	uint32_t argument;
+	uint32_t command;
+	uint32_t respcmd;
+	uint32_t response[4];
+	uint32_t datatimer;
+	uint32_t datalength;
+	uint32_t datactrl;
+	uint32_t datacnt;
+	uint32_t status;
+	uint32_t mask[2];
+	uint32_t select;
+} pmb887x_mci_t;
+
+static bool mci_is_data_read(pmb887x_mci_t *p) {
+	return (p->datactrl & MCI_DATACTRL_DIRECTION) == MCI_DATACTRL_DIRECTION_READ;
+}
+
+static bool mci_is_data_dma(pmb887x_mci_t *p) {
+	return p->dmac && (p->datactrl & MCI_DATACTRL_DMAENABLE);
+}
+
+static void mci_update_state(pmb887x_mci_t *p) {
+	uint32_t status = p->status & ~(MCI_STATUS_TX_FIFO | MCI_STATUS_RX_FIFO);
+	
+	if ((p->datactrl & MCI_DATACTRL_EMABLE)) {
+		uint32_t count = pmb887x_fifo_count(&p->fifo);
+		
+		if (mci_is_data_read(p)) {
+			status |= MCI_STATUS_RXACTIVE;
+			status |= count ? MCI_STATUS_RXDATAAVLBL : MCI_STATUS_RXFIFOEMPTY;
+			
+			if (count >= MCI_FIFO_WORDS / 2)
+				status |= MCI_STATUS_RXFIFOHALFFULL;
+			
+			if (count == MCI_FIFO_WORDS)
+				status |= MCI_STATUS_RXFIFOFULL;
+		} else {
+			status |= MCI_STATUS_TXACTIVE;
+			status |= count ? MCI_STATUS_TXDATAAVLBL : MCI_STATUS_TXFIFOEMPTY;
+			
+			if (count <= MCI_FIFO_WORDS / 2)
+				status |= MCI_STATUS_TXFIFOHALFEMPTY;
+			
+			if (count == MCI_FIFO_WORDS)
+				status |= MCI_STATUS_TXFIFOFULL;
+		}
+	}
+	
+	p->status = status;
+	qemu_set_irq(p->irq, (p->status & (p->mask[0] | p->mask[1])) != 0);
+}
+
+// Time of moving "size" bytes over the card bus
+static int64_t mci_get_transfer_ns(pmb887x_mci_t *p, uint32_t size) {
+	if (p->turbo || !p->pll || !(p->clock & MCI_CLOCK_ENABLE))
+		return 0;
+	
+	uint64_t mclk = pmb887x_pll_get_fsys(p->pll);
+	uint64_t freq = (p->clock & MCI_CLOCK_BYPASS) ? mclk : mclk / (2 * ((p->clock & MCI_CLOCK_CLKDIV) + 1));
+	
+	if (!freq)
+		return 0;
+	
+	uint64_t cycles = (uint64_t) size * ((p->clock & MCI_CLOCK_WIDEBUS) ? 2 : 8);
+	return muldiv64(cycles, NANOSECONDS_PER_SECOND, freq);
+}
+
+static uint32_t mci_get_step_size(pmb887x_mci_t *p) {
+	if (mci_is_data_dma(p))
+		return MIN(p->datacnt, MCI_DMA_SLICE);
+	return MIN(p->datacnt, pmb887x_fifo_free_count(&p->fifo) * 4);
+}
+
+static void mci_data_kick(pmb887x_mci_t *p) {
+	if (!(p->datactrl & MCI_DATACTRL_EMABLE) || timer_pending(p->data_timer))
+		return;
+	
+	uint32_t step = mci_get_step_size(p);
+	if (!step)
+		return;
+	
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	timer_mod(p->data_timer, now + mci_get_transfer_ns(p, step));
+}
+
+// Account bytes moved between card and FIFO/RAM
+static void mci_data_account(pmb887x_mci_t *p, uint32_t size) {
+	uint32_t block_size = 1 << ((p->datactrl & MCI_DATACTRL_BLOCKSIZE) >> MCI_DATACTRL_BLOCKSIZE_SHIFT);
+	uint32_t done = p->datalength - p->datacnt;
+	
+	p->datacnt -= size;
+	
+	if ((done + size) / block_size != done / block_size)
+		p->status |= MCI_STATUS_DATABLOCKEND;
+}
+
+static void mci_data_check_end(pmb887x_mci_t *p) {
+	if (!(p->datactrl & MCI_DATACTRL_EMABLE) || p->datacnt)
+		return;
+	
+	if (mci_is_data_read(p) && !pmb887x_fifo_is_empty(&p->fifo))
+		return;
+	
+	DPRINTF("data end\n");
+	
+	p->status |= MCI_STATUS_DATAEND | MCI_STATUS_DATABLOCKEND;
+	p->datactrl &= ~MCI_DATACTRL_EMABLE;
+	timer_del(p->data_timer);
+}
+
+static void mci_rx_fill(pmb887x_mci_t *p) {
+	if (!sdbus_data_ready(&p->sdbus))
+		return;
+	
+	while (p->datacnt && !pmb887x_fifo_is_full(&p->fifo)) {
+		uint8_t buffer[4] = { 0 };
+		uint32_t size = MIN(4, p->datacnt);
+		sdbus_read_data(&p->sdbus, buffer, size);
+		pmb887x_fifo32_push(&p->fifo, ldl_le_p(buffer));
+		mci_data_account(p, size);
+	}
+}
+
+static void mci_tx_flush(pmb887x_mci_t *p) {
+	if (!sdbus_receive_ready(&p->sdbus))
+		return;
+	
+	while (p->datacnt && !pmb887x_fifo_is_empty(&p->fifo)) {
+		uint8_t buffer[4];
+		uint32_t size = MIN(4, p->datacnt);
+		stl_le_p(buffer, pmb887x_fifo32_pop(&p->fifo));
+		sdbus_write_data(&p->sdbus, buffer, size);
+		mci_data_account(p, size);
+	}
+}
+
+// Data engine step: card I/O is done here, outside of guest MMIO handlers
+static void mci_data_run(void *opaque) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	
+	if (!(p->datactrl & MCI_DATACTRL_EMABLE))
+		return;
+	
+	uint32_t datacnt = p->datacnt;
+	
+	if (mci_is_data_read(p)) {
+		if (mci_is_data_dma(p) && p->datacnt && sdbus_data_ready(&p->sdbus))
+			pmb887x_dmac_request(p->dmac, p->dmac_periph_id, DIV_ROUND_UP(mci_get_step_size(p), 4));
+		mci_rx_fill(p);
+	} else {
+		mci_tx_flush(p);
+		if (mci_is_data_dma(p) && p->datacnt)
+			pmb887x_dmac_request(p->dmac, p->dmac_periph_id, DIV_ROUND_UP(mci_get_step_size(p), 4));
+	}
+	
+	mci_data_check_end(p);
+	
+	// Without progress wait for card (command), FIFO or DMAC (channel enable) instead of spinning
+	if (p->datacnt != datacnt)
+		mci_data_kick(p);
+	
+	mci_update_state(p);
+}
+
+static void mci_data_start(pmb887x_mci_t *p) {
+	DPRINTF("data %s: %d bytes%s\n", mci_is_data_read(p) ? "read" : "write", p->datalength, mci_is_data_dma(p) ? " [DMA]" : "");
+	
+	p->datacnt = p->datalength;
+	pmb887x_fifo_reset(&p->fifo);
+	timer_del(p->data_timer);
+	mci_data_kick(p);
+}
+
+// PER2MEM bulk: card -> guest RAM
+static void mci_dma_source(void *opaque, uint8_t *data, uint32_t size, uint32_t width) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	uint32_t offset = 0;
+	
+	while (offset + 4 <= size && !pmb887x_fifo_is_empty(&p->fifo)) {
+		stl_le_p(data + offset, pmb887x_fifo32_pop(&p->fifo));
+		offset += 4;
+	}
+	
+	if (mci_is_data_read(p) && sdbus_data_ready(&p->sdbus)) {
+		uint32_t chunk = MIN(size - offset, p->datacnt);
+		sdbus_read_data(&p->sdbus, data + offset, chunk);
+		mci_data_account(p, chunk);
+		offset += chunk;
+	}
+	
+	if (offset < size) {
+		WPRINTF("DMA read %d bytes beyond available data\n", size - offset);
+		memset(data + offset, 0, size - offset);
+	}
+	
+	mci_data_check_end(p);
+	mci_data_kick(p);
+	mci_update_state(p);
+}
+
+// MEM2PER bulk: guest RAM -> card
+static void mci_dma_sink(void *opaque, const uint8_t *data, uint32_t size, uint32_t width) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	
+	if (!(p->datactrl & MCI_DATACTRL_EMABLE) || mci_is_data_read(p) || !sdbus_receive_ready(&p->sdbus)) {
+		WPRINTF("unexpected DMA write, %d bytes dropped\n", size);
+		return;
+	}
+	
+	mci_tx_flush(p);
+	
+	uint32_t chunk = MIN(size, p->datacnt);
+	sdbus_write_data(&p->sdbus, data, chunk);
+	mci_data_account(p, chunk);
+	
+	if (chunk < size)
+		WPRINTF("DMA write %d bytes beyond DATALENGTH\n", size - chunk);
+	
+	mci_data_check_end(p);
+	mci_data_kick(p);
+	mci_update_state(p);
+}
+
+static void mci_do_command(pmb887x_mci_t *p) {
+	SDRequest request = {
+		.cmd	= p->command & MCI_COMMAND_CMDINDEX,
+		.arg	= p->argument,
+	};
+	uint8_t response[16];
+	bool is_long = (p->command & MCI_COMMAND_LONGRSP) != 0;
+	
+	int rlen = sdbus_do_command(&p->sdbus, &request, response);
+	
+	DPRINTF("CMD%d(%08X): rlen=%d\n", request.cmd, request.arg, rlen);
+	
+	if (!(p->command & MCI_COMMAND_RESPONSE)) {
+		p->status |= MCI_STATUS_CMDSENT;
+		return;
+	}
+	
+	if (rlen != (is_long ? 16 : 4)) {
+		p->status |= MCI_STATUS_CMDTIMEOUT;
+		return;
+	}
+	
+	p->respcmd = is_long ? MCI_RESPCMD_CMDINDEX : request.cmd;
+	p->response[0] = ldl_be_p(&response[0]);
+	
+	if (is_long) {
+		p->response[1] = ldl_be_p(&response[4]);
+		p->response[2] = ldl_be_p(&response[8]);
+		p->response[3] = ldl_be_p(&response[12]) & ~1;
+	} else {
+		p->response[1] = 0;
+		p->response[2] = 0;
+		p->response[3] = 0;
+	}
+	
+	p->status |= MCI_STATUS_CMDRESPEND;
+}
+
+static uint32_t mci_get_fifo_cnt(pmb887x_mci_t *p) {
+	uint32_t pending = DIV_ROUND_UP(p->datacnt, 4);
+	if (mci_is_data_read(p))
+		return pending + pmb887x_fifo_count(&p->fifo);
+	return pending - MIN(pending, pmb887x_fifo_count(&p->fifo));
+}
+
+static uint64_t mci_io_read(void *opaque, hwaddr haddr, unsigned size) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	
+	uint64_t value = 0;
+	
+	switch (haddr) {
+		case MCI_POWER:
+			value = p->power;
+		break;
+		
+		case MCI_CLOCK:
+			value = p->clock;
+		break;
+		
+		case MCI_ARGUMENT:
+			value = p->argument;
+		break;
+		
+		case MCI_COMMAND:
+			value = p->command;
+		break;
+		
+		case MCI_RESPCMD:
+			value = p->respcmd;
+		break;
+		
+		case MCI_RESPONSE0:
+		case MCI_RESPONSE1:
+		case MCI_RESPONSE2:
+		case MCI_RESPONSE3:
+			value = p->response[(haddr - MCI_RESPONSE0) / 4];
+		break;
+		
+		case MCI_DATATIMER:
+			value = p->datatimer;
+		break;
+		
+		case MCI_DATALENGTH:
+			value = p->datalength;
+		break;
+		
+		case MCI_DATACTRL:
+			value = p->datactrl;
+		break;
+		
+		case MCI_DATACNT:
+			value = p->datacnt;
+		break;
+		
+		case MCI_STATUS:
+			value = p->status;
+		break;
+		
+		case MCI_MASK0:
+			value = p->mask[0];
+		break;
+		
+		case MCI_MASK1:
+			value = p->mask[1];
+		break;
+		
+		case MCI_SELECT:
+			value = p->select;
+		break;
+		
+		case MCI_FIFOCNT:
+			value = mci_get_fifo_cnt(p);
+		break;
+		
+		case MCI_FIFO0 ... (MCI_FIFO15 + 3):
+			// Guest (or DMAC element loop) is faster than the data engine
+			if (pmb887x_fifo_is_empty(&p->fifo) && mci_is_data_read(p))
+				mci_rx_fill(p);
+			
+			if (pmb887x_fifo_is_empty(&p->fifo)) {
+				WPRINTF("unexpected FIFO read\n");
+			} else {
+				value = pmb887x_fifo32_pop(&p->fifo);
+				mci_data_check_end(p);
+				mci_data_kick(p);
+				mci_update_state(p);
+			}
+		break;
+		
+		case MCI_PERIPH_ID0:
+		case MCI_PERIPH_ID1:
+		case MCI_PERIPH_ID2:
+		case MCI_PERIPH_ID3:
+			value = (PERIPH_ID >> ((haddr - MCI_PERIPH_ID0) / 4) * 8) & 0xFF;
+		break;
+		
+		case MCI_PCELL_ID0:
+		case MCI_PCELL_ID1:
+		case MCI_PCELL_ID2:
+		case MCI_PCELL_ID3:
+			value = (PCELL_ID >> ((haddr - MCI_PCELL_ID0) / 4) * 8) & 0xFF;
+		break;
+		
+		default:
+			EPRINTF("unknown reg access: %02"PRIX64"\n", haddr);
+			exit(1);
+		break;
+	}
+	
+	IO_DUMP(haddr + p->mmio.addr, size, value, false);
+	
+	return value;
+}
+
+static void mci_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned size) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	
+	IO_DUMP(haddr + p->mmio.addr, size, value, true);
+	
+	switch (haddr) {
+		case MCI_POWER:
+			p->power = value & 0xFF;
+		break;
+		
+		case MCI_CLOCK:
+			p->clock = value & 0xFFF;
+		break;
+		
+		case MCI_ARGUMENT:
+			p->argument = value;
+		break;
+		
+		case MCI_COMMAND:
+			p->command = value & 0x7FF;
+			
+			if ((p->command & MCI_COMMAND_ENABLE)) {
+				if ((p->command & (MCI_COMMAND_INTERRUPT | MCI_COMMAND_PENDING)))
+					WPRINTF("interrupt/pending command mode not supported\n");
+				
+				mci_do_command(p);
+				p->command &= ~MCI_COMMAND_ENABLE;
+				
+				// Data commands make card ready for transfer
+				mci_data_kick(p);
+			}
+		break;
+		
+		case MCI_DATATIMER:
+			p->datatimer = value;
+		break;
+		
+		case MCI_DATALENGTH:
+			p->datalength = value & MCI_DATALENGTH_LENGTH;
+		break;
+		
+		case MCI_DATACTRL:
+			p->datactrl = value & 0xFF;
+			
+			if ((p->datactrl & MCI_DATACTRL_EMABLE)) {
+				mci_data_start(p);
+			} else {
+				timer_del(p->data_timer);
+			}
+		break;
+		
+		case MCI_CLEAR:
+			p->status &= ~(value & MCI_STATUS_STATIC);
+		break;
+		
+		case MCI_MASK0:
+			p->mask[0] = value & 0x3FFFFF;
+		break;
+		
+		case MCI_MASK1:
+			p->mask[1] = value & 0x3FFFFF;
+		break;
+		
+		case MCI_SELECT:
+			p->select = value & MCI_SELECT_SDCARD;
+		break;
+		
+		case MCI_FIFO0 ... (MCI_FIFO15 + 3):
+			if (!(p->datactrl & MCI_DATACTRL_EMABLE) || mci_is_data_read(p) || pmb887x_fifo_is_full(&p->fifo)) {
+				WPRINTF("unexpected FIFO write\n");
+			} else {
+				pmb887x_fifo32_push(&p->fifo, value);
+				
+				// Guest (or DMAC element loop) is faster than the data engine
+				if (pmb887x_fifo_is_full(&p->fifo))
+					mci_tx_flush(p);
+				
+				mci_data_check_end(p);
+				mci_data_kick(p);
+			}
+		break;
+		
+		default:
+			EPRINTF("unknown reg access: %02"PRIX64"\n", haddr);
+			exit(1);
+		break;
+	}
+	
+	mci_update_state(p);
+}
+
+static const MemoryRegionOps io_ops = {
+	.read			= mci_io_read,
+	.write			= mci_io_write,
+	.endianness		= DEVICE_NATIVE_ENDIAN,
+	.valid			= {
+		.min_access_size	= 1,
+		.max_access_size	= 4
+	}
+};
+
+static void mci_init(Object *obj) {
+	pmb887x_mci_t *p = PMB887X_MCI(obj);
+	memory_region_init_io(&p->mmio, obj, &io_ops, p, "pmb887x-mci", MCI_IO_SIZE);
+	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
+	sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq);
+	qbus_init(&p->sdbus, sizeof(p->sdbus), TYPE_SD_BUS, DEVICE(obj), "sd-bus");
+}
+
+static void mci_realize(DeviceState *dev, Error **errp) {
+	pmb887x_mci_t *p = PMB887X_MCI(dev);
+	
+	if (!p->irq)
+		hw_error("pmb887x-mci: irq not set");
+	
+	pmb887x_fifo32_init(&p->fifo, MCI_FIFO_WORDS);
+	p->data_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, mci_data_run, p);
+	
+	if (p->dmac) {
+		pmb887x_dmac_set_source(p->dmac, p->dmac_periph_id, &p->mmio, MCI_FIFO0, MCI_FIFO_SIZE, mci_dma_source, p);
+		pmb887x_dmac_set_sink(p->dmac, p->dmac_periph_id, &p->mmio, MCI_FIFO0, MCI_FIFO_SIZE, mci_dma_sink, p);
+	}
+	
+	mci_update_state(p);
+}
+
+static int mci_post_load(void *opaque, int version_id) {
+	pmb887x_mci_t *p = (pmb887x_mci_t *) opaque;
+	
+	// Continue pending data transfer with current card clock
+	timer_del(p->data_timer);
+	mci_data_kick(p);
+	
+	return 0;
+}
+
+static const VMStateDescription mci_vmstate = {
+	.name = TYPE_PMB887X_MCI,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = mci_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_FIFO32(fifo, pmb887x_mci_t),
+		VMSTATE_UINT32(power, pmb887x_mci_t),
+		VMSTATE_UINT32(clock, pmb887x_mci_t),
+		VMSTATE_UINT32(argument, pmb887x_mci_t),
+		VMSTATE_UINT32(command, pmb887x_mci_t),
+		VMSTATE_UINT32(respcmd, pmb887x_mci_t),
+		VMSTATE_UINT32_ARRAY(response, pmb887x_mci_t, 4),
+		VMSTATE_UINT32(datatimer, pmb887x_mci_t),
+		VMSTATE_UINT32(datalength, pmb887x_mci_t),
+		VMSTATE_UINT32(datactrl, pmb887x_mci_t),
+		VMSTATE_UINT32(datacnt, pmb887x_mci_t),
+		VMSTATE_UINT32(status, pmb887x_mci_t),
+		VMSTATE_UINT32_ARRAY(mask, pmb887x_mci_t, 2),
+		VMSTATE_UINT32(select, pmb887x_mci_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static Property mci_properties[] = {
+	DEFINE_PROP_LINK("pll", pmb887x_mci_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
+	DEFINE_PROP_LINK("dmac", pmb887x_mci_t, dmac, "pmb887x-dmac", pmb887x_dmac_t *),
+	DEFINE_PROP_UINT32("dmac-periph-id", pmb887x_mci_t, dmac_periph_id, 5),
+	DEFINE_PROP_BOOL("turbo", pmb887x_mci_t, turbo, false),
+	DEFINE_PROP_END_OF_LIST(),
+};
+
+static void mci_class_init(ObjectClass *klass, void *data) {
+	DeviceClass *dc = DEVICE_CLASS(klass);
+	device_class_set_props(dc, mci_properties);
+	dc->realize = mci_realize;
+	dc->vmsd = &mci_vmstate;
+}
+
+static const TypeInfo mci_info = {
+    .name          	= TYPE_PMB887X_MCI,
+    .parent        	= TYPE_SYS_BUS_DEVICE,
+    .instance_size 	= sizeof(pmb887x_mci_t),
+    .instance_init 	= mci_init,
+    .class_init    	= mci_class_init,
+};
+
+static void mci_register_types(void) {
+	type_register_static(&mci_info);
+}
+type_init(mci_register_types)
@@ -15,6 +15,7 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "cpu.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
@@ -62,7 +63,7 @@ static void mmci_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 	IO_DUMP(haddr + p->mmio.addr, size, value, true);
 	
 	switch (haddr) {
-		case GPIO_CLC:
+		case MMCI_CLC:
 			pmb887x_clc_set(&p->clc, value);
 		break;
 		
@@ -94,6 +95,16 @@ static void mmci_realize(DeviceState *dev, Error **errp) {
 	pmb887x_clc_init(&p->clc);
 }
 
+static const VMStateDescription mmci_vmstate = {
+	.name = TYPE_PMB887X_MMCI,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, pmb887x_mmci_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property mmci_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -102,6 +113,7 @@ static void mmci_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, mmci_properties);
 	dc->realize = mmci_realize;
+	dc->vmsd = &mmci_vmstate;
 }
 
 static const TypeInfo mmci_info = {
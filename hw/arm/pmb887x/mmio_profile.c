@@ -0,0 +1,335 @@
+/*
+ * MMIO access profiler
+ * */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qemu/module.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "exec/address-spaces.h"
+
+#include "hw/arm/pmb887x/mmio_profile.h"
+#include "hw/arm/pmb887x/regs_dump.h"
+
+#define MMIO_PROFILE_REG_SIZE		4
+#define MMIO_PROFILE_DEFAULT_TOP	20
+
+typedef struct {
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t read_ns;
+	uint64_t write_ns;
+} pmb887x_mmio_counter_t;
+
+typedef struct {
+	MemoryRegionOps ops;
+	const MemoryRegionOps *orig_ops;
+	void *orig_opaque;
+	const char *name;
+	uint32_t base;
+	uint32_t regs_count;
+	pmb887x_mmio_counter_t total;
+	pmb887x_mmio_counter_t *regs;
+} pmb887x_mmio_dev_t;
+
+typedef struct {
+	const pmb887x_mmio_dev_t *dev;
+	uint32_t index;
+} pmb887x_mmio_reg_ref_t;
+
+static struct {
+	bool enabled;
+	GPtrArray *devices;
+	char *csv_file;
+	
+	MemoryListener listener;
+	uint64_t rebuilds;
+	uint64_t remaps;
+	uint64_t remaps_skipped;
+} profile;
+
+static inline pmb887x_mmio_counter_t *mmio_profile_reg(pmb887x_mmio_dev_t *d, hwaddr addr) {
+	uint32_t index = addr / MMIO_PROFILE_REG_SIZE;
+	return index < d->regs_count ? &d->regs[index] : NULL;
+}
+
+static MemTxResult mmio_profile_call_read(pmb887x_mmio_dev_t *d, hwaddr addr, uint64_t *data, unsigned size, MemTxAttrs attrs) {
+	if (d->orig_ops->read) {
+		*data = d->orig_ops->read(d->orig_opaque, addr, size);
+		return MEMTX_OK;
+	}
+	return d->orig_ops->read_with_attrs(d->orig_opaque, addr, data, size, attrs);
+}
+
+static MemTxResult mmio_profile_call_write(pmb887x_mmio_dev_t *d, hwaddr addr, uint64_t data, unsigned size, MemTxAttrs attrs) {
+	if (d->orig_ops->write) {
+		d->orig_ops->write(d->orig_opaque, addr, data, size);
+		return MEMTX_OK;
+	}
+	return d->orig_ops->write_with_attrs(d->orig_opaque, addr, data, size, attrs);
+}
+
+static MemTxResult mmio_profile_read(void *opaque, hwaddr addr, uint64_t *data, unsigned size, MemTxAttrs attrs) {
+	pmb887x_mmio_dev_t *d = opaque;
+	
+	if (likely(!profile.enabled))
+		return mmio_profile_call_read(d, addr, data, size, attrs);
+	
+	int64_t start = get_clock();
+	MemTxResult result = mmio_profile_call_read(d, addr, data, size, attrs);
+	uint64_t elapsed = get_clock() - start;
+	
+	pmb887x_mmio_counter_t *reg = mmio_profile_reg(d, addr);
+	if (reg) {
+		reg->reads++;
+		reg->read_ns += elapsed;
+	}
+	d->total.reads++;
+	d->total.read_ns += elapsed;
+	
+	return result;
+}
+
+static MemTxResult mmio_profile_write(void *opaque, hwaddr addr, uint64_t data, unsigned size, MemTxAttrs attrs) {
+	pmb887x_mmio_dev_t *d = opaque;
+	
+	if (likely(!profile.enabled))
+		return mmio_profile_call_write(d, addr, data, size, attrs);
+	
+	int64_t start = get_clock();
+	MemTxResult result = mmio_profile_call_write(d, addr, data, size, attrs);
+	uint64_t elapsed = get_clock() - start;
+	
+	pmb887x_mmio_counter_t *reg = mmio_profile_reg(d, addr);
+	if (reg) {
+		reg->writes++;
+		reg->write_ns += elapsed;
+	}
+	d->total.writes++;
+	d->total.write_ns += elapsed;
+	
+	return result;
+}
+
+void pmb887x_mmio_profile_attach(MemoryRegion *mr, const char *name, uint32_t base) {
+	if (!mr->ops || (!mr->ops->read && !mr->ops->read_with_attrs))
+		return;
+	
+	pmb887x_mmio_dev_t *d = g_new0(pmb887x_mmio_dev_t, 1);
+	d->orig_ops = mr->ops;
+	d->orig_opaque = mr->opaque;
+	d->name = name;
+	d->base = base;
+	d->regs_count = DIV_ROUND_UP(memory_region_size(mr), MMIO_PROFILE_REG_SIZE);
+	d->regs = g_new0(pmb887x_mmio_counter_t, d->regs_count);
+	
+	// Same sizes and endianness, only handlers are replaced
+	d->ops = *mr->ops;
+	d->ops.read = NULL;
+	d->ops.write = NULL;
+	d->ops.read_with_attrs = mmio_profile_read;
+	d->ops.write_with_attrs = mmio_profile_write;
+	
+	mr->ops = &d->ops;
+	mr->opaque = d;
+	
+	g_ptr_array_add(profile.devices, d);
+}
+
+void pmb887x_mmio_profile_enable(bool enable) {
+	profile.enabled = enable;
+}
+
+bool pmb887x_mmio_profile_enabled(void) {
+	return profile.enabled;
+}
+
+void pmb887x_mmio_profile_remap(bool changed) {
+	if (changed) {
+		profile.remaps++;
+	} else {
+		profile.remaps_skipped++;
+	}
+}
+
+void pmb887x_mmio_profile_reset(void) {
+	profile.rebuilds = 0;
+	profile.remaps = 0;
+	profile.remaps_skipped = 0;
+	
+	for (guint i = 0; i < profile.devices->len; i++) {
+		pmb887x_mmio_dev_t *d = g_ptr_array_index(profile.devices, i);
+		memset(&d->total, 0, sizeof(d->total));
+		memset(d->regs, 0, sizeof(pmb887x_mmio_counter_t) * d->regs_count);
+	}
+}
+
+static const char *mmio_profile_module_name(const pmb887x_mmio_dev_t *d) {
+	const pmb887x_module_t *module = pmb887x_find_cpu_module(d->base);
+	return module ? module->name : d->name;
+}
+
+static const char *mmio_profile_reg_name(const pmb887x_mmio_dev_t *d, uint32_t index) {
+	const pmb887x_module_t *module = pmb887x_find_cpu_module(d->base);
+	const pmb887x_module_reg_t *reg = module ? pmb887x_find_cpu_module_reg(module, d->base + index * MMIO_PROFILE_REG_SIZE) : NULL;
+	return reg ? reg->name : "";
+}
+
+static uint64_t mmio_counter_ns(const pmb887x_mmio_counter_t *c) {
+	return c->read_ns + c->write_ns;
+}
+
+static gint mmio_profile_dev_cmp(gconstpointer a, gconstpointer b) {
+	const pmb887x_mmio_dev_t *da = *(const pmb887x_mmio_dev_t **) a;
+	const pmb887x_mmio_dev_t *db = *(const pmb887x_mmio_dev_t **) b;
+	uint64_t ta = mmio_counter_ns(&da->total);
+	uint64_t tb = mmio_counter_ns(&db->total);
+	return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+static gint mmio_profile_reg_cmp(gconstpointer a, gconstpointer b) {
+	const pmb887x_mmio_reg_ref_t *ra = a;
+	const pmb887x_mmio_reg_ref_t *rb = b;
+	uint64_t ta = mmio_counter_ns(&ra->dev->regs[ra->index]);
+	uint64_t tb = mmio_counter_ns(&rb->dev->regs[rb->index]);
+	return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+bool pmb887x_mmio_profile_save_csv(const char *file, Error **errp) {
+	FILE *fp = fopen(file, "w");
+	if (!fp) {
+		error_setg_errno(errp, errno, "fopen(%s)", file);
+		return false;
+	}
+	
+	fprintf(fp, "module,register,address,reads,writes,read_ns,write_ns\n");
+	
+	for (guint i = 0; i < profile.devices->len; i++) {
+		const pmb887x_mmio_dev_t *d = g_ptr_array_index(profile.devices, i);
+		
+		for (uint32_t j = 0; j < d->regs_count; j++) {
+			const pmb887x_mmio_counter_t *c = &d->regs[j];
+			if (!c->reads && !c->writes)
+				continue;
+			
+			fprintf(fp, "%s,%s,%08X,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64"\n",
+				mmio_profile_module_name(d), mmio_profile_reg_name(d, j), d->base + j * MMIO_PROFILE_REG_SIZE,
+				c->reads, c->writes, c->read_ns, c->write_ns);
+		}
+	}
+	
+	if (fclose(fp) != 0) {
+		error_setg_errno(errp, errno, "fclose(%s)", file);
+		return false;
+	}
+	
+	return true;
+}
+
+static void mmio_profile_atexit(void) {
+	Error *err = NULL;
+	if (!pmb887x_mmio_profile_save_csv(profile.csv_file, &err))
+		error_report_err(err);
+}
+
+// Called once per FlatView rebuild, after all address spaces are updated
+static void mmio_profile_memory_commit(MemoryListener *listener) {
+	profile.rebuilds++;
+}
+
+void pmb887x_mmio_profile_init(void) {
+	profile.listener.name = "pmb887x-mmio-profile";
+	profile.listener.commit = mmio_profile_memory_commit;
+	memory_listener_register(&profile.listener, &address_space_memory);
+	profile.rebuilds = 0;
+	
+	const char *file = getenv("PMB887X_MMIO_PROFILE");
+	if (file && file[0]) {
+		profile.csv_file = g_strdup(file);
+		profile.enabled = true;
+		atexit(mmio_profile_atexit);
+	}
+}
+
+static void hmp_pmb887x_mmio_profile(Monitor *mon, const QDict *qdict) {
+	const char *action = qdict_get_str(qdict, "action");
+	const char *file = qdict_get_try_str(qdict, "filename");
+	Error *err = NULL;
+	
+	if (strcmp(action, "on") == 0) {
+		pmb887x_mmio_profile_enable(true);
+	} else if (strcmp(action, "off") == 0) {
+		pmb887x_mmio_profile_enable(false);
+	} else if (strcmp(action, "reset") == 0) {
+		pmb887x_mmio_profile_reset();
+	} else if (strcmp(action, "csv") == 0) {
+		if (!file) {
+			error_setg(&err, "CSV file name is required");
+		} else {
+			pmb887x_mmio_profile_save_csv(file, &err);
+		}
+	} else {
+		error_setg(&err, "Invalid action: %s, expected: on, off, reset, csv", action);
+	}
+	
+	hmp_handle_error(mon, err);
+}
+
+static void hmp_info_pmb887x_mmio_profile(Monitor *mon, const QDict *qdict) {
+	int top = qdict_get_try_int(qdict, "count", MMIO_PROFILE_DEFAULT_TOP);
+	g_autoptr(GPtrArray) devices = g_ptr_array_copy(profile.devices, NULL, NULL);
+	g_autoptr(GArray) regs = g_array_new(false, false, sizeof(pmb887x_mmio_reg_ref_t));
+	uint64_t total_ns = 0;
+	
+	monitor_printf(mon, "profiler: %s\n", profile.enabled ? "on" : "off");
+	monitor_printf(mon, "memory map: %"PRIu64" rebuilds, %"PRIu64" remaps, %"PRIu64" unchanged remaps skipped\n",
+		profile.rebuilds, profile.remaps, profile.remaps_skipped);
+	
+	for (guint i = 0; i < devices->len; i++) {
+		const pmb887x_mmio_dev_t *d = g_ptr_array_index(devices, i);
+		total_ns += mmio_counter_ns(&d->total);
+		
+		for (uint32_t j = 0; j < d->regs_count; j++) {
+			if (d->regs[j].reads || d->regs[j].writes) {
+				pmb887x_mmio_reg_ref_t ref = { d, j };
+				g_array_append_val(regs, ref);
+			}
+		}
+	}
+	
+	g_ptr_array_sort(devices, mmio_profile_dev_cmp);
+	g_array_sort(regs, mmio_profile_reg_cmp);
+	
+	monitor_printf(mon, "%-10s %12s %12s %14s %6s\n", "MODULE", "READS", "WRITES", "TIME_NS", "%");
+	for (guint i = 0; i < devices->len; i++) {
+		const pmb887x_mmio_dev_t *d = g_ptr_array_index(devices, i);
+		uint64_t ns = mmio_counter_ns(&d->total);
+		
+		if (!d->total.reads && !d->total.writes)
+			continue;
+		
+		monitor_printf(mon, "%-10s %12"PRIu64" %12"PRIu64" %14"PRIu64" %6.2f\n",
+			mmio_profile_module_name(d), d->total.reads, d->total.writes, ns, total_ns ? ns * 100.0 / total_ns : 0);
+	}
+	
+	monitor_printf(mon, "\n%-10s %-20s %-8s %12s %12s %14s %8s\n", "MODULE", "REGISTER", "ADDR", "READS", "WRITES", "TIME_NS", "AVG_NS");
+	for (guint i = 0; i < regs->len && i < top; i++) {
+		const pmb887x_mmio_reg_ref_t *ref = &g_array_index(regs, pmb887x_mmio_reg_ref_t, i);
+		const pmb887x_mmio_counter_t *c = &ref->dev->regs[ref->index];
+		
+		monitor_printf(mon, "%-10s %-20s %08X %12"PRIu64" %12"PRIu64" %14"PRIu64" %8"PRIu64"\n",
+			mmio_profile_module_name(ref->dev), mmio_profile_reg_name(ref->dev, ref->index),
+			ref->dev->base + ref->index * MMIO_PROFILE_REG_SIZE, c->reads, c->writes,
+			mmio_counter_ns(c), mmio_counter_ns(c) / (c->reads + c->writes));
+	}
+}
+
+static void pmb887x_mmio_profile_register(void) {
+	profile.devices = g_ptr_array_new();
+	monitor_register_hmp("pmb887x-mmio-profile", false, hmp_pmb887x_mmio_profile);
+	monitor_register_hmp("pmb887x-mmio-profile", true, hmp_info_pmb887x_mmio_profile);
+}
+type_init(pmb887x_mmio_profile_register)
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "exec/memory.h"
+
+/*
+ * MMIO access profiler: per-module and per-register read/write counts and host time spent in handlers.
+ *
+ *   PMB887X_MMIO_PROFILE=file.csv			enable from start, write CSV at exit
+ *   pmb887x-mmio-profile on|off|reset		HMP
+ *   pmb887x-mmio-profile csv file.csv
+ *   info pmb887x-mmio-profile [count]
+ *   qom-set /machine mmio-profile true		QMP
+ *
+ * Handlers are always wrapped, when profiler is disabled the cost is one extra indirect call.
+ *
+ * Memory map updates (EBU chip selects, TCM) and system address space rebuilds are always counted.
+ * */
+void pmb887x_mmio_profile_init(void);
+void pmb887x_mmio_profile_attach(MemoryRegion *mr, const char *name, uint32_t base);
+void pmb887x_mmio_profile_enable(bool enable);
+bool pmb887x_mmio_profile_enabled(void);
+void pmb887x_mmio_profile_reset(void);
+bool pmb887x_mmio_profile_save_csv(const char *file, Error **errp);
+void pmb887x_mmio_profile_remap(bool changed);
@@ -1,5 +1,5 @@
 /*
- * Standart parts for all modules: CLC, SRB, SRC
+ * Standart parts for all modules: CLC, SRB, SRC, RAM windows
  * */
 #define PMB887X_TRACE_ID		MOD
 #define PMB887X_TRACE_PREFIX	"pmb887x-mod"
@@ -8,6 +8,8 @@
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/hw.h"
 #include "qemu/error-report.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
 #include "hw/arm/pmb887x/trace.h"
 
 void pmb887x_clc_init(pmb887x_clc_reg_t *reg) {
@@ -237,3 +239,136 @@ void pmb887x_srb_ext_set_isr(pmb887x_srb_ext_reg_t *reg, uint32_t value) {
 	if (reg->ris)
 		pmb887x_srb_set_isr(reg->parent, reg->events);
 }
+
+/*
+ * VMState
+ * IRQ lines are not migrated, receivers keep their own input state.
+ * */
+const VMStateDescription vmstate_pmb887x_clc = {
+	.name = "pmb887x-clc",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(value, pmb887x_clc_reg_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+const VMStateDescription vmstate_pmb887x_src = {
+	.name = "pmb887x-src",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(value, pmb887x_src_reg_t),
+		VMSTATE_BOOL(last_irq_state, pmb887x_src_reg_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+/*
+ * RAM window
+ * */
+static uint64_t ram_window_watch_read(void *opaque, hwaddr haddr, unsigned size) {
+	pmb887x_ram_window_watch_t *w = (pmb887x_ram_window_watch_t *) opaque;
+	return ldn_le_p(w->win->ptr + w->offset + haddr, size);
+}
+
+static void ram_window_watch_write(void *opaque, hwaddr haddr, uint64_t value, unsigned size) {
+	pmb887x_ram_window_watch_t *w = (pmb887x_ram_window_watch_t *) opaque;
+	stn_le_p(w->win->ptr + w->offset + haddr, size, value);
+	w->dirty = true;
+	
+	if (w->callback)
+		w->callback(w->opaque, w->offset + haddr, value, size);
+}
+
+static const MemoryRegionOps ram_window_watch_ops = {
+	.read			= ram_window_watch_read,
+	.write			= ram_window_watch_write,
+	.endianness		= DEVICE_NATIVE_ENDIAN,
+	.valid			= {
+		.min_access_size	= 1,
+		.max_access_size	= 4
+	}
+};
+
+bool pmb887x_ram_window_init(pmb887x_ram_window_t *win, Object *owner, const char *name,
+		MemoryRegion *parent, hwaddr base, uint32_t size, Error **errp) {
+	g_autofree char *ram_name = g_strdup_printf("%s-ram", name);
+	
+	win->size = size;
+	win->watch_n = 0;
+	
+	memory_region_init(&win->container, owner, name, size);
+	if (!memory_region_init_ram(&win->ram, owner, ram_name, size, errp))
+		return false;
+	
+	win->ptr = memory_region_get_ram_ptr(&win->ram);
+	memory_region_add_subregion(&win->container, 0, &win->ram);
+	
+	// Window overrides module IO callbacks
+	memory_region_add_subregion_overlap(parent, base, &win->container, 1);
+	
+	return true;
+}
+
+int pmb887x_ram_window_watch(pmb887x_ram_window_t *win, uint32_t offset, uint32_t size,
+		pmb887x_ram_window_notify_t callback, void *opaque) {
+	if (win->watch_n >= PMB887X_RAM_WINDOW_MAX_WATCH) {
+		EPRINTF("%s: too many watches\n", memory_region_name(&win->container));
+		exit(1);
+	}
+	
+	if (offset + size > win->size) {
+		EPRINTF("%s: watch %08X-%08X out of window\n", memory_region_name(&win->container), offset, offset + size - 1);
+		exit(1);
+	}
+	
+	int id = win->watch_n++;
+	pmb887x_ram_window_watch_t *w = &win->watch[id];
+	g_autofree char *watch_name = g_strdup_printf("%s-watch%d", memory_region_name(&win->container), id);
+	
+	w->win = win;
+	w->offset = offset;
+	w->size = size;
+	w->dirty = false;
+	w->callback = callback;
+	w->opaque = opaque;
+	
+	memory_region_init_io(&w->mmio, memory_region_owner(&win->container), &ram_window_watch_ops, w, watch_name, size);
+	memory_region_add_subregion_overlap(&win->container, offset, &w->mmio, 1);
+	
+	return id;
+}
+
+bool pmb887x_ram_window_test_and_clear_dirty(pmb887x_ram_window_t *win, int id) {
+	bool dirty = win->watch[id].dirty;
+	win->watch[id].dirty = false;
+	return dirty;
+}
+
+const VMStateDescription vmstate_pmb887x_srb = {
+	.name = "pmb887x-srb",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_INT32_EQUAL(irq_n, pmb887x_srb_reg_t, NULL),
+		VMSTATE_VARRAY_INT32(last_irq_state, pmb887x_srb_reg_t, irq_n, 0, vmstate_info_bool, bool),
+		VMSTATE_VARRAY_INT32(irq_events, pmb887x_srb_reg_t, irq_n, 0, vmstate_info_uint32, uint32_t),
+		VMSTATE_UINT32(last_state, pmb887x_srb_reg_t),
+		VMSTATE_UINT32(imsc, pmb887x_srb_reg_t),
+		VMSTATE_UINT32(ris, pmb887x_srb_reg_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+const VMStateDescription vmstate_pmb887x_srb_ext = {
+	.name = "pmb887x-srb-ext",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(imsc, pmb887x_srb_ext_reg_t),
+		VMSTATE_UINT32(ris, pmb887x_srb_ext_reg_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
@@ -1,6 +1,32 @@
 #pragma once
 #include "qemu/osdep.h"
 #include "hw/irq.h"
+#include "exec/memory.h"
+#include "migration/vmstate.h"
+
+#define PMB887X_RAM_WINDOW_MAX_WATCH	4
+
+typedef struct pmb887x_ram_window_t pmb887x_ram_window_t;
+typedef void (*pmb887x_ram_window_notify_t)(void *opaque, uint32_t offset, uint64_t value, unsigned size);
+
+typedef struct {
+	pmb887x_ram_window_t *win;
+	MemoryRegion mmio;
+	uint32_t offset;
+	uint32_t size;
+	bool dirty;
+	pmb887x_ram_window_notify_t callback;
+	void *opaque;
+} pmb887x_ram_window_watch_t;
+
+struct pmb887x_ram_window_t {
+	MemoryRegion container;
+	MemoryRegion ram;
+	uint8_t *ptr;
+	uint32_t size;
+	pmb887x_ram_window_watch_t watch[PMB887X_RAM_WINDOW_MAX_WATCH];
+	int watch_n;
+};
 
 typedef struct pmb887x_clc_reg_t {
 	uint32_t value;
@@ -68,3 +94,35 @@ uint32_t pmb887x_srb_ext_get_ris(pmb887x_srb_ext_reg_t *reg);
 void pmb887x_srb_ext_set_imsc(pmb887x_srb_ext_reg_t *reg, uint32_t value);
 void pmb887x_srb_ext_set_icr(pmb887x_srb_ext_reg_t *reg, uint32_t value);
 void pmb887x_srb_ext_set_isr(pmb887x_srb_ext_reg_t *reg, uint32_t value);
+
+/*
+ * RAM window: plain memory mapped into module IO, accessed by guest without MMIO callbacks.
+ * Offsets which model must see are covered by small watch regions: write goes to RAM, then dirty flag and callback.
+ * RAM content is migrated as RAM block, not in module vmstate.
+ * */
+bool pmb887x_ram_window_init(pmb887x_ram_window_t *win, Object *owner, const char *name,
+	MemoryRegion *parent, hwaddr base, uint32_t size, Error **errp);
+int pmb887x_ram_window_watch(pmb887x_ram_window_t *win, uint32_t offset, uint32_t size,
+	pmb887x_ram_window_notify_t callback, void *opaque);
+bool pmb887x_ram_window_test_and_clear_dirty(pmb887x_ram_window_t *win, int id);
+
+// VMState
+extern const VMStateDescription vmstate_pmb887x_clc;
+extern const VMStateDescription vmstate_pmb887x_src;
+extern const VMStateDescription vmstate_pmb887x_srb;
+extern const VMStateDescription vmstate_pmb887x_srb_ext;
+
+#define VMSTATE_PMB887X_CLC(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_clc, pmb887x_clc_reg_t)
+
+#define VMSTATE_PMB887X_SRC(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_src, pmb887x_src_reg_t)
+
+#define VMSTATE_PMB887X_SRC_ARRAY(_f, _s, _n) \
+	VMSTATE_STRUCT_ARRAY(_f, _s, _n, 0, vmstate_pmb887x_src, pmb887x_src_reg_t)
+
+#define VMSTATE_PMB887X_SRB(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_srb, pmb887x_srb_reg_t)
+
+#define VMSTATE_PMB887X_SRB_EXT(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_srb_ext, pmb887x_srb_ext_reg_t)
@@ -14,6 +14,11 @@
 #include "qapi/error.h"
 #include "hw/qdev-properties.h"
 #include "hw/irq.h"
+#include "migration/vmstate.h"
+#include "qemu/bitops.h"
+#include "qemu/timer.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
@@ -23,6 +28,7 @@
 #define TYPE_PMB887X_NVIC	"pmb887x-nvic"
 #define PMB887X_NVIC(obj)	OBJECT_CHECK(pmb887x_nvic_t, (obj), TYPE_PMB887X_NVIC)
 #define IRQS_COUNT			((NVIC_CON169 - NVIC_CON0) / 4 + 1)
+#define PRIORITIES_COUNT	((NVIC_CON_PRIORITY >> NVIC_CON_PRIORITY_SHIFT) + 1)
 
 typedef struct {
 	uint8_t id;
@@ -30,13 +36,33 @@ typedef struct {
 	uint8_t priority;
 	uint8_t level;
 	bool bridge;
+	
+	// Stats
+	uint64_t count;
+	uint64_t acks;
+	int64_t asserted_at; // -1 - not pending
+	int64_t latency_sum;
+	int64_t latency_max;
 } pmb887x_nvic_irq_t;
 
+// Pending lines grouped by NVIC_CON priority
+typedef struct {
+	DECLARE_BITMAP(lines, IRQS_COUNT);
+} pmb887x_nvic_prio_t;
+
+typedef struct {
+	pmb887x_nvic_prio_t prio[PRIORITIES_COUNT];
+	DECLARE_BITMAP(used, PRIORITIES_COUNT);
+} pmb887x_nvic_pending_t;
+
 typedef struct {
 	SysBusDevice parent_obj;
 	MemoryRegion mmio;
 	
 	pmb887x_nvic_irq_t irq_state[IRQS_COUNT];
+	pmb887x_nvic_pending_t pending[2]; // IRQ, FIQ
+	
+	uint32_t cpu_type;
 	
 	qemu_irq parent_irq;
 	qemu_irq parent_fiq;
@@ -48,32 +74,84 @@ typedef struct {
 	bool fiq_lock;
 } pmb887x_nvic_t;
 
-static uint32_t nvic_get_priority(pmb887x_nvic_irq_t *line) {
-	if (!line->level)
-		return 0;
-	return (line->priority << 16) | (line->level << 8) | ((IRQS_COUNT - line->id));
+static void nvic_pending_add(pmb887x_nvic_t *p, pmb887x_nvic_irq_t *line) {
+	pmb887x_nvic_pending_t *pending = &p->pending[line->fiq];
+	
+	// Line 0 means "no irq" in the STAT registers
+	if (!line->level || !line->id)
+		return;
+	
+	set_bit(line->id, pending->prio[line->priority].lines);
+	set_bit(line->priority, pending->used);
+}
+
+static void nvic_pending_del(pmb887x_nvic_t *p, pmb887x_nvic_irq_t *line) {
+	pmb887x_nvic_pending_t *pending = &p->pending[line->fiq];
+	unsigned long *lines = pending->prio[line->priority].lines;
+	
+	if (!test_bit(line->id, lines))
+		return;
+	
+	clear_bit(line->id, lines);
+	if (find_first_bit(lines, IRQS_COUNT) == IRQS_COUNT)
+		clear_bit(line->priority, pending->used);
+}
+
+static void nvic_pending_rebuild(pmb887x_nvic_t *p) {
+	memset(p->pending, 0, sizeof(p->pending));
+	for (int i = 0; i < IRQS_COUNT; i++)
+		nvic_pending_add(p, &p->irq_state[i]);
 }
 
+/*
+ * Highest NVIC_CON priority wins, then highest SRC priority (line level), then lowest line number.
+ * */
 static int nvic_current_irq(pmb887x_nvic_t *p, bool fiq) {
+	pmb887x_nvic_pending_t *pending = &p->pending[fiq];
+	
+	unsigned long priority = find_last_bit(pending->used, PRIORITIES_COUNT);
+	if (priority == PRIORITIES_COUNT)
+		return 0;
+	
+	unsigned long *lines = pending->prio[priority].lines;
 	int irq_n = 0;
-	uint32_t max_priority = 0;
+	uint8_t max_level = 0;
 	
-	for (int i = 0; i < IRQS_COUNT; ++i) {
-		pmb887x_nvic_irq_t *line = &p->irq_state[i];
-		
-		if (fiq != line->fiq || !line->level)
-			continue;
-		
-		uint32_t priority = nvic_get_priority(line);
-		if (max_priority < priority) {
+	for (unsigned long i = find_first_bit(lines, IRQS_COUNT); i < IRQS_COUNT; i = find_next_bit(lines, IRQS_COUNT, i + 1)) {
+		if (p->irq_state[i].level > max_level) {
 			irq_n = i;
-			max_priority = priority;
+			max_level = p->irq_state[i].level;
 		}
 	}
 	
 	return irq_n;
 }
 
+static void nvic_set_level(pmb887x_nvic_t *p, pmb887x_nvic_irq_t *line, uint8_t level) {
+	if (!line->level && level) {
+		line->count++;
+		line->asserted_at = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	} else if (!level) {
+		line->asserted_at = -1;
+	}
+	
+	nvic_pending_del(p, line);
+	line->level = level;
+	nvic_pending_add(p, line);
+}
+
+static void nvic_irq_acked(pmb887x_nvic_t *p, int irq_n) {
+	pmb887x_nvic_irq_t *line = &p->irq_state[irq_n];
+	
+	line->acks++;
+	if (line->asserted_at >= 0) {
+		int64_t latency = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - line->asserted_at;
+		line->latency_sum += latency;
+		line->latency_max = MAX(line->latency_max, latency);
+		line->asserted_at = -1;
+	}
+}
+
 static void nvic_update_state(pmb887x_nvic_t *p) {
 	if (!p->irq_lock) {
 		p->current_irq = nvic_current_irq(p, false);
@@ -96,7 +174,7 @@ static void nvic_irq_handler(void *opaque, int irq, int level) {
 	}
 	#endif
 	
-	p->irq_state[irq].level = level;
+	nvic_set_level(p, &p->irq_state[irq], level);
 	nvic_update_state(p);
 }
 
@@ -140,6 +218,7 @@ static uint64_t nvic_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			if (p->current_irq > 0 && !p->irq_lock) {
 				value = p->current_irq;
 				p->irq_lock = true;
+				nvic_irq_acked(p, p->current_irq);
 				qemu_set_irq(p->parent_irq, 0);
 			} else {
 				value = 0;
@@ -150,6 +229,7 @@ static uint64_t nvic_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			if (p->current_fiq > 0 && !p->fiq_lock) {
 				value = p->current_fiq;
 				p->fiq_lock = true;
+				nvic_irq_acked(p, p->current_fiq);
 				qemu_set_irq(p->parent_fiq, 0);
 			} else {
 				value = 0;
@@ -193,7 +273,7 @@ static void nvic_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 		case NVIC_IRQ_ACK:
 			#ifdef PMB887X_IO_BRIDGE
 			if (p->current_irq > 0 && p->irq_state[p->current_irq].bridge) {
-				p->irq_state[p->current_irq].level = 0;
+				nvic_set_level(p, &p->irq_state[p->current_irq], 0);
 				pmb8876_io_bridge_write(haddr + p->mmio.addr, size, value);
 			}
 			#endif
@@ -210,8 +290,12 @@ static void nvic_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 		case NVIC_CON0 ... NVIC_CON169:
 		{
 			int irq_n = (haddr - NVIC_CON0) / 4;
-			p->irq_state[irq_n].fiq = (value & NVIC_CON_FIQ) != 0;
-			p->irq_state[irq_n].priority = (value & NVIC_CON_PRIORITY) >> NVIC_CON_PRIORITY_SHIFT;
+			pmb887x_nvic_irq_t *line = &p->irq_state[irq_n];
+			
+			nvic_pending_del(p, line);
+			line->fiq = (value & NVIC_CON_FIQ) != 0;
+			line->priority = (value & NVIC_CON_PRIORITY) >> NVIC_CON_PRIORITY_SHIFT;
+			nvic_pending_add(p, line);
 			
 			#ifdef PMB887X_IO_BRIDGE
 			if (irq_n != 22 && irq_n != 23 && irq_n != 24) {
@@ -244,8 +328,10 @@ static void nvic_init(Object *obj) {
 	memory_region_init_io(&p->mmio, obj, &io_ops, p, "pmb887x-nvic", NVIC_IO_SIZE);
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
 	
-	for (int i = 0; i < ARRAY_SIZE(p->irq_state); i++)
+	for (int i = 0; i < ARRAY_SIZE(p->irq_state); i++) {
 		p->irq_state[i].id = i;
+		p->irq_state[i].asserted_at = -1;
+	}
 	
 	DPRINTF("irq count: %d\n", IRQS_COUNT);
 	
@@ -260,7 +346,74 @@ static void nvic_realize(DeviceState *dev, Error **errp) {
 	nvic_update_state(p);
 }
 
+static const VMStateDescription nvic_irq_vmstate = {
+	.name = "pmb887x-nvic-irq",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_BOOL(fiq, pmb887x_nvic_irq_t),
+		VMSTATE_UINT8(priority, pmb887x_nvic_irq_t),
+		VMSTATE_UINT8(level, pmb887x_nvic_irq_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static int nvic_post_load(void *opaque, int version_id) {
+	nvic_pending_rebuild((pmb887x_nvic_t *) opaque);
+	return 0;
+}
+
+static const VMStateDescription nvic_vmstate = {
+	.name = TYPE_PMB887X_NVIC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = nvic_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_STRUCT_ARRAY(irq_state, pmb887x_nvic_t, IRQS_COUNT, 0, nvic_irq_vmstate, pmb887x_nvic_irq_t),
+		VMSTATE_INT32(current_irq, pmb887x_nvic_t),
+		VMSTATE_INT32(current_fiq, pmb887x_nvic_t),
+		VMSTATE_BOOL(irq_lock, pmb887x_nvic_t),
+		VMSTATE_BOOL(fiq_lock, pmb887x_nvic_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static void hmp_info_pmb887x_irq(Monitor *mon, const QDict *qdict) {
+	Object *obj = object_resolve_path_type("", TYPE_PMB887X_NVIC, NULL);
+	if (!obj) {
+		monitor_printf(mon, "pmb887x-nvic not found\n");
+		return;
+	}
+	
+	pmb887x_nvic_t *p = PMB887X_NVIC(obj);
+	const pmb887x_cpu_meta_t *cpu_info = pmb887x_get_cpu_meta(p->cpu_type);
+	
+	monitor_printf(mon, "%-4s %-24s %-4s %-4s %12s %12s %12s %12s\n", "IRQ", "NAME", "TYPE", "PRIO", "ASSERTED", "ACKED", "AVG_LAT_NS", "MAX_LAT_NS");
+	
+	for (int i = 0; i < IRQS_COUNT; i++) {
+		pmb887x_nvic_irq_t *line = &p->irq_state[i];
+		const char *name = "";
+		
+		if (!line->count && !line->acks)
+			continue;
+		
+		for (int j = 0; cpu_info && j < cpu_info->irqs_count; j++) {
+			if (cpu_info->irqs[j].id == i)
+				name = cpu_info->irqs[j].name;
+		}
+		
+		monitor_printf(mon, "%-4d %-24s %-4s %-4d %12"PRIu64" %12"PRIu64" %12"PRId64" %12"PRId64"%s\n",
+			i, name, line->fiq ? "FIQ" : "IRQ", line->priority, line->count, line->acks,
+			line->acks ? line->latency_sum / (int64_t) line->acks : 0, line->latency_max,
+			line->level ? " *" : "");
+	}
+	
+	monitor_printf(mon, "current: irq=%d%s, fiq=%d%s\n",
+		p->current_irq, p->irq_lock ? " [locked]" : "", p->current_fiq, p->fiq_lock ? " [locked]" : "");
+}
+
 static Property nvic_properties[] = {
+	DEFINE_PROP_UINT32("cpu_type", pmb887x_nvic_t, cpu_type, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -268,6 +421,7 @@ static void nvic_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, nvic_properties);
 	dc->realize = nvic_realize;
+	dc->vmsd = &nvic_vmstate;
 }
 
 static const TypeInfo nvic_info = {
@@ -280,5 +434,6 @@ static const TypeInfo nvic_info = {
 
 static void nvic_register_types(void) {
 	type_register_static(&nvic_info);
+	monitor_register_hmp("pmb887x-irq", true, hmp_info_pmb887x_irq);
 }
 type_init(nvic_register_types)
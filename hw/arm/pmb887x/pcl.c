@@ -10,6 +10,7 @@
 #include "hw/sysbus.h"
 #include "hw/hw.h"
 #include "hw/ptimer.h"
+#include "migration/vmstate.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/pll.h"
 #include "exec/address-spaces.h"
@@ -210,6 +211,21 @@ static void pcl_realize(DeviceState *dev, Error **errp) {
 	pcl_update_state(p);
 }
 
+static const VMStateDescription pcl_vmstate = {
+	.name = TYPE_PMB887X_PCL,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(exti, pmb887x_pcl_t),
+		VMSTATE_PMB887X_SRC_ARRAY(exti_src, pmb887x_pcl_t, 8),
+		VMSTATE_PMB887X_CLC(clc, pmb887x_pcl_t),
+		VMSTATE_UINT32_ARRAY(pins, pmb887x_pcl_t, GPIOS_COUNT),
+		VMSTATE_UINT32_ARRAY(mon_cr, pmb887x_pcl_t, 4),
+		VMSTATE_BOOL_ARRAY(pins_input_state, pmb887x_pcl_t, GPIOS_COUNT),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property pcl_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -218,6 +234,7 @@ static void pcl_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, pcl_properties);
 	dc->realize = pcl_realize;
+	dc->vmsd = &pcl_vmstate;
 }
 
 static const TypeInfo pcl_info = {
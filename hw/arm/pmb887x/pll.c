@@ -10,10 +10,12 @@
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-clock.h"
 #include "cpu.h"
 #include "qemu/timer.h"
 #include "hw/ptimer.h"
 #include "sysemu/cpu-timers.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/regs.h"
@@ -25,17 +27,18 @@
 #define TYPE_PMB887X_PLL	"pmb887x-pll"
 #define PMB887X_PLL(obj)	OBJECT_CHECK(struct pmb887x_pll_t, (obj), TYPE_PMB887X_PLL)
 
-struct pmb887x_pll_callback_t {
-	void *opaque;
-	void (*callback)(void *);
-};
-
 struct pmb887x_pll_t {
 	SysBusDevice parent_obj;
 	MemoryRegion mmio;
 	
-	struct pmb887x_pll_callback_t *callbacks;
-	int callbacks_count;
+	// Clock tree outputs, consumers are notified only when output period actually changes
+	Clock *clk_fosc;
+	Clock *clk_frtc;
+	Clock *clk_fsys;
+	Clock *clk_fstm;
+	Clock *clk_fcpu;
+	Clock *clk_fahb;
+	Clock *clk_fgptu;
 	
 	pmb887x_src_reg_t src;
 	qemu_irq irq;
@@ -162,6 +165,43 @@ static uint32_t pll_get_cpu_freq(struct pmb887x_pll_t *p) {
 	return ahb_freq;
 }
 
+static void pll_update_clocks(struct pmb887x_pll_t *p) {
+	// Set all outputs first, so callbacks of consumers see consistent tree
+	bool fosc_changed = clock_set_hz(p->clk_fosc, p->xtal);
+	bool frtc_changed = clock_set_hz(p->clk_frtc, p->frtc);
+	bool fsys_changed = clock_set_hz(p->clk_fsys, p->fsys);
+	bool fstm_changed = clock_set_hz(p->clk_fstm, p->fstm);
+	bool fcpu_changed = clock_set_hz(p->clk_fcpu, p->fcpu);
+	bool fahb_changed = clock_set_hz(p->clk_fahb, p->fahb);
+	bool fgptu_changed = clock_set_hz(p->clk_fgptu, p->fgptu);
+	
+	if (fosc_changed)
+		clock_propagate(p->clk_fosc);
+	if (frtc_changed)
+		clock_propagate(p->clk_frtc);
+	if (fsys_changed)
+		clock_propagate(p->clk_fsys);
+	if (fstm_changed)
+		clock_propagate(p->clk_fstm);
+	if (fcpu_changed)
+		clock_propagate(p->clk_fcpu);
+	if (fahb_changed)
+		clock_propagate(p->clk_fahb);
+	if (fgptu_changed)
+		clock_propagate(p->clk_fgptu);
+}
+
+// Clock propagation is forbidden during migration, consumers restore their scales in own post_load
+static void pll_restore_clocks(struct pmb887x_pll_t *p) {
+	clock_set_hz(p->clk_fosc, p->xtal);
+	clock_set_hz(p->clk_frtc, p->frtc);
+	clock_set_hz(p->clk_fsys, p->fsys);
+	clock_set_hz(p->clk_fstm, p->fstm);
+	clock_set_hz(p->clk_fcpu, p->fcpu);
+	clock_set_hz(p->clk_fahb, p->fahb);
+	clock_set_hz(p->clk_fgptu, p->fgptu);
+}
+
 static void pll_update_state(struct pmb887x_pll_t *p) {
 	uint32_t new_fsys = pll_get_sys_freq(p);
 	uint32_t new_fstm = pll_get_stm_freq(p);
@@ -195,8 +235,7 @@ static void pll_update_state(struct pmb887x_pll_t *p) {
 		
 		DPRINTF("fCPU: %d Hz, fAHB: %d Hz, fSYS: %d Hz, fSTM: %d Hz, ns_per_tick=%d\n", p->fcpu, p->fahb, p->fsys, p->fstm, p->ns_per_tick);
 		
-		for (int i = 0; i < p->callbacks_count; ++i)
-			p->callbacks[i].callback(p->callbacks[i].opaque);
+		pll_update_clocks(p);
 	}
 }
 
@@ -327,11 +366,8 @@ uint32_t pmb887x_pll_get_fgptu(struct pmb887x_pll_t *p) {
 	return p->fgptu;
 }
 
-void pmb887x_pll_add_freq_update_callback(struct pmb887x_pll_t *p, void (*callback)(void *), void *opaque) {
-	p->callbacks = g_realloc(p->callbacks, (p->callbacks_count + 1) * sizeof(struct pmb887x_pll_callback_t));
-	p->callbacks[p->callbacks_count].opaque = opaque;
-	p->callbacks[p->callbacks_count].callback = callback;
-	p->callbacks_count++;
+void pmb887x_pll_connect_clock(struct pmb887x_pll_t *p, const char *output, Clock *clk) {
+	clock_set_source(clk, qdev_get_clock_out(DEVICE(p), output));
 }
 
 static void pll_init(Object *obj) {
@@ -339,6 +375,14 @@ static void pll_init(Object *obj) {
 	memory_region_init_io(&p->mmio, obj, &io_ops, p, "pmb887x-pll", PLL_IO_SIZE);
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
 	sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq);
+	
+	p->clk_fosc = qdev_init_clock_out(DEVICE(obj), "fosc");
+	p->clk_frtc = qdev_init_clock_out(DEVICE(obj), "frtc");
+	p->clk_fsys = qdev_init_clock_out(DEVICE(obj), "fsys");
+	p->clk_fstm = qdev_init_clock_out(DEVICE(obj), "fstm");
+	p->clk_fcpu = qdev_init_clock_out(DEVICE(obj), "fcpu");
+	p->clk_fahb = qdev_init_clock_out(DEVICE(obj), "fahb");
+	p->clk_fgptu = qdev_init_clock_out(DEVICE(obj), "fgptu");
 }
 
 static void pll_realize(DeviceState *dev, Error **errp) {
@@ -356,9 +400,6 @@ static void pll_realize(DeviceState *dev, Error **errp) {
 	p->fgptu = 1000000000;
 	p->fsys = p->xtal;
 	
-	p->callbacks = NULL;
-	p->callbacks_count = 0;
-	
 	// Initial values
 	p->osc	= 0x01070001;
 	p->con0	= 0x22000012;
@@ -369,6 +410,37 @@ static void pll_realize(DeviceState *dev, Error **errp) {
 	pll_update_state(p);
 }
 
+static int pll_post_load(void *opaque, int version_id) {
+	struct pmb887x_pll_t *p = (struct pmb887x_pll_t *) opaque;
+	if (icount2_enabled() && p->ns_per_tick)
+		icount2_set_ns_per_tick(p->ns_per_tick);
+	pll_restore_clocks(p);
+	return 0;
+}
+
+static const VMStateDescription pll_vmstate = {
+	.name = TYPE_PMB887X_PLL,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = pll_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_SRC(src, struct pmb887x_pll_t),
+		VMSTATE_INT32(ns_per_tick, struct pmb887x_pll_t),
+		VMSTATE_UINT32(frtc, struct pmb887x_pll_t),
+		VMSTATE_UINT32(fsys, struct pmb887x_pll_t),
+		VMSTATE_UINT32(fstm, struct pmb887x_pll_t),
+		VMSTATE_UINT32(fahb, struct pmb887x_pll_t),
+		VMSTATE_UINT32(fcpu, struct pmb887x_pll_t),
+		VMSTATE_UINT32(fgptu, struct pmb887x_pll_t),
+		VMSTATE_UINT32(osc, struct pmb887x_pll_t),
+		VMSTATE_UINT32(con0, struct pmb887x_pll_t),
+		VMSTATE_UINT32(con1, struct pmb887x_pll_t),
+		VMSTATE_UINT32(con2, struct pmb887x_pll_t),
+		VMSTATE_UINT32(con3, struct pmb887x_pll_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property pll_properties[] = {
 	DEFINE_PROP_UINT32("xtal", struct pmb887x_pll_t, xtal, 26000000),
 	DEFINE_PROP_UINT32("hw-ns-throttle", struct pmb887x_pll_t, hw_ns_div, 1),
@@ -379,6 +451,7 @@ static void pll_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, pll_properties);
 	dc->realize = pll_realize;
+	dc->vmsd = &pll_vmstate;
 }
 
 static const TypeInfo pll_info = {
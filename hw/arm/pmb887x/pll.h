@@ -1,9 +1,14 @@
 #pragma once
 #include "qemu/osdep.h"
+#include "hw/clock.h"
 
 struct pmb887x_pll_t;
 
-void pmb887x_pll_add_freq_update_callback(struct pmb887x_pll_t *p, void (*callback)(void *), void *opaque);
+/*
+ * Clock tree outputs: fosc, frtc, fsys, fstm, fcpu, fahb, fgptu.
+ * Input clock callback (ClockUpdate) is called only when connected output frequency actually changes.
+ * */
+void pmb887x_pll_connect_clock(struct pmb887x_pll_t *p, const char *output, Clock *clk);
 
 struct pmb887x_pll_t *pmb887x_pll_get_self(DeviceState *dev);
 uint32_t pmb887x_pll_get_fosc(struct pmb887x_pll_t *p);
@@ -4,6 +4,18 @@
 #include "sysemu/cpu-timers.h"
 #include "qemu/log.h"
 #include "qemu/error-report.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+
+#define IO_DUMP_RING_SIZE	(256 * 1024)
+#define IO_TRACE_BUFFER		(4 * 1024 * 1024)
+
+enum {
+	IO_DUMP_OVERFLOW_BLOCK,
+	IO_DUMP_OVERFLOW_DROP,
+};
 
 typedef struct {
 	uint32_t addr;
@@ -11,120 +23,179 @@ typedef struct {
 	uint8_t size;
 	uint32_t pc;
 	uint32_t lr;
+	uint64_t icount;
 	bool is_write;
-	uint32_t count;
+	uint32_t count; // 0 - taken by consumer
 } pmb887x_io_operation_t;
 
-static QemuMutex io_dump_queue_lock;
-static GQueue *io_dump_queue = NULL;
-static QemuThread io_dump_thread_id;
-static GCond io_dump_cond = {};
-static uint32_t gpio_base = 0;
-static const pmb887x_board_t *board_info = NULL;
-static const pmb887x_cpu_meta_t *cpu_info = NULL;
-static pmb887x_io_operation_t *last_log_entry = NULL;
+/*
+ * SPSC ring: producer is MMIO handler (always under BQL), consumer is io_dump thread.
+ * Producer can coalesce the same access into the last record while consumer didn't take it.
+ * */
 static struct {
-	uint32_t count;
-	const pmb887x_module_t **modules;
-} addr2modules[0xFFF] = {0};
-
-static const pmb887x_module_t *_find_cpu_module(uint32_t addr) {
-	uint32_t prefix = (addr & 0xFFF00000) >> 20;
-	for (int i = 0; i < addr2modules[prefix].count; i++) {
-		const pmb887x_module_t *module = addr2modules[prefix].modules[i];
-		if (addr >= module->base && addr <= (module->base + module->size))
-			return module;
-	}
-	return NULL;
-}
-
-static const pmb887x_module_reg_t *_find_cpu_module_reg(const pmb887x_module_t *module, uint32_t addr) {
-	for (int i = 0; i < module->regs_count; i++) {
-		const pmb887x_module_reg_t *reg = &module->regs[i];
-		if (addr == (module->base + reg->addr))
-			return reg;
-	}
-	return NULL;
-}
-
-static const char *_find_cpu_module_field_enum(const pmb887x_module_field_t *field, uint32_t field_value) {
-	for (int i = 0; i < field->values_count; i++) {
-		const pmb887x_module_value_t *v = &field->values[i];
-		if (field_value == v->value)
-			return v->name;
-	}
-	return NULL;
-}
+	pmb887x_io_operation_t *entries;
+	uint32_t mask;
+	uint32_t head;
+	uint32_t tail;
+	int overflow;
+	bool stop;
+	QemuEvent data_event;
+	QemuEvent space_event;
+	
+	// Stats
+	uint64_t total;
+	uint64_t coalesced;
+	uint64_t dropped;
+} io_dump_ring;
 
-static const char *_find_cpu_irq_num_name(const pmb887x_cpu_meta_t *cpu, uint32_t field_value) {
-	for (int i = 0; i < cpu->irqs_count; i++) {
-		const pmb887x_cpu_meta_irq_t *v = &cpu->irqs[i];
-		if (field_value == v->id)
-			return v->name;
-	}
-	return NULL;
-}
+static QemuThread io_dump_thread_id;
+static FILE *io_trace_fp = NULL;
 
-static const char *_find_cpu_irq_name(const pmb887x_cpu_meta_t *cpu, uint32_t field_value) {
-	for (int i = 0; i < cpu->irqs_count; i++) {
-		const pmb887x_cpu_meta_irq_t *v = &cpu->irqs[i];
-		if (field_value == v->addr)
-			return v->name;
+static void _write_io_trace(const pmb887x_io_operation_t *entry, uint32_t count) {
+	pmb887x_io_trace_record_t record = {
+		.addr		= entry->addr,
+		.value		= entry->value,
+		.pc			= entry->pc,
+		.lr			= entry->lr,
+		.icount		= entry->icount,
+		.repeat		= count,
+		.size		= entry->size,
+		.flags		= entry->is_write ? PMB887X_IO_TRACE_WRITE : 0,
+	};
+	
+	if (fwrite(&record, sizeof(record), 1, io_trace_fp) != 1) {
+		error_report("IO trace write error: %s", strerror(errno));
+		exit(1);
 	}
-	return NULL;
 }
 
 static void *_dump_io_thread(void *arg) {
 	while (true) {
-		pmb887x_io_operation_t *entry = NULL;
-		size_t queue_size;
-		
-		qemu_mutex_lock(&io_dump_queue_lock);
-		queue_size = g_queue_get_length(io_dump_queue);
-		if (queue_size > 0)
-			entry = g_queue_pop_head(io_dump_queue);
+		uint32_t tail = io_dump_ring.tail;
 		
-		if (entry == last_log_entry)
-			last_log_entry = NULL;
+		qemu_event_reset(&io_dump_ring.data_event);
+		if (tail == qatomic_load_acquire(&io_dump_ring.head)) {
+			// Ring is drained
+			if (qatomic_read(&io_dump_ring.stop))
+				break;
+			qemu_event_wait(&io_dump_ring.data_event);
+			continue;
+		}
 		
-		qemu_mutex_unlock(&io_dump_queue_lock);
+		pmb887x_io_operation_t *slot = &io_dump_ring.entries[tail & io_dump_ring.mask];
+		uint32_t count = qatomic_xchg(&slot->count, 0);
+		pmb887x_io_operation_t entry = *slot;
 		
-		if (entry) {
-			pmb887x_print_dump_io(entry->addr, entry->size, entry->value, entry->is_write, entry->pc, entry->lr);
-			g_free(entry);
-		}
+		qatomic_store_release(&io_dump_ring.tail, tail + 1);
+		qemu_event_set(&io_dump_ring.space_event);
 		
-		if (queue_size > 2000000) {
-			error_report("IO dump queue overflow (%d)! Something wrong!\n", g_queue_get_length(io_dump_queue));
-			exit(1);
+		if (io_trace_fp) {
+			_write_io_trace(&entry, count);
+		} else {
+			pmb887x_print_dump_io(entry.addr, entry.size, entry.value, entry.is_write, entry.pc, entry.lr, count);
 		}
 	}
 	return NULL;
 }
 
+static void _dump_io_stop(void) {
+	// Consumer itself can exit on write error
+	if (qemu_thread_is_self(&io_dump_thread_id))
+		return;
+	
+	qatomic_set(&io_dump_ring.stop, true);
+	qemu_event_set(&io_dump_ring.data_event);
+	qemu_thread_join(&io_dump_thread_id);
+	
+	if (io_trace_fp) {
+		fclose(io_trace_fp);
+		io_trace_fp = NULL;
+	}
+}
+
+static void _dump_io_stats(void) {
+	_dump_io_stop();
+	
+	if (!io_dump_ring.total)
+		return;
+	
+	qemu_log_mask(LOG_TRACE, "IO dump: %"PRIu64" records, %"PRIu64" coalesced, %"PRIu64" dropped\n",
+		io_dump_ring.total, io_dump_ring.coalesced, io_dump_ring.dropped);
+	
+	if (io_dump_ring.dropped)
+		warn_report("IO dump: %"PRIu64" records dropped, increase PMB887X_IO_DUMP_RING", io_dump_ring.dropped);
+}
+
+static void _open_io_trace(const char *file, uint32_t cpu) {
+	io_trace_fp = fopen(file, "wb");
+	if (!io_trace_fp) {
+		error_report("fopen(%s): %s", file, strerror(errno));
+		exit(1);
+	}
+	
+	setvbuf(io_trace_fp, NULL, _IOFBF, IO_TRACE_BUFFER);
+	
+	pmb887x_io_trace_header_t header = {
+		.version		= PMB887X_IO_TRACE_VERSION,
+		.cpu			= cpu,
+		.flags			= icount_enabled() ? PMB887X_IO_TRACE_ICOUNT : 0,
+		.record_size	= sizeof(pmb887x_io_trace_record_t),
+	};
+	memcpy(header.magic, PMB887X_IO_TRACE_MAGIC, sizeof(header.magic));
+	
+	if (fwrite(&header, sizeof(header), 1, io_trace_fp) != 1) {
+		error_report("IO trace write error: %s", strerror(errno));
+		exit(1);
+	}
+}
+
 void pmb887x_io_dump_init(const pmb887x_board_t *board) {
-	board_info = board;
-	cpu_info = pmb887x_get_cpu_meta(board->cpu);
+	const pmb887x_cpu_meta_t *cpu_info = pmb887x_get_cpu_meta(board->cpu);
 	
-	io_dump_queue = g_queue_new();
-	qemu_mutex_init(&io_dump_queue_lock);
-	g_cond_init(&io_dump_cond);
+	// Names for PMB887X_REG_IS_GPIO_PIN
+	const char **gpio_names = g_new0(const char *, cpu_info->gpios_count);
+	for (int i = 0; i < cpu_info->gpios_count && i < board->gpios_count; i++)
+		gpio_names[i] = board->gpios[i].full_name;
+	pmb887x_regs_format_init(cpu_info, gpio_names);
+	g_free(gpio_names);
 	
-	qemu_thread_create(&io_dump_thread_id, "io_dump", _dump_io_thread, NULL, QEMU_THREAD_JOINABLE);
+	// Binary trace instead of text log
+	const char *trace_file = getenv("PMB887X_IO_TRACE");
+	if (trace_file)
+		_open_io_trace(trace_file, board->cpu);
 	
-	// Module search index
-	for (int i = 0; i < cpu_info->modules_count; i++) {
-		const pmb887x_module_t *module = &cpu_info->modules[i];
-		uint32_t prefix = (module->base & 0xFFF00000) >> 20;
-		addr2modules[prefix].count++;
-		addr2modules[prefix].modules = g_realloc(addr2modules[prefix].modules, sizeof(pmb887x_io_operation_t *) * addr2modules[prefix].count);
-		addr2modules[prefix].modules[addr2modules[prefix].count - 1] = module;
-		
-		if (strcmp(module->name, "GPIO") == 0)
-			gpio_base = module->base;
+	uint32_t ring_size = IO_DUMP_RING_SIZE;
+	const char *ring_size_env = getenv("PMB887X_IO_DUMP_RING");
+	if (ring_size_env) {
+		char *end;
+		errno = 0;
+		uint64_t value = strtoull(ring_size_env, &end, 0);
+		if (errno || end == ring_size_env || *end || value > (1 << 30)) {
+			error_report("Invalid PMB887X_IO_DUMP_RING=%s, expected: 2 ... %d", ring_size_env, 1 << 30);
+			exit(1);
+		}
+		ring_size = pow2ceil(MAX(value, 2));
 	}
 	
-	assert(gpio_base != 0);
+	io_dump_ring.overflow = IO_DUMP_OVERFLOW_BLOCK;
+	const char *overflow_env = getenv("PMB887X_IO_DUMP_OVERFLOW");
+	if (overflow_env) {
+		if (strcmp(overflow_env, "drop") == 0) {
+			io_dump_ring.overflow = IO_DUMP_OVERFLOW_DROP;
+		} else if (strcmp(overflow_env, "block") != 0) {
+			error_report("Invalid PMB887X_IO_DUMP_OVERFLOW=%s, expected: drop, block", overflow_env);
+			exit(1);
+		}
+	}
+	
+	// Pages are not touched until tracing is enabled
+	io_dump_ring.entries = g_new(pmb887x_io_operation_t, ring_size);
+	io_dump_ring.mask = ring_size - 1;
+	qemu_event_init(&io_dump_ring.data_event, false);
+	qemu_event_init(&io_dump_ring.space_event, false);
+	
+	qemu_thread_create(&io_dump_thread_id, "io_dump", _dump_io_thread, NULL, QEMU_THREAD_JOINABLE);
+	atexit(_dump_io_stats);
 }
 
 static bool _is_log_entry_same(const pmb887x_io_operation_t *a, const pmb887x_io_operation_t *b) {
@@ -138,108 +209,76 @@ static bool _is_log_entry_same(const pmb887x_io_operation_t *a, const pmb887x_io
 	);
 }
 
-void pmb887x_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write) {
-	pmb887x_io_operation_t *entry = g_new0(pmb887x_io_operation_t, 1);
-	entry->addr = addr;
-	entry->size = size;
-	entry->value = value;
-	entry->is_write = is_write;
-	entry->pc = ARM_CPU(qemu_get_cpu(0))->env.regs[15];
-	entry->lr = ARM_CPU(qemu_get_cpu(0))->env.regs[14];
-	entry->count = 1;
-	
-	qemu_mutex_lock(&io_dump_queue_lock);
-	if (last_log_entry && _is_log_entry_same(last_log_entry, entry)) {
-		last_log_entry->count++;
-	} else {
-		last_log_entry = entry;
-		g_queue_push_tail(io_dump_queue, entry);
+static bool _try_coalesce(pmb887x_io_operation_t *last, const pmb887x_io_operation_t *entry) {
+	if (!_is_log_entry_same(last, entry))
+		return false;
+	
+	// Fails when consumer already took the record
+	uint32_t count = qatomic_read(&last->count);
+	while (count != 0) {
+		uint32_t old = qatomic_cmpxchg(&last->count, count, count + 1);
+		if (old == count)
+			return true;
+		count = old;
 	}
-	qemu_mutex_unlock(&io_dump_queue_lock);
+	return false;
 }
 
-void pmb887x_print_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write, uint32_t pc, uint32_t lr) {
-	const pmb887x_module_t *module = _find_cpu_module(addr);
-	g_autoptr(GString) s = g_string_new("");
+static bool _wait_for_space(uint32_t head) {
+	if (io_dump_ring.overflow == IO_DUMP_OVERFLOW_DROP)
+		return false;
 	
-	if (is_write) {
-		g_string_append_printf(s, "WRITE[%d] %08X: %08X", size, addr, value);
-	} else {
-		g_string_append_printf(s, " READ[%d] %08X: %08X", size, addr, value);
+	while (true) {
+		qemu_event_reset(&io_dump_ring.space_event);
+		if (head - qatomic_load_acquire(&io_dump_ring.tail) <= io_dump_ring.mask)
+			return true;
+		qemu_event_wait(&io_dump_ring.space_event);
 	}
+}
+
+void pmb887x_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write) {
+	CPUARMState *env = &ARM_CPU(qemu_get_cpu(0))->env;
+	pmb887x_io_operation_t entry = {
+		.addr		= addr,
+		.value		= value,
+		.size		= size,
+		.pc			= env->regs[15],
+		.lr			= env->regs[14],
+		.icount		= icount_enabled() ? icount_get_raw() : qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
+		.is_write	= is_write,
+	};
 	
-	if (module) {
-		const pmb887x_module_reg_t *reg = _find_cpu_module_reg(module, addr);
-		if (reg) {
-			if (reg->special == PMB887X_REG_IS_GPIO_PIN) {
-				uint32_t gpio_id = (addr - (gpio_base + GPIO_PIN0)) / 4;
-				g_string_append_printf(s, " (%s)", board_info->gpios[gpio_id].full_name);
-			} else if (reg->special == PMB887X_REG_IS_IRQ_CON) {
-				const char *irq_name = _find_cpu_irq_name(cpu_info, addr - module->base);
-				if (irq_name) {
-					g_string_append_printf(s, " (%s_%s_%s)",  module->name, reg->name, irq_name);
-				} else {
-					g_string_append_printf(s, " (%s_%s)", module->name, reg->name);
-				}
-			} else {
-				g_string_append_printf(s, " (%s_%s)", module->name, reg->name);
-			}
-			
-			if (reg->special == PMB887X_REG_IS_IRQ_NUM) {
-				const char *irq_name = _find_cpu_irq_num_name(cpu_info, value);
-				if (irq_name) {
-					g_string_append_printf(s, ": NUM(0x%02X)=%s", value, irq_name);
-				} else {
-					g_string_append_printf(s, ": NUM(0x%02X)", value);
-				}
-			} else if (reg->fields_count) {
-				bool first = true;
-				uint32_t known_bits = 0;
-				for (int i = 0; i < reg->fields_count; i++) {
-					const pmb887x_module_field_t *field = &reg->fields[i];
-					uint32_t field_value = (value & field->mask) >> field->shift;
-					const char *enum_name = _find_cpu_module_field_enum(field, (value & field->mask));
-					
-					known_bits |= field->mask;
-					
-					if (!field_value && !enum_name)
-						continue;
-					
-					if (first) {
-						g_string_append_printf(s, ": ");
-						first = false;
-					} else {
-						g_string_append_printf(s, " | ");
-					}
-					
-					if (enum_name) {
-						g_string_append_printf(s, "%s(%s)", field->name, enum_name);
-					} else if ((field->mask >> field->shift) == 1) {
-						g_string_append_printf(s, "%s", field->name);
-					} else {
-						g_string_append_printf(s, "%s(0x%02X)", field->name, field_value);
-					}
-				}
-				
-				uint32_t unknown_bits = (value & ~known_bits);
-				if (unknown_bits) {
-					for (int i = 0; i < 32; i++) {
-						if ((unknown_bits & (1 << i))) {
-							if (first) {
-								g_string_append_printf(s, ": ");
-								first = false;
-							} else {
-								g_string_append_printf(s, " | ");
-							}
-							g_string_append_printf(s, "UNK_%d", i);
-						}
-					}
-				}
-			}
-		} else {
-			g_string_append_printf(s, " (%s_*)", module->name);
-		}
+	uint32_t head = io_dump_ring.head;
+	uint32_t tail = qatomic_load_acquire(&io_dump_ring.tail);
+	
+	io_dump_ring.total++;
+	
+	if (head != tail && _try_coalesce(&io_dump_ring.entries[(head - 1) & io_dump_ring.mask], &entry)) {
+		io_dump_ring.coalesced++;
+		return;
 	}
 	
-	qemu_log_mask(LOG_TRACE, "%s (PC: %08X, LR: %08X)\n", s->str, pc, lr);
+	if (head - tail > io_dump_ring.mask && !_wait_for_space(head)) {
+		io_dump_ring.dropped++;
+		return;
+	}
+	
+	pmb887x_io_operation_t *slot = &io_dump_ring.entries[head & io_dump_ring.mask];
+	*slot = entry;
+	slot->count = 1;
+	
+	qatomic_store_release(&io_dump_ring.head, head + 1);
+	qemu_event_set(&io_dump_ring.data_event);
+}
+
+void pmb887x_print_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write, uint32_t pc, uint32_t lr, uint32_t count) {
+	g_autoptr(GString) s = g_string_new("");
+	
+	pmb887x_format_io(s, addr, size, value, is_write);
+	
+	if (count > 1) {
+		qemu_log_mask(LOG_TRACE, "%s (PC: %08X, LR: %08X) x%d\n", s->str, pc, lr, count);
+	} else {
+		qemu_log_mask(LOG_TRACE, "%s (PC: %08X, LR: %08X)\n", s->str, pc, lr);
+	}
 }
@@ -64,7 +64,47 @@ typedef struct {
 	int modules_count;
 } pmb887x_cpu_meta_t;
 
+/*
+ * Binary IO trace (PMB887X_IO_TRACE=file), host byte order:
+ *   pmb887x_io_trace_header_t, then pmb887x_io_trace_record_t[]
+ * Decoder: contrib/pmb887x-iotrace
+ * */
+#define PMB887X_IO_TRACE_MAGIC		"PMBIOTRC"
+#define PMB887X_IO_TRACE_VERSION	1
+
+// Header flags
+#define PMB887X_IO_TRACE_ICOUNT		(1 << 0) // time is instruction counter, otherwise virtual clock ns
+
+// Record flags
+#define PMB887X_IO_TRACE_WRITE		(1 << 0)
+
+typedef struct QEMU_PACKED {
+	char magic[8];
+	uint32_t version;
+	uint32_t cpu;
+	uint32_t flags;
+	uint32_t record_size;
+} pmb887x_io_trace_header_t;
+
+typedef struct QEMU_PACKED {
+	uint32_t addr;
+	uint32_t value;
+	uint32_t pc;
+	uint32_t lr;
+	uint64_t icount;
+	uint32_t repeat;
+	uint8_t size;
+	uint8_t flags;
+	uint16_t reserved;
+} pmb887x_io_trace_record_t;
+
 void pmb887x_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write);
-void pmb887x_print_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write, uint32_t pc, uint32_t lr);
+void pmb887x_print_dump_io(uint32_t addr, uint32_t size, uint32_t value, bool is_write, uint32_t pc, uint32_t lr, uint32_t count);
 const pmb887x_cpu_meta_t *pmb887x_get_cpu_meta(int cpu);
 void pmb887x_io_dump_init(const pmb887x_board_t *board);
+
+// Formatting
+void pmb887x_regs_format_init(const pmb887x_cpu_meta_t *cpu, const char **gpio_names);
+void pmb887x_format_io(GString *s, uint32_t addr, uint32_t size, uint32_t value, bool is_write);
+const pmb887x_module_t *pmb887x_find_cpu_module(uint32_t addr);
+const pmb887x_module_reg_t *pmb887x_find_cpu_module_reg(const pmb887x_module_t *module, uint32_t addr);
@@ -0,0 +1,165 @@
+/*
+ * Human readable IO access formatting, shared with contrib/pmb887x-iotrace
+ * */
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/regs_dump.h"
+
+static uint32_t gpio_base = 0;
+static const pmb887x_cpu_meta_t *cpu_info = NULL;
+static const char **gpio_names = NULL;
+static struct {
+	uint32_t count;
+	const pmb887x_module_t **modules;
+} addr2modules[0xFFF] = {0};
+
+const pmb887x_module_t *pmb887x_find_cpu_module(uint32_t addr) {
+	uint32_t prefix = (addr & 0xFFF00000) >> 20;
+	for (int i = 0; i < addr2modules[prefix].count; i++) {
+		const pmb887x_module_t *module = addr2modules[prefix].modules[i];
+		if (addr >= module->base && addr <= (module->base + module->size))
+			return module;
+	}
+	return NULL;
+}
+
+const pmb887x_module_reg_t *pmb887x_find_cpu_module_reg(const pmb887x_module_t *module, uint32_t addr) {
+	for (int i = 0; i < module->regs_count; i++) {
+		const pmb887x_module_reg_t *reg = &module->regs[i];
+		if (addr == (module->base + reg->addr))
+			return reg;
+	}
+	return NULL;
+}
+
+static const char *_find_cpu_module_field_enum(const pmb887x_module_field_t *field, uint32_t field_value) {
+	for (int i = 0; i < field->values_count; i++) {
+		const pmb887x_module_value_t *v = &field->values[i];
+		if (field_value == v->value)
+			return v->name;
+	}
+	return NULL;
+}
+
+static const char *_find_cpu_irq_num_name(const pmb887x_cpu_meta_t *cpu, uint32_t field_value) {
+	for (int i = 0; i < cpu->irqs_count; i++) {
+		const pmb887x_cpu_meta_irq_t *v = &cpu->irqs[i];
+		if (field_value == v->id)
+			return v->name;
+	}
+	return NULL;
+}
+
+static const char *_find_cpu_irq_name(const pmb887x_cpu_meta_t *cpu, uint32_t field_value) {
+	for (int i = 0; i < cpu->irqs_count; i++) {
+		const pmb887x_cpu_meta_irq_t *v = &cpu->irqs[i];
+		if (field_value == v->addr)
+			return v->name;
+	}
+	return NULL;
+}
+
+void pmb887x_regs_format_init(const pmb887x_cpu_meta_t *cpu, const char **names) {
+	cpu_info = cpu;
+	
+	// Board-specific names or default CPU names
+	gpio_names = g_new0(const char *, cpu->gpios_count);
+	for (int i = 0; i < cpu->gpios_count; i++)
+		gpio_names[i] = (names && names[i]) ? names[i] : cpu->gpios[i].full_name;
+	
+	// Module search index
+	for (int i = 0; i < cpu_info->modules_count; i++) {
+		const pmb887x_module_t *module = &cpu_info->modules[i];
+		uint32_t prefix = (module->base & 0xFFF00000) >> 20;
+		addr2modules[prefix].count++;
+		addr2modules[prefix].modules = g_realloc(addr2modules[prefix].modules, sizeof(pmb887x_module_t *) * addr2modules[prefix].count);
+		addr2modules[prefix].modules[addr2modules[prefix].count - 1] = module;
+		
+		if (strcmp(module->name, "GPIO") == 0)
+			gpio_base = module->base;
+	}
+	
+	assert(gpio_base != 0);
+}
+
+void pmb887x_format_io(GString *s, uint32_t addr, uint32_t size, uint32_t value, bool is_write) {
+	const pmb887x_module_t *module = pmb887x_find_cpu_module(addr);
+	
+	if (is_write) {
+		g_string_append_printf(s, "WRITE[%d] %08X: %08X", size, addr, value);
+	} else {
+		g_string_append_printf(s, " READ[%d] %08X: %08X", size, addr, value);
+	}
+	
+	if (module) {
+		const pmb887x_module_reg_t *reg = pmb887x_find_cpu_module_reg(module, addr);
+		if (reg) {
+			if (reg->special == PMB887X_REG_IS_GPIO_PIN) {
+				uint32_t gpio_id = (addr - (gpio_base + GPIO_PIN0)) / 4;
+				g_string_append_printf(s, " (%s)", gpio_names[gpio_id]);
+			} else if (reg->special == PMB887X_REG_IS_IRQ_CON) {
+				const char *irq_name = _find_cpu_irq_name(cpu_info, addr - module->base);
+				if (irq_name) {
+					g_string_append_printf(s, " (%s_%s_%s)",  module->name, reg->name, irq_name);
+				} else {
+					g_string_append_printf(s, " (%s_%s)", module->name, reg->name);
+				}
+			} else {
+				g_string_append_printf(s, " (%s_%s)", module->name, reg->name);
+			}
+			
+			if (reg->special == PMB887X_REG_IS_IRQ_NUM) {
+				const char *irq_name = _find_cpu_irq_num_name(cpu_info, value);
+				if (irq_name) {
+					g_string_append_printf(s, ": NUM(0x%02X)=%s", value, irq_name);
+				} else {
+					g_string_append_printf(s, ": NUM(0x%02X)", value);
+				}
+			} else if (reg->fields_count) {
+				bool first = true;
+				uint32_t known_bits = 0;
+				for (int i = 0; i < reg->fields_count; i++) {
+					const pmb887x_module_field_t *field = &reg->fields[i];
+					uint32_t field_value = (value & field->mask) >> field->shift;
+					const char *enum_name = _find_cpu_module_field_enum(field, (value & field->mask));
+					
+					known_bits |= field->mask;
+					
+					if (!field_value && !enum_name)
+						continue;
+					
+					if (first) {
+						g_string_append_printf(s, ": ");
+						first = false;
+					} else {
+						g_string_append_printf(s, " | ");
+					}
+					
+					if (enum_name) {
+						g_string_append_printf(s, "%s(%s)", field->name, enum_name);
+					} else if ((field->mask >> field->shift) == 1) {
+						g_string_append_printf(s, "%s", field->name);
+					} else {
+						g_string_append_printf(s, "%s(0x%02X)", field->name, field_value);
+					}
+				}
+				
+				uint32_t unknown_bits = (value & ~known_bits);
+				if (unknown_bits) {
+					for (int i = 0; i < 32; i++) {
+						if ((unknown_bits & (1 << i))) {
+							if (first) {
+								g_string_append_printf(s, ": ");
+								first = false;
+							} else {
+								g_string_append_printf(s, " | ");
+							}
+							g_string_append_printf(s, "UNK_%d", i);
+						}
+					}
+				}
+			}
+		} else {
+			g_string_append_printf(s, " (%s_*)", module->name);
+		}
+	}
+}
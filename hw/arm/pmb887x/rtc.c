@@ -16,6 +16,7 @@
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
@@ -202,6 +203,27 @@ static void rtc_realize(DeviceState *dev, Error **errp) {
 	rtc_update_state(p);
 }
 
+static const VMStateDescription rtc_vmstate = {
+	.name = TYPE_PMB887X_RTC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_rtc_t),
+		VMSTATE_PMB887X_SRC(src, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(ctrl, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(con, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(t14, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(cnt, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(rel, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(isnc, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(alarm, struct pmb887x_rtc_t),
+		VMSTATE_UINT32(unk0, struct pmb887x_rtc_t),
+		VMSTATE_UINT64(realtime_start, struct pmb887x_rtc_t),
+		VMSTATE_UINT64(virtual_start, struct pmb887x_rtc_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property rtc_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -210,6 +232,7 @@ static void rtc_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, rtc_properties);
 	dc->realize = rtc_realize;
+	dc->vmsd = &rtc_vmstate;
 }
 
 static const TypeInfo rtc_info = {
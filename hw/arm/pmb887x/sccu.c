@@ -16,9 +16,12 @@
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/sccu.h"
 #include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/clock.h"
+#include "hw/arm/pmb887x/timebase.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
@@ -42,6 +45,7 @@ struct pmb887x_sccu_t {
 	
 	bool irq_fired;
 	uint32_t timer_freq;
+	pmb887x_clock_scale_t scale;
 	uint64_t start;
 	uint64_t next;
 	bool enabled;
@@ -55,7 +59,7 @@ struct pmb887x_sccu_t {
 	uint32_t sleep_ctrl;
 	uint32_t stat;
 	
-	QEMUTimer *timer;
+	pmb887x_timebase_event_t timer;
 	QEMUTimer *cal_timer;
 	struct pmb887x_pll_t *pll;
 };
@@ -64,15 +68,14 @@ static uint64_t sccu_get_counter(struct pmb887x_sccu_t *p, bool real) {
 	uint64_t next = p->timer_cnt;
 	
 	if (p->enabled) {
-		uint64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		next += muldiv64(delta_ns, p->timer_freq, NANOSECONDS_PER_SECOND);
+		next += pmb887x_timebase_ticks(&p->scale, p->start, pmb887x_timebase_now());
 	}
 	
 	return real ? next : MIN(next, p->timer_rel);
 }
 
 static uint64_t sccu_ticks_to_ns(struct pmb887x_sccu_t *p, uint64_t ticks) {
-    return muldiv64(ticks, NANOSECONDS_PER_SECOND, p->timer_freq);
+	return pmb887x_clock_ticks_to_ns(&p->scale, ticks);
 }
 
 static void sccu_cal_timer_reset(void *opaque) {
@@ -86,7 +89,7 @@ static void sccu_ptimer_reset(void *opaque) {
 	if (!p->enabled)
 		return;
 	
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	uint32_t overflow = p->timer_rel + 1;
 	
 	if (!p->start) {
@@ -117,14 +120,19 @@ static void sccu_ptimer_reset(void *opaque) {
 		DPRINTF("now %u\n", (uint32_t) (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) / 1000000));
 		DPRINTF("sleep timer done\n");
 	} else {
-		p->next = now + sccu_ticks_to_ns(p, overflow - counter);
-		timer_mod(p->timer, p->next);
+		p->next = pmb887x_timebase_after(&p->scale, now, overflow - counter);
+		pmb887x_timebase_mod(&p->timer, p->next);
 	}
 }
 
 static void sccu_update_timer_timer(struct pmb887x_sccu_t *p) {
 	uint32_t sub = (p->con[2] & SCCU_CON2_REL_SUB) >> SCCU_CON2_REL_SUB_SHIFT;
-	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / p->timer_div;
+	uint32_t timer_freq = pmb887x_pll_get_frtc(p->pll) / p->timer_div;
+	if (p->timer_freq != timer_freq) {
+		p->timer_freq = timer_freq;
+		pmb887x_clock_scale_set(&p->scale, p->timer_freq);
+	}
+	
 	p->enabled = (p->con[1] & SCCU_CON1_TIMER_START) != 0 && pmb887x_clc_is_enabled(&p->clc);
 	p->timer_int = p->timer_rel - sub;
 	
@@ -132,7 +140,6 @@ static void sccu_update_timer_timer(struct pmb887x_sccu_t *p) {
 	if ((p->con[1] & SCCU_CON1_CAL)) {
 		DPRINTF("SCCU_SLEEP_CON0_CAL\n");
 		// Unknown magic, similar to hardware value
-		uint32_t timer_freq = pmb887x_pll_get_frtc(p->pll) / p->timer_div;
 		uint32_t sccu_freq = pmb887x_pll_get_fosc(p->pll) / pmb887x_clc_get_rmc(&p->clc);
 		uint32_t ratio = sccu_freq / timer_freq;
 		uint32_t cal = (ratio >= 60000 ? 0 : 60000 - ratio) << 4;
@@ -298,8 +305,8 @@ static void sccu_realize(DeviceState *dev, Error **errp) {
 		
 		pmb887x_src_init(&p->src[i], p->irq[i]);
 	}
-	
-    p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sccu_ptimer_reset, p);
+
+	pmb887x_timebase_event_init(&p->timer, "sccu", sccu_ptimer_reset, p);
     p->cal_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sccu_cal_timer_reset, p);
 	
 	p->timer_div = 0x97;
@@ -309,6 +316,39 @@ static void sccu_realize(DeviceState *dev, Error **errp) {
 	sccu_update_timer_timer(p);
 }
 
+static int sccu_post_load(void *opaque, int version_id) {
+	struct pmb887x_sccu_t *p = (struct pmb887x_sccu_t *) opaque;
+	pmb887x_clock_scale_set(&p->scale, p->timer_freq);
+	return 0;
+}
+
+static const VMStateDescription sccu_vmstate = {
+	.name = TYPE_PMB887X_RTC,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = sccu_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_sccu_t),
+		VMSTATE_PMB887X_SRC_ARRAY(src, struct pmb887x_sccu_t, 2),
+		VMSTATE_BOOL(irq_fired, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(timer_freq, struct pmb887x_sccu_t),
+		VMSTATE_UINT64(start, struct pmb887x_sccu_t),
+		VMSTATE_UINT64(next, struct pmb887x_sccu_t),
+		VMSTATE_BOOL(enabled, struct pmb887x_sccu_t),
+		VMSTATE_UINT32_ARRAY(con, struct pmb887x_sccu_t, 4),
+		VMSTATE_UINT32(cal, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(timer_int, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(timer_rel, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(timer_cnt, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(timer_div, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(sleep_ctrl, struct pmb887x_sccu_t),
+		VMSTATE_UINT32(stat, struct pmb887x_sccu_t),
+		VMSTATE_PMB887X_TIMEBASE_EVENT(timer, struct pmb887x_sccu_t),
+		VMSTATE_TIMER_PTR(cal_timer, struct pmb887x_sccu_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property sccu_properties[] = {
 	DEFINE_PROP_LINK("pll", struct pmb887x_sccu_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
     DEFINE_PROP_END_OF_LIST(),
@@ -318,6 +358,7 @@ static void sccu_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, sccu_properties);
 	dc->realize = sccu_realize;
+	dc->vmsd = &sccu_vmstate;
 }
 
 static const TypeInfo sccu_info = {
@@ -7,6 +7,7 @@
 #include "qemu/osdep.h"
 #include "hw/sysbus.h"
 #include "hw/hw.h"
+#include "migration/vmstate.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "exec/address-spaces.h"
@@ -359,6 +360,35 @@ static void scu_realize(DeviceState *dev, Error **errp) {
 	scu_update_state(p);
 }
 
+static int scu_post_load(void *opaque, int version_id) {
+	scu_update_state((pmb887x_scu_t *) opaque);
+	return 0;
+}
+
+static const VMStateDescription scu_vmstate = {
+	.name = TYPE_PMB887X_SCU,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = scu_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_SRC_ARRAY(dsp_src, pmb887x_scu_t, 5),
+		VMSTATE_PMB887X_SRC_ARRAY(unk_src, pmb887x_scu_t, 3),
+		VMSTATE_UINT32(wdtcon0, pmb887x_scu_t),
+		VMSTATE_UINT32(wdtcon1, pmb887x_scu_t),
+		VMSTATE_UINT32(romamcr, pmb887x_scu_t),
+		VMSTATE_UINT32(ebuclc, pmb887x_scu_t),
+		VMSTATE_UINT32(ebuclc1, pmb887x_scu_t),
+		VMSTATE_UINT32(ebuclc2, pmb887x_scu_t),
+		VMSTATE_UINT32(rtcif, pmb887x_scu_t),
+		VMSTATE_UINT32(boot_flag, pmb887x_scu_t),
+		VMSTATE_UINT32(dmars, pmb887x_scu_t),
+		VMSTATE_UINT32(rst_req, pmb887x_scu_t),
+		VMSTATE_UINT32(boot_cfg, pmb887x_scu_t),
+		VMSTATE_UINT32(dsp_unk0, pmb887x_scu_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property scu_properties[] = {
 	DEFINE_PROP_UINT32("cpu_type", pmb887x_scu_t, cpu_type, 0),
 	DEFINE_PROP_LINK("sccu", pmb887x_scu_t, sccu, "pmb887x-sccu", struct pmb887x_sccu_t *),
@@ -371,6 +401,7 @@ static void scu_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, scu_properties);
 	dc->realize = scu_realize;
+	dc->vmsd = &scu_vmstate;
 }
 
 static const TypeInfo scu_info = {
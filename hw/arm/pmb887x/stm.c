@@ -15,14 +15,19 @@
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-clock.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/clock.h"
+#include "hw/arm/pmb887x/timebase.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
+#include "hw/arm/pmb887x/idle.h"
 
 #define TYPE_PMB887X_STM	"pmb887x-stm"
 #define PMB887X_STM(obj)	OBJECT_CHECK(struct pmb887x_stm_t, (obj), TYPE_PMB887X_STM)
@@ -38,14 +43,15 @@ struct pmb887x_stm_t {
 	uint64_t start;
 	uint64_t capture;
 	uint64_t counter;
+	pmb887x_clock_scale_t scale;
 	
+	Clock *clk;
 	struct pmb887x_pll_t *pll;
 };
 
 static uint64_t stm_get_time(struct pmb887x_stm_t *p) {
 	if (p->enabled) {
-		uint64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		return p->counter + muldiv64(delta_ns, p->freq, NANOSECONDS_PER_SECOND);
+		return p->counter + pmb887x_timebase_ticks(&p->scale, p->start, pmb887x_timebase_now());
 	}
 	return p->counter;
 }
@@ -56,14 +62,16 @@ static void stm_update_state(struct pmb887x_stm_t *p) {
 	bool new_enabled = new_freq > 0 && pmb887x_clc_is_enabled(&p->clc);
 	
 	if (new_enabled != p->enabled || new_freq != p->freq) {
-		p->freq = new_freq;
-		p->enabled = new_enabled;
-		
+		// Accumulate ticks with previous rate
 		if (p->start)
 			p->counter = stm_get_time(p);
 		
+		p->freq = new_freq;
+		p->enabled = new_enabled;
+		pmb887x_clock_scale_set(&p->scale, p->freq);
+		
 		if (p->enabled) {
-			p->start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+			p->start = pmb887x_timebase_now();
 		} else {
 			p->start = 0;
 		}
@@ -72,7 +80,7 @@ static void stm_update_state(struct pmb887x_stm_t *p) {
 	}
 }
 
-static void stm_update_state_callback(void *opaque) {
+static void stm_clock_update(void *opaque, ClockEvent event) {
 	stm_update_state((struct pmb887x_stm_t *) opaque);
 }
 
@@ -91,36 +99,43 @@ static uint64_t stm_io_read(void *opaque, hwaddr haddr, unsigned size) {
 		break;
 		
 		case STM_TIM0:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 0) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM1:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 4) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM2:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 8) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM3:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 12) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM4:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 16) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM5:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 20) & 0xFFFFFFFF;
 		break;
 		
 		case STM_TIM6:
+			pmb887x_idle_poll(p->mmio.addr + haddr);
 			p->capture = stm_get_time(p);
 			value = (p->capture >> 32) & 0x00FFFFFF;
 		break;
@@ -174,17 +189,40 @@ static void stm_init(Object *obj) {
 	struct pmb887x_stm_t *p = PMB887X_STM(obj);
 	memory_region_init_io(&p->mmio, obj, &io_ops, p, "pmb887x-stm", STM_IO_SIZE);
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
+	p->clk = qdev_init_clock_in(DEVICE(obj), "clk", stm_clock_update, p, ClockUpdate);
 }
 
 static void stm_realize(DeviceState *dev, Error **errp) {
 	struct pmb887x_stm_t *p = PMB887X_STM(dev);
 	
 	pmb887x_clc_init(&p->clc);
+	pmb887x_pll_connect_clock(p->pll, "fstm", p->clk);
 	
 	stm_update_state(p);
-	pmb887x_pll_add_freq_update_callback(p->pll, stm_update_state_callback, p);
 }
 
+static int stm_post_load(void *opaque, int version_id) {
+	struct pmb887x_stm_t *p = (struct pmb887x_stm_t *) opaque;
+	pmb887x_clock_scale_set(&p->scale, p->freq);
+	return 0;
+}
+
+static const VMStateDescription stm_vmstate = {
+	.name = TYPE_PMB887X_STM,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = stm_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_stm_t),
+		VMSTATE_BOOL(enabled, struct pmb887x_stm_t),
+		VMSTATE_UINT32(freq, struct pmb887x_stm_t),
+		VMSTATE_UINT64(start, struct pmb887x_stm_t),
+		VMSTATE_UINT64(capture, struct pmb887x_stm_t),
+		VMSTATE_UINT64(counter, struct pmb887x_stm_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property stm_properties[] = {
 	DEFINE_PROP_LINK("pll", struct pmb887x_stm_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
     DEFINE_PROP_END_OF_LIST(),
@@ -194,6 +232,7 @@ static void stm_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, stm_properties);
 	dc->realize = stm_realize;
+	dc->vmsd = &stm_vmstate;
 }
 
 static const TypeInfo stm_info = {
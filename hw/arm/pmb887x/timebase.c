@@ -0,0 +1,226 @@
+/*
+ * Timer peripherals deadline scheduler
+ * */
+#define PMB887X_TRACE_ID		STM
+#define PMB887X_TRACE_PREFIX	"pmb887x-timebase"
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "hw/hw.h"
+#include "migration/vmstate.h"
+
+#include "hw/arm/pmb887x/timebase.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define TIMEBASE_EXPIRED	-2
+
+static struct {
+	QEMUTimer *timer;
+	int64_t armed;
+	bool dispatching;
+	
+	int events_n;
+	int heap_n;
+	pmb887x_timebase_event_t *heap[PMB887X_TIMEBASE_MAX_EVENTS];
+	
+	uint64_t expired;
+	uint64_t rearms;
+} timebase;
+
+/*
+ * Min-heap by deadline
+ * */
+static void timebase_heap_set(int index, pmb887x_timebase_event_t *ev) {
+	timebase.heap[index] = ev;
+	ev->index = index;
+}
+
+static void timebase_heap_up(int index) {
+	pmb887x_timebase_event_t *ev = timebase.heap[index];
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+		if (timebase.heap[parent]->deadline <= ev->deadline)
+			break;
+		timebase_heap_set(index, timebase.heap[parent]);
+		index = parent;
+	}
+	timebase_heap_set(index, ev);
+}
+
+static void timebase_heap_down(int index) {
+	pmb887x_timebase_event_t *ev = timebase.heap[index];
+	while (true) {
+		int child = index * 2 + 1;
+		if (child >= timebase.heap_n)
+			break;
+		if (child + 1 < timebase.heap_n && timebase.heap[child + 1]->deadline < timebase.heap[child]->deadline)
+			child++;
+		if (ev->deadline <= timebase.heap[child]->deadline)
+			break;
+		timebase_heap_set(index, timebase.heap[child]);
+		index = child;
+	}
+	timebase_heap_set(index, ev);
+}
+
+static void timebase_heap_remove(pmb887x_timebase_event_t *ev) {
+	int index = ev->index;
+	pmb887x_timebase_event_t *last = timebase.heap[--timebase.heap_n];
+	
+	ev->index = -1;
+	
+	if (last == ev)
+		return;
+	
+	timebase_heap_set(index, last);
+	timebase_heap_up(index);
+	timebase_heap_down(last->index);
+}
+
+// Deadlines of several queued events can change at once (vmstate load)
+static void timebase_heap_rebuild(void) {
+	for (int i = timebase.heap_n / 2 - 1; i >= 0; i--)
+		timebase_heap_down(i);
+}
+
+/*
+ * Host timer
+ * */
+static void timebase_rearm(void) {
+	if (timebase.dispatching)
+		return;
+	
+	int64_t next = timebase.heap_n > 0 ? timebase.heap[0]->deadline : -1;
+	if (next == timebase.armed)
+		return;
+	
+	timebase.armed = next;
+	
+	if (next < 0) {
+		timer_del(timebase.timer);
+	} else {
+		timer_mod(timebase.timer, next);
+		timebase.rearms++;
+	}
+}
+
+static void timebase_run(void *opaque) {
+	pmb887x_timebase_event_t *expired[PMB887X_TIMEBASE_MAX_EVENTS];
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	int expired_n = 0;
+	
+	timebase.armed = -1;
+	
+	// Callbacks can re-arm or delete any event, so expired list is collected first
+	while (timebase.heap_n > 0 && timebase.heap[0]->deadline <= now) {
+		pmb887x_timebase_event_t *ev = timebase.heap[0];
+		timebase_heap_remove(ev);
+		ev->index = TIMEBASE_EXPIRED;
+		ev->deadline = -1;
+		expired[expired_n++] = ev;
+	}
+	
+	timebase.dispatching = true;
+	for (int i = 0; i < expired_n; i++) {
+		pmb887x_timebase_event_t *ev = expired[i];
+		if (ev->index != TIMEBASE_EXPIRED)
+			continue;
+		ev->index = -1;
+		timebase.expired++;
+		ev->callback(ev->opaque);
+	}
+	timebase.dispatching = false;
+	
+	timebase_rearm();
+}
+
+static void timebase_stats(void) {
+	if (timebase.expired)
+		DPRINTF("%"PRIu64" events expired, %"PRIu64" host timer rearms\n", timebase.expired, timebase.rearms);
+}
+
+/*
+ * API
+ * */
+void pmb887x_timebase_event_init(pmb887x_timebase_event_t *ev, const char *name, pmb887x_timebase_cb_t callback, void *opaque) {
+	if (timebase.events_n >= PMB887X_TIMEBASE_MAX_EVENTS)
+		hw_error("pmb887x-timebase: too many events (%s)", name);
+	
+	if (!timebase.timer) {
+		timebase.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, timebase_run, NULL);
+		timebase.armed = -1;
+		atexit(timebase_stats);
+	}
+	
+	timebase.events_n++;
+	
+	ev->name = name;
+	ev->callback = callback;
+	ev->opaque = opaque;
+	ev->deadline = -1;
+	ev->index = -1;
+}
+
+void pmb887x_timebase_mod(pmb887x_timebase_event_t *ev, int64_t deadline) {
+	if (deadline < 0)
+		deadline = 0;
+	
+	if (ev->index >= 0) {
+		ev->deadline = deadline;
+		timebase_heap_up(ev->index);
+		timebase_heap_down(ev->index);
+	} else {
+		ev->deadline = deadline;
+		timebase_heap_set(timebase.heap_n++, ev);
+		timebase_heap_up(ev->index);
+	}
+	
+	timebase_rearm();
+}
+
+void pmb887x_timebase_del(pmb887x_timebase_event_t *ev) {
+	if (ev->index >= 0) {
+		timebase_heap_remove(ev);
+		timebase_rearm();
+	}
+	ev->index = -1;
+	ev->deadline = -1;
+}
+
+bool pmb887x_timebase_is_pending(const pmb887x_timebase_event_t *ev) {
+	return ev->index >= 0;
+}
+
+int64_t pmb887x_timebase_next_deadline(void) {
+	return timebase.heap_n > 0 ? timebase.heap[0]->deadline : -1;
+}
+
+/*
+ * VMState
+ * */
+static int timebase_event_post_load(void *opaque, int version_id) {
+	pmb887x_timebase_event_t *ev = (pmb887x_timebase_event_t *) opaque;
+	
+	if (ev->deadline < 0 && ev->index >= 0) {
+		pmb887x_timebase_event_t *last = timebase.heap[--timebase.heap_n];
+		timebase_heap_set(ev->index, last);
+		ev->index = -1;
+	} else if (ev->deadline >= 0 && ev->index < 0) {
+		timebase_heap_set(timebase.heap_n++, ev);
+	}
+	
+	timebase_heap_rebuild();
+	timebase_rearm();
+	return 0;
+}
+
+const VMStateDescription vmstate_pmb887x_timebase_event = {
+	.name = "pmb887x-timebase-event",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = timebase_event_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_INT64(deadline, pmb887x_timebase_event_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "migration/vmstate.h"
+
+#include "hw/arm/pmb887x/clock.h"
+
+/*
+ * Shared deadline scheduler for timer peripherals.
+ * One QEMU_CLOCK_VIRTUAL timer for all modules, armed to the nearest event deadline from min-heap.
+ * Host timer is re-armed only when the nearest deadline changes.
+ * */
+#define PMB887X_TIMEBASE_MAX_EVENTS		32
+
+typedef void (*pmb887x_timebase_cb_t)(void *opaque);
+
+typedef struct {
+	const char *name;
+	pmb887x_timebase_cb_t callback;
+	void *opaque;
+	int64_t deadline;	// -1 when not pending
+	int index;			// position in heap
+} pmb887x_timebase_event_t;
+
+void pmb887x_timebase_event_init(pmb887x_timebase_event_t *ev, const char *name, pmb887x_timebase_cb_t callback, void *opaque);
+void pmb887x_timebase_mod(pmb887x_timebase_event_t *ev, int64_t deadline);
+void pmb887x_timebase_del(pmb887x_timebase_event_t *ev);
+bool pmb887x_timebase_is_pending(const pmb887x_timebase_event_t *ev);
+int64_t pmb887x_timebase_next_deadline(void);
+
+static inline int64_t pmb887x_timebase_now(void) {
+	return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+// Counter value from time, using module cached scale
+static inline uint64_t pmb887x_timebase_ticks(const pmb887x_clock_scale_t *scale, int64_t start, int64_t now) {
+	return pmb887x_clock_ns_to_ticks(scale, now - start);
+}
+
+// Time when counter reaches +ticks
+static inline int64_t pmb887x_timebase_after(const pmb887x_clock_scale_t *scale, int64_t now, uint64_t ticks) {
+	uint64_t ns = pmb887x_clock_ticks_to_ns(scale, ticks);
+	return ns >= INT64_MAX - now ? INT64_MAX : now + ns;
+}
+
+extern const VMStateDescription vmstate_pmb887x_timebase_event;
+
+#define VMSTATE_PMB887X_TIMEBASE_EVENT(_f, _s) \
+	VMSTATE_STRUCT(_f, _s, 0, vmstate_pmb887x_timebase_event, pmb887x_timebase_event_t)
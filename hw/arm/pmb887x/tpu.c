@@ -16,9 +16,13 @@
 #include "qemu/main-loop.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-clock.h"
 #include "qapi/error.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/clock.h"
+#include "hw/arm/pmb887x/timebase.h"
 #include "hw/arm/pmb887x/regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
 #include "hw/arm/pmb887x/regs_dump.h"
@@ -35,7 +39,7 @@ struct pmb887x_tpu_t {
 	
 	// regs
 	pmb887x_clc_reg_t clc;
-	uint8_t ram[TPU_RAM_SIZE];
+	pmb887x_ram_window_t ram;
 	uint32_t correction;
 	uint32_t overflow;
 	uint32_t offset;
@@ -56,7 +60,7 @@ struct pmb887x_tpu_t {
 	uint32_t unk[8];
 	
 	uint32_t irq_fired;
-	QEMUTimer *timer;
+	pmb887x_timebase_event_t timer;
 	
 	bool enabled;
 	uint32_t freq;
@@ -68,7 +72,9 @@ struct pmb887x_tpu_t {
 	uint32_t K;
 	
 	uint32_t last_fsys;
+	pmb887x_clock_scale_t scale;
 	
+	Clock *clk;
 	struct pmb887x_pll_t *pll;
 };
 
@@ -77,17 +83,12 @@ static uint64_t tpu_get_time(struct pmb887x_tpu_t *p, bool real) {
 	uint64_t overflow = p->overflow + 1;
 	
 	if (p->enabled) {
-		uint64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		next += muldiv64(delta_ns, p->freq, NANOSECONDS_PER_SECOND);
+		next += pmb887x_timebase_ticks(&p->scale, p->start, pmb887x_timebase_now());
 	}
 	
 	return real ? next : (next % overflow);
 }
 
-static uint64_t tpu_ticks_to_ns(struct pmb887x_tpu_t *p, uint64_t ticks) {
-    return muldiv64(ticks, NANOSECONDS_PER_SECOND, p->freq);
-}
-
 static uint64_t tpu_run_irq(struct pmb887x_tpu_t *p, uint64_t counter, uint64_t now, uint64_t next) {
 	for (int i = 0; i < 2; i++) {
 		if (!(p->irq_fired & (1 << i))) {
@@ -95,7 +96,7 @@ static uint64_t tpu_run_irq(struct pmb887x_tpu_t *p, uint64_t counter, uint64_t
 				pmb887x_src_update(&p->src[i], 0, MOD_SRC_SETR);
 				p->irq_fired |= (1 << i);
 			} else {
-				next = MIN(next, now + tpu_ticks_to_ns(p, p->intr[i] - counter));
+				next = MIN(next, pmb887x_timebase_after(&p->scale, now, p->intr[i] - counter));
 			}
 		}
 	}
@@ -108,7 +109,7 @@ static void tpu_ptimer_reset(void *opaque) {
 	if (!p->enabled)
 		return;
 	
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	uint64_t overflow = p->overflow + 1;
 	
 	if (!p->start) {
@@ -125,16 +126,16 @@ static void tpu_ptimer_reset(void *opaque) {
 		counter = p->counter;
 	}
 	
-	p->next = now + tpu_ticks_to_ns(p, overflow - counter);
+	p->next = pmb887x_timebase_after(&p->scale, now, overflow - counter);
 	p->next = tpu_run_irq(p, counter, now, p->next);
 	
-	timer_mod(p->timer, p->next);
+	pmb887x_timebase_mod(&p->timer, p->next);
 }
 
 static void tpu_ptimer_reset2(void *opaque) {
 	struct pmb887x_tpu_t *p = (struct pmb887x_tpu_t *) opaque;
 	
-	uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t now = pmb887x_timebase_now();
 	if (p->next && (now - p->next) / 1000000) {
 		EPRINTF("delta=%"PRId64" ms / %"PRId64" us\n", (now - p->next) / 1000000, (now - p->next) / 1000);
 		// abort();
@@ -178,50 +179,18 @@ static void tpu_update_state(struct pmb887x_tpu_t *p) {
 	if (p->freq != new_freq || p->enabled != enabled) {
 		p->freq = new_freq;
 		p->enabled = enabled;
+		pmb887x_clock_scale_set(&p->scale, p->freq);
 		DPRINTF("fsys=%d, ftpu=%d, fcounter=%d [%s]\n", pmb887x_pll_get_fsys(p->pll), ftpu, p->freq, p->enabled ? "ON" : "OFF");
 	}
 	
 	tpu_ptimer_reset(p);
 }
 
-static void tpu_update_state_callback(void *opaque) {
+// Called only when fSYS actually changes
+static void tpu_clock_update(void *opaque, ClockEvent event) {
 	struct pmb887x_tpu_t *p = (struct pmb887x_tpu_t *) opaque;
-	uint32_t fsys = pmb887x_pll_get_fsys(p->pll);
-	if (p->last_fsys != fsys) {
-		tpu_update_state(p);
-		p->last_fsys = fsys;
-	}
-}
-
-static uint32_t tpu_ram_read(struct pmb887x_tpu_t *p, uint32_t offset, unsigned size) {
-	uint8_t *data = p->ram;
-	switch (size) {
-		case 1:		return data[offset];
-		case 2:		return data[offset] | (data[offset + 1] << 8);
-		case 4:		return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | (data[offset + 3] << 24);
-	}
-    return 0;
-}
-
-static void tpu_ram_write(struct pmb887x_tpu_t *p, uint32_t offset, uint32_t value, unsigned size) {
-	uint8_t *data = p->ram;
-	switch (size) {
-		case 1:
-			data[offset] = value & 0xFF;
-		break;
-		
-		case 2:
-			data[offset] = value & 0xFF;
-			data[offset + 1] = (value >> 8) & 0xFF;
-		break;
-		
-		case 4:
-			data[offset] = value & 0xFF;
-			data[offset + 1] = (value >> 8) & 0xFF;
-			data[offset + 2] = (value >> 16) & 0xFF;
-			data[offset + 3] = (value >> 24) & 0xFF;
-		break;
-	}
+	p->last_fsys = pmb887x_pll_get_fsys(p->pll);
+	tpu_update_state(p);
 }
 
 static int tpu_unk_by_reg(hwaddr haddr) {
@@ -311,10 +280,6 @@ static uint64_t tpu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			value = tpu_get_time(p, false);
 		break;
 		
-		case TPU_RAM0 ... (TPU_RAM0 + TPU_RAM_SIZE):
-			value = tpu_ram_read(p, haddr, size);
-		break;
-		
 		case TPU_UNK_SRC0:
 		case TPU_UNK_SRC1:
 		case TPU_UNK_SRC2:
@@ -405,10 +370,6 @@ static void tpu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 			p->pllcon2 = value;
 		break;
 		
-		case TPU_RAM0 ... (TPU_RAM0 + TPU_RAM_SIZE):
-			tpu_ram_write(p, haddr, value, size);
-		break;
-		
 		case TPU_UNK_SRC0:
 		case TPU_UNK_SRC1:
 		case TPU_UNK_SRC2:
@@ -457,11 +418,16 @@ static void tpu_init(Object *obj) {
 		sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq[i]);
 	for (int i = 0; i < ARRAY_SIZE(p->unk_src); i++)
 		sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->unk_irq[i]);
+	
+	p->clk = qdev_init_clock_in(DEVICE(obj), "clk", tpu_clock_update, p, ClockUpdate);
 }
 
 static void tpu_realize(DeviceState *dev, Error **errp) {
 	struct pmb887x_tpu_t *p = PMB887X_TPU(dev);
 	
+	if (!pmb887x_ram_window_init(&p->ram, OBJECT(dev), "pmb887x-tpu-ram", &p->mmio, TPU_RAM0, TPU_RAM_SIZE, errp))
+		return;
+	
 	pmb887x_clc_init(&p->clc);
 	
 	int index = 0;
@@ -479,14 +445,55 @@ static void tpu_realize(DeviceState *dev, Error **errp) {
 		
 		pmb887x_src_init(&p->unk_src[i], p->unk_irq[i]);
 	}
-	
-    p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, tpu_ptimer_reset2, p);
+
+	pmb887x_timebase_event_init(&p->timer, "tpu", tpu_ptimer_reset2, p);
 	p->enabled = false;
 	
+	pmb887x_pll_connect_clock(p->pll, "fsys", p->clk);
+	p->last_fsys = pmb887x_pll_get_fsys(p->pll);
+	
 	tpu_update_state(p);
-	pmb887x_pll_add_freq_update_callback(p->pll, tpu_update_state_callback, p);
 }
 
+static int tpu_post_load(void *opaque, int version_id) {
+	struct pmb887x_tpu_t *p = (struct pmb887x_tpu_t *) opaque;
+	pmb887x_clock_scale_set(&p->scale, p->freq);
+	return 0;
+}
+
+static const VMStateDescription tpu_vmstate = {
+	.name = TYPE_PMB887X_TPU,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = tpu_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(correction, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(overflow, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(offset, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(param, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(skip, struct pmb887x_tpu_t),
+		VMSTATE_UINT32_ARRAY(intr, struct pmb887x_tpu_t, 2),
+		VMSTATE_PMB887X_SRC_ARRAY(src, struct pmb887x_tpu_t, 2),
+		VMSTATE_PMB887X_SRC_ARRAY(unk_src, struct pmb887x_tpu_t, 6),
+		VMSTATE_UINT32(pllcon0, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(pllcon1, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(pllcon2, struct pmb887x_tpu_t),
+		VMSTATE_UINT32_ARRAY(unk, struct pmb887x_tpu_t, 8),
+		VMSTATE_UINT32(irq_fired, struct pmb887x_tpu_t),
+		VMSTATE_PMB887X_TIMEBASE_EVENT(timer, struct pmb887x_tpu_t),
+		VMSTATE_BOOL(enabled, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(freq, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(counter, struct pmb887x_tpu_t),
+		VMSTATE_UINT64(start, struct pmb887x_tpu_t),
+		VMSTATE_UINT64(next, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(L, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(K, struct pmb887x_tpu_t),
+		VMSTATE_UINT32(last_fsys, struct pmb887x_tpu_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
 static Property tpu_properties[] = {
 	DEFINE_PROP_LINK("pll", struct pmb887x_tpu_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
     DEFINE_PROP_END_OF_LIST(),
@@ -496,6 +503,7 @@ static void tpu_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, tpu_properties);
 	dc->realize = tpu_realize;
+	dc->vmsd = &tpu_vmstate;
 }
 
 static const TypeInfo tpu_info = {
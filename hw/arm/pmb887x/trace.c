@@ -0,0 +1,176 @@
+/*
+ * Runtime per-module trace masks
+ *
+ * Syntax: list of module names separated by any of ",:+| ", for example "gptu:stm:dif".
+ * Special names: "all", "none". Prefix "-" removes module: "all:-stm:-gptu".
+ * Raw numeric masks are accepted too: "0x100".
+ * */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/module.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "qapi/qmp/qdict.h"
+#include "hw/arm/pmb887x/trace_common.h"
+
+uint64_t pmb887x_trace_log_mask = 0;
+uint64_t pmb887x_trace_io_mask = 0;
+
+static const struct {
+	const char *name;
+	uint64_t id;
+} trace_modules[] = {
+	{ "gptu",		PMB887X_TRACE_GPTU },
+	{ "tpu",		PMB887X_TRACE_TPU },
+	{ "dmac",		PMB887X_TRACE_DMAC },
+	{ "ebu",		PMB887X_TRACE_EBU },
+	{ "stm",		PMB887X_TRACE_STM },
+	{ "pll",		PMB887X_TRACE_PLL },
+	{ "adc",		PMB887X_TRACE_ADC },
+	{ "capcom",		PMB887X_TRACE_CAPCOM },
+	{ "dif",		PMB887X_TRACE_DIF },
+	{ "dsp",		PMB887X_TRACE_DSP },
+	{ "mod",		PMB887X_TRACE_MOD },
+	{ "nvic",		PMB887X_TRACE_NVIC },
+	{ "pcl",		PMB887X_TRACE_PCL },
+	{ "rtc",		PMB887X_TRACE_RTC },
+	{ "scu",		PMB887X_TRACE_SCU },
+	{ "usart",		PMB887X_TRACE_USART },
+	{ "keypad",		PMB887X_TRACE_KEYPAD },
+	{ "i2c",		PMB887X_TRACE_I2C },
+	{ "sccu",		PMB887X_TRACE_SCCU },
+	{ "mmci",		PMB887X_TRACE_MMCI },
+	{ "hle",		PMB887X_TRACE_HLE },
+	{ "input",		PMB887X_TRACE_INPUT },
+	{ "fm_radio",	PMB887X_TRACE_FM_RADIO },
+	{ "flash",		PMB887X_TRACE_FLASH },
+	{ "lcd",		PMB887X_TRACE_LCD },
+	{ "pmic",		PMB887X_TRACE_PMIC },
+};
+
+static bool trace_find_module(const char *name, uint64_t *id) {
+	uint64_t value;
+	
+	if (strcmp(name, "all") == 0) {
+		*id = PMB887X_TRACE_ALL;
+		return true;
+	}
+	
+	for (int i = 0; i < ARRAY_SIZE(trace_modules); i++) {
+		if (strcmp(trace_modules[i].name, name) == 0) {
+			*id = trace_modules[i].id;
+			return true;
+		}
+	}
+	
+	if (qemu_strtou64(name, NULL, 0, &value) == 0) {
+		*id = value;
+		return true;
+	}
+	
+	return false;
+}
+
+bool pmb887x_trace_parse(const char *str, uint64_t *mask, Error **errp) {
+	g_auto(GStrv) tokens = g_strsplit_set(str, ",:+| ", -1);
+	uint64_t new_mask = 0;
+	
+	for (int i = 0; tokens[i]; i++) {
+		const char *name = tokens[i];
+		bool remove = false;
+		uint64_t id;
+		
+		if (!name[0] || strcmp(name, "none") == 0)
+			continue;
+		
+		if (name[0] == '-') {
+			remove = true;
+			name++;
+		}
+		
+		if (!trace_find_module(name, &id)) {
+			error_setg(errp, "Unknown pmb887x trace module: %s", name);
+			return false;
+		}
+		
+		if (remove) {
+			new_mask &= ~id;
+		} else {
+			new_mask |= id;
+		}
+	}
+	
+	*mask = new_mask;
+	return true;
+}
+
+char *pmb887x_trace_format(uint64_t mask) {
+	g_autoptr(GString) s = g_string_new("");
+	
+	for (int i = 0; i < ARRAY_SIZE(trace_modules); i++) {
+		if ((mask & trace_modules[i].id)) {
+			g_string_append_printf(s, "%s%s", s->len ? ":" : "", trace_modules[i].name);
+			mask &= ~trace_modules[i].id;
+		}
+	}
+	
+	if (mask)
+		g_string_append_printf(s, "%s0x%"PRIx64, s->len ? ":" : "", mask);
+	
+	if (!s->len)
+		g_string_append(s, "none");
+	
+	return g_string_free(g_steal_pointer(&s), false);
+}
+
+static void trace_init_from_env(const char *env, uint64_t *mask) {
+	Error *err = NULL;
+	const char *value = getenv(env);
+	
+	if (value && !pmb887x_trace_parse(value, mask, &err)) {
+		error_prepend(&err, "%s: ", env);
+		error_report_err(err);
+		exit(1);
+	}
+}
+
+static void hmp_pmb887x_trace(Monitor *mon, const QDict *qdict) {
+	const char *kind = qdict_get_str(qdict, "kind");
+	const char *modules = qdict_get_str(qdict, "modules");
+	Error *err = NULL;
+	uint64_t *mask;
+	
+	if (strcmp(kind, "log") == 0) {
+		mask = &pmb887x_trace_log_mask;
+	} else if (strcmp(kind, "io") == 0) {
+		mask = &pmb887x_trace_io_mask;
+	} else {
+		error_setg(&err, "Invalid trace kind: %s, expected: log, io", kind);
+		hmp_handle_error(mon, err);
+		return;
+	}
+	
+	pmb887x_trace_parse(modules, mask, &err);
+	hmp_handle_error(mon, err);
+}
+
+static void hmp_info_pmb887x_trace(Monitor *mon, const QDict *qdict) {
+	g_autofree char *log = pmb887x_trace_format(pmb887x_trace_log_mask);
+	g_autofree char *io = pmb887x_trace_format(pmb887x_trace_io_mask);
+	
+	#ifndef CONFIG_PMB887X_TRACE
+	monitor_printf(mon, "Tracing is disabled at build time (--disable-pmb887x-trace)\n");
+	#endif
+	
+	monitor_printf(mon, "log: %s\n", log);
+	monitor_printf(mon, "io:  %s\n", io);
+}
+
+static void pmb887x_trace_init(void) {
+	trace_init_from_env("PMB887X_TRACE", &pmb887x_trace_log_mask);
+	trace_init_from_env("PMB887X_TRACE_IO", &pmb887x_trace_io_mask);
+	monitor_register_hmp("pmb887x-trace", false, hmp_pmb887x_trace);
+	monitor_register_hmp("pmb887x-trace", true, hmp_info_pmb887x_trace);
+}
+type_init(pmb887x_trace_init)
@@ -29,89 +29,43 @@ enum pmb887x_modules_t {
 	PMB887X_TRACE_I2C		= 1ULL << 17,
 	PMB887X_TRACE_SCCU		= 1ULL << 18,
 	PMB887X_TRACE_MMCI		= 1ULL << 19,
+	PMB887X_TRACE_HLE		= 1ULL << 20,
 	
 	// External
+	PMB887X_TRACE_INPUT		= 1ULL << 27,
 	PMB887X_TRACE_FM_RADIO	= 1ULL << 28,
 	PMB887X_TRACE_FLASH		= 1ULL << 29,
 	PMB887X_TRACE_LCD		= 1ULL << 30,
 	PMB887X_TRACE_PMIC		= 1ULL << 31,
 };
 
-//extern uint32_t pmb887x_trace_flags;
+#define PMB887X_TRACE_ALL		0xFFFFFFFFULL
 
+/*
+ * Runtime masks: PMB887X_TRACE / PMB887X_TRACE_IO env, -machine pmb887x,trace=...,trace-io=...
+ * or "pmb887x-trace" monitor command. See trace.c
+ * */
+extern uint64_t pmb887x_trace_log_mask;
+extern uint64_t pmb887x_trace_io_mask;
+
+bool pmb887x_trace_parse(const char *str, uint64_t *mask, Error **errp);
+char *pmb887x_trace_format(uint64_t mask);
+
+#ifdef CONFIG_PMB887X_TRACE
+static inline bool pmb887x_trace_log_enabled(uint64_t id) {
+	return (pmb887x_trace_log_mask & id) != 0;
+}
+
+static inline bool pmb887x_trace_io_enabled(uint64_t id) {
+	return (pmb887x_trace_io_mask & id) != 0;
+}
+#else
+// Compiled out with --disable-pmb887x-trace
 static inline bool pmb887x_trace_log_enabled(uint64_t id) {
-	return ((id & (PMB887X_TRACE_GPTU)) != 0);
-	//return ((id & (PMB887X_TRACE_LCD)) != 0);
 	return false;
-	return ((id & (PMB887X_TRACE_ADC)) != 0);
-	return ((id & (PMB887X_TRACE_FLASH)) != 0);
-	return ((id & (PMB887X_TRACE_LCD)) != 0);
-	return ((id & (PMB887X_TRACE_TPU | PMB887X_TRACE_FLASH | PMB887X_TRACE_LCD | PMB887X_TRACE_EBU | PMB887X_TRACE_I2C)) != 0);
-//	return false;
-	return ((
-		PMB887X_TRACE_GPTU |
-		PMB887X_TRACE_TPU |
-//		PMB887X_TRACE_DMAC |
-		PMB887X_TRACE_EBU |
-//		PMB887X_TRACE_STM |
-		PMB887X_TRACE_PLL |
-		PMB887X_TRACE_ADC |
-		PMB887X_TRACE_CAPCOM |
-		PMB887X_TRACE_DIF |
-		PMB887X_TRACE_DSP |
-		PMB887X_TRACE_MOD |
-		PMB887X_TRACE_NVIC |
-		PMB887X_TRACE_PCL |
-		PMB887X_TRACE_RTC |
-		PMB887X_TRACE_SCU |
-		PMB887X_TRACE_USART |
-		PMB887X_TRACE_KEYPAD |
-		PMB887X_TRACE_I2C |
-		PMB887X_TRACE_SCCU |
-		PMB887X_TRACE_MMCI |
-		
-		PMB887X_TRACE_FLASH |
-		PMB887X_TRACE_LCD |
-		PMB887X_TRACE_PMIC |
-		PMB887X_TRACE_FM_RADIO |
-		0
-	) & id) != 0;
 }
 
 static inline bool pmb887x_trace_io_enabled(uint64_t id) {
-	return ((id & (PMB887X_TRACE_GPTU)) != 0);
-	//return true;
-	//return ((id & (PMB887X_TRACE_GPTU)) != 0);
-	//return ((id & (PMB887X_TRACE_ADC)) != 0);
-	//return ((id & (PMB887X_TRACE_PCL)) != 0);
 	return false;
-	return ((id & (PMB887X_TRACE_SCCU | PMB887X_TRACE_SCU)) != 0);
-	return ((
-		PMB887X_TRACE_GPTU |
-		PMB887X_TRACE_TPU |
-		PMB887X_TRACE_DMAC |
-		PMB887X_TRACE_EBU |
-		PMB887X_TRACE_STM |
-		PMB887X_TRACE_PLL |
-		PMB887X_TRACE_ADC |
-		PMB887X_TRACE_CAPCOM |
-		PMB887X_TRACE_DIF |
-		PMB887X_TRACE_DSP |
-		PMB887X_TRACE_MOD |
-		PMB887X_TRACE_NVIC |
-		PMB887X_TRACE_PCL |
-		PMB887X_TRACE_RTC |
-		PMB887X_TRACE_SCU |
-		PMB887X_TRACE_USART |
-		PMB887X_TRACE_KEYPAD |
-		PMB887X_TRACE_I2C |
-		PMB887X_TRACE_SCCU |
-		PMB887X_TRACE_MMCI |
-		
-//		PMB887X_TRACE_FLASH |
-		PMB887X_TRACE_LCD |
-		PMB887X_TRACE_PMIC |
-		PMB887X_TRACE_FM_RADIO |
-		0
-	) & id) != 0;
 }
+#endif
@@ -19,6 +19,7 @@
 #include "qapi/error.h"
 #include "chardev/char-fe.h"
 #include "chardev/char-serial.h"
+#include "migration/vmstate.h"
 
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/regs.h"
@@ -31,7 +32,8 @@
 #define TYPE_PMB887X_USART	"pmb887x-usart"
 #define PMB887X_USART(obj)	OBJECT_CHECK(struct pmb887x_usart_t, (obj), TYPE_PMB887X_USART)
 
-#define FIFO_SIZE	8
+#define FIFO_SIZE			8
+#define USART_HOST_BUFFER	4096
 
 enum {
 	USART_IRQ_TX,
@@ -58,6 +60,26 @@ struct pmb887x_usart_t {
 	guint watch_tag;
 	CharBackend chr;
 	
+	struct pmb887x_pll_t *pll;
+	bool turbo;
+	
+	// Line timing
+	QEMUTimer *tx_timer;
+	QEMUTimer *rx_timer;
+	int64_t tx_last;
+	int64_t rx_last;
+	
+	// Batching between FIFO and chardev
+	GByteArray *tx_host;
+	GByteArray *rx_host;
+	QEMUBH *tx_bh;
+	
+	// Migration of tx_host/rx_host
+	uint32_t tx_host_len;
+	uint32_t rx_host_len;
+	uint8_t *tx_host_data;
+	uint8_t *rx_host_data;
+	
 	pmb887x_fifo8_t tx_fifo_buffered;
 	pmb887x_fifo8_t rx_fifo_buffered;
 	
@@ -87,7 +109,43 @@ struct pmb887x_usart_t {
 	uint32_t tmo;
 };
 
-static void usart_transmit_fifo(struct pmb887x_usart_t *p);
+static void usart_tx_kick(struct pmb887x_usart_t *p);
+static void usart_tx_flush(struct pmb887x_usart_t *p);
+static void usart_rx_kick(struct pmb887x_usart_t *p);
+
+/*
+ * Time of one frame on the wire: start + data + parity + stop bits.
+ * 0 - no timing (turbo mode or baud rate generator is not configured), data is moved instantly.
+ * */
+static int64_t usart_get_char_ns(struct pmb887x_usart_t *p) {
+	if (p->turbo || !p->pll || !(p->con & USART_CON_CON_R))
+		return 0;
+	
+	uint64_t fsys = pmb887x_pll_get_fsys(p->pll);
+	uint64_t div = 16 * ((p->bg & 0x1FFF) + 1);
+	uint64_t baud;
+	
+	if ((p->con & USART_CON_FDE)) {
+		uint32_t fdv = (p->fdv & 0x1FF) ?: 512;
+		baud = muldiv64(fsys, fdv, 512 * div);
+	} else {
+		baud = fsys / (div * ((p->con & USART_CON_BRS) ? 3 : 2));
+	}
+	
+	if (!baud)
+		return 0;
+	
+	uint32_t bits = 1 + 8 + ((p->con & USART_CON_STP) ? 2 : 1);
+	switch ((p->con & USART_CON_M)) {
+		case USART_CON_M_ASYNC_9BIT:
+		case USART_CON_M_ASYNC_WAKE_UP_8BIT:
+		case USART_CON_M_ASYNC_PARITY_8BIT:
+			bits++;
+		break;
+	}
+	
+	return muldiv64(bits, NANOSECONDS_PER_SECOND, baud);
+}
 
 static void usart_set_rx_fifo(struct pmb887x_usart_t *p, bool buffered) {
 	pmb887x_fifo_reset(&p->rx_fifo_buffered);
@@ -104,11 +162,6 @@ static void usart_set_tx_fifo(struct pmb887x_usart_t *p, bool buffered) {
 	pmb887x_fifo_reset(&p->tx_fifo_buffered);
 	pmb887x_fifo_reset(&p->tx_fifo_single);
 	
-	if (p->watch_tag) {
-		g_source_remove(p->watch_tag);
-		p->watch_tag = 0;
-	}
-	
 	if (buffered) {
 		p->tx_fifo = &p->tx_fifo_buffered;
 	} else {
@@ -134,11 +187,14 @@ static void usart_update_state(struct pmb887x_usart_t *p) {
 	}
 }
 
+/*
+ * RX: host -> rx_host -> rx_fifo
+ * */
 static int usart_can_receive(void *opaque) {
 	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
 	if (!pmb887x_clc_is_enabled(&p->clc))
 		return 0;
-	return pmb887x_fifo_free_count(p->rx_fifo);
+	return USART_HOST_BUFFER - p->rx_host->len;
 }
 
 static void usart_receive(void *opaque, const uint8_t *buf, int size) {
@@ -150,8 +206,20 @@ static void usart_receive(void *opaque, const uint8_t *buf, int size) {
 		return;
 	}
 	
-	g_assert(size <= pmb887x_fifo_free_count(p->rx_fifo));
-	pmb887x_fifo8_write(p->rx_fifo, buf, size);
+	g_assert(p->rx_host->len + size <= USART_HOST_BUFFER);
+	g_byte_array_append(p->rx_host, buf, size);
+	usart_rx_kick(p);
+}
+
+static uint32_t usart_rx_fill(struct pmb887x_usart_t *p, uint32_t max) {
+	uint32_t count = MIN(max, MIN(pmb887x_fifo_free_count(p->rx_fifo), p->rx_host->len));
+	if (!count)
+		return 0;
+	
+	bool was_full = p->rx_host->len == USART_HOST_BUFFER;
+	
+	pmb887x_fifo8_write(p->rx_fifo, p->rx_host->data, count);
+	g_byte_array_remove_range(p->rx_host, 0, count);
 	
 	if ((p->rxfcon & USART_RXFCON_RXFEN)) {
 		uint32_t rx_level = (p->rxfcon & USART_RXFCON_RXFITL) >> USART_RXFCON_RXFITL_SHIFT;
@@ -162,71 +230,153 @@ static void usart_receive(void *opaque, const uint8_t *buf, int size) {
 	} else {
 		pmb887x_srb_set_isr(&p->srb, USART_ISR_RX);
 	}
+	
+	if (was_full)
+		qemu_chr_fe_accept_input(&p->chr);
+	
+	return count;
 }
 
+static void usart_rx_kick(struct pmb887x_usart_t *p) {
+	int64_t char_ns = usart_get_char_ns(p);
+	
+	if (!char_ns) {
+		usart_rx_fill(p, UINT32_MAX);
+	} else if (p->rx_host->len && !timer_pending(p->rx_timer)) {
+		p->rx_last = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+		timer_mod(p->rx_timer, p->rx_last + char_ns);
+	}
+}
+
+static void usart_rx_timer(void *opaque) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	int64_t char_ns = usart_get_char_ns(p);
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	
+	if (!char_ns) {
+		usart_rx_fill(p, UINT32_MAX);
+		return;
+	}
+	
+	// All chars which were fully received since last tick
+	uint32_t chars = MAX(1, (now - p->rx_last) / char_ns);
+	uint32_t received = usart_rx_fill(p, chars);
+	p->rx_last = received < chars ? now : p->rx_last + chars * char_ns;
+	
+	// Receiver waits for RXB read when FIFO is full
+	if (p->rx_host->len && !pmb887x_fifo_is_full(p->rx_fifo))
+		timer_mod(p->rx_timer, p->rx_last + char_ns);
+}
+
+/*
+ * TX: tx_fifo -> tx_host -> host
+ * */
 static gboolean usart_transmit_delayed(void *do_not_use, GIOCondition cond, void *opaque) {
 	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
 	p->watch_tag = 0;
-	usart_transmit_fifo(p);
+	usart_tx_flush(p);
+	usart_tx_kick(p);
 	return false;
 }
 
-static void usart_transmit_fifo(struct pmb887x_usart_t *p) {
-	if (p->watch_tag)
+static void usart_tx_flush(struct pmb887x_usart_t *p) {
+	if (p->watch_tag || !p->tx_host->len)
 		return;
 	
-	if (!pmb887x_clc_is_enabled(&p->clc)) {
-		pmb887x_fifo_reset(p->tx_fifo);
+	if (!qemu_chr_fe_backend_connected(&p->chr)) {
+		g_byte_array_set_size(p->tx_host, 0);
 		return;
 	}
 	
+	int ret = qemu_chr_fe_write(&p->chr, p->tx_host->data, p->tx_host->len);
+	if (ret > 0)
+		g_byte_array_remove_range(p->tx_host, 0, ret);
+	
+	if (p->tx_host->len) {
+		p->watch_tag = qemu_chr_fe_add_watch(&p->chr, G_IO_OUT | G_IO_HUP, usart_transmit_delayed, p);
+		if (!p->watch_tag) {
+			WPRINTF("chardev write failed, %d bytes lost\n", p->tx_host->len);
+			g_byte_array_set_size(p->tx_host, 0);
+		}
+	}
+}
+
+static void usart_tx_bh(void *opaque) {
+	usart_tx_flush((struct pmb887x_usart_t *) opaque);
+}
+
+static uint32_t usart_tx_drain(struct pmb887x_usart_t *p, uint32_t max) {
+	uint32_t count = MIN(max, MIN(pmb887x_fifo_count(p->tx_fifo), USART_HOST_BUFFER - p->tx_host->len));
+	if (!count)
+		return 0;
+	
 	bool is_full = pmb887x_fifo_is_full(p->tx_fifo);
 	
 	uint8_t buff[FIFO_SIZE];
-	uint32_t size = pmb887x_fifo_count(p->tx_fifo);
-	pmb887x_fifo8_read(p->tx_fifo, buff, size);
+	count = MIN(count, sizeof(buff));
+	pmb887x_fifo8_read(p->tx_fifo, buff, count);
+	g_byte_array_append(p->tx_host, buff, count);
 	
-	/*
-	for (uint32_t i = 0; i < size; i++) {
-		DPRINTF("TX=%02X\n", buff[i]);
-	}
-	*/
+	if (is_full)
+		pmb887x_srb_set_isr(&p->srb, USART_ISR_TB);
 	
-	int ret = qemu_chr_fe_write_all(&p->chr, buff, size);
-	if (ret > 0) {
-		if (ret < size) {
-			// possible?
-			pmb887x_fifo8_write(p->tx_fifo, buff + ret, size - ret);
-		}
-		
-		if (is_full)
-			pmb887x_srb_set_isr(&p->srb, USART_ISR_TB);
+	if ((p->txfcon & USART_TXFCON_TXFEN)) {
+		uint32_t tx_level = (p->txfcon & USART_TXFCON_TXFITL) >> USART_TXFCON_TXFITL_SHIFT;
+		tx_level = MAX(1, MIN(FIFO_SIZE, tx_level));
 		
-		if ((p->txfcon & USART_TXFCON_TXFEN)) {
-			uint32_t tx_level = (p->txfcon & USART_TXFCON_TXFITL) >> USART_TXFCON_TXFITL_SHIFT;
-			tx_level = MAX(1, MIN(FIFO_SIZE, tx_level));
-			
-			if (pmb887x_fifo_count(p->tx_fifo) <= tx_level)
-				pmb887x_srb_set_isr(&p->srb, USART_ISR_TX);
-		} else {
-			if (pmb887x_fifo_is_empty(p->tx_fifo))
-				pmb887x_srb_set_isr(&p->srb, USART_ISR_TX);
-		}
-	} else if (size > 0) {
-		WPRINTF("qemu_chr_fe_write_all failed! size=%d, ret=%d", size, ret);
-		for (uint32_t i = 0; i < size; i++)
-			WPRINTF("Lost data: %02X\n", buff[i]);
+		if (pmb887x_fifo_count(p->tx_fifo) <= tx_level)
+			pmb887x_srb_set_isr(&p->srb, USART_ISR_TX);
+	} else {
+		if (pmb887x_fifo_is_empty(p->tx_fifo))
+			pmb887x_srb_set_isr(&p->srb, USART_ISR_TX);
 	}
 	
-	if (!pmb887x_fifo_is_empty(p->tx_fifo)) {
-		p->watch_tag = qemu_chr_fe_add_watch(&p->chr, G_IO_OUT | G_IO_HUP, usart_transmit_delayed, p);
-		if (!p->watch_tag) {
-			pmb887x_srb_set_isr(&p->srb, USART_ISR_TB | USART_ISR_TX);
-			pmb887x_fifo_reset(p->tx_fifo);
-		}
+	// Turbo: one host write per main loop iteration instead of one per FIFO
+	if (p->turbo && p->tx_host->len < USART_HOST_BUFFER / 2) {
+		qemu_bh_schedule(p->tx_bh);
+	} else {
+		usart_tx_flush(p);
+	}
+	
+	return count;
+}
+
+static void usart_tx_kick(struct pmb887x_usart_t *p) {
+	if (!pmb887x_clc_is_enabled(&p->clc)) {
+		pmb887x_fifo_reset(p->tx_fifo);
+		return;
+	}
+	
+	int64_t char_ns = usart_get_char_ns(p);
+	
+	if (!char_ns) {
+		usart_tx_drain(p, UINT32_MAX);
+	} else if (!pmb887x_fifo_is_empty(p->tx_fifo) && !timer_pending(p->tx_timer)) {
+		p->tx_last = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+		timer_mod(p->tx_timer, p->tx_last + char_ns);
 	}
 }
 
+static void usart_tx_timer(void *opaque) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	int64_t char_ns = usart_get_char_ns(p);
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	
+	if (!char_ns) {
+		usart_tx_drain(p, UINT32_MAX);
+		return;
+	}
+	
+	// All chars which were fully shifted out since last tick
+	uint32_t chars = MAX(1, (now - p->tx_last) / char_ns);
+	uint32_t sent = usart_tx_drain(p, chars);
+	p->tx_last = sent < chars ? now : p->tx_last + chars * char_ns;
+	
+	// Stalled by host: continues from usart_transmit_delayed()
+	if (sent && !pmb887x_fifo_is_empty(p->tx_fifo))
+		timer_mod(p->tx_timer, p->tx_last + char_ns);
+}
+
 static uint64_t usart_io_read(void *opaque, hwaddr haddr, unsigned size) {
 	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
 	
@@ -272,7 +422,6 @@ static uint64_t usart_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			no_dump = true;
 			
 			if (!pmb887x_fifo_is_empty(p->rx_fifo)) {
-				bool is_full = pmb887x_fifo_is_full(p->rx_fifo);
 				value = pmb887x_fifo8_pop(p->rx_fifo);
 				/*
 				if (isprint(value)) {
@@ -281,8 +430,7 @@ static uint64_t usart_io_read(void *opaque, hwaddr haddr, unsigned size) {
 					DPRINTF("RX=%02X [read]\n", value);
 				}
 				*/
-				if (is_full)
-					qemu_chr_fe_accept_input(&p->chr);
+				usart_rx_kick(p);
 			}
 		break;
 		
@@ -422,7 +570,7 @@ static void usart_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned
 				if (!pmb887x_fifo_is_full(p->tx_fifo))
 					pmb887x_srb_set_isr(&p->srb, USART_ISR_TB);
 				
-				usart_transmit_fifo(p);
+				usart_tx_kick(p);
 			} else {
 				EPRINTF("TX FIFO is FULL :(\n");
 				abort();
@@ -519,10 +667,10 @@ static void usart_realize(DeviceState *dev, Error **errp) {
 		if (!p->irq[i])
 			hw_error("pmb887x-usart: irq %d not set", i);
 	}
-	
+
     pmb887x_fifo8_init(&p->tx_fifo_buffered, FIFO_SIZE);
     pmb887x_fifo8_init(&p->rx_fifo_buffered, FIFO_SIZE);
-	
+
     pmb887x_fifo8_init(&p->tx_fifo_single, 2);
     pmb887x_fifo8_init(&p->rx_fifo_single, 1);
 	
@@ -531,14 +679,131 @@ static void usart_realize(DeviceState *dev, Error **errp) {
 	
 	pmb887x_srb_init(&p->srb, p->irq, ARRAY_SIZE(p->irq));
 	
+	p->tx_host = g_byte_array_sized_new(USART_HOST_BUFFER);
+	p->rx_host = g_byte_array_sized_new(USART_HOST_BUFFER);
+	p->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, usart_tx_timer, p);
+	p->rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, usart_rx_timer, p);
+	p->tx_bh = qemu_bh_new_guarded(usart_tx_bh, p, &dev->mem_reentrancy_guard);
+	
 	qemu_chr_fe_set_handlers(&p->chr, usart_can_receive, usart_receive, NULL, NULL, p, NULL, true);
 	
 	usart_update_state(p);
 }
 
+static int usart_post_load(void *opaque, int version_id) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	
+	p->rx_fifo = (p->rxfcon & USART_RXFCON_RXFEN) ? &p->rx_fifo_buffered : &p->rx_fifo_single;
+	p->tx_fifo = (p->txfcon & USART_TXFCON_TXFEN) ? &p->tx_fifo_buffered : &p->tx_fifo_single;
+	
+	// Continue pending TX/RX, restored timers are kept
+	usart_tx_kick(p);
+	usart_rx_kick(p);
+	
+	if (p->tx_host->len)
+		qemu_bh_schedule(p->tx_bh);
+	
+	return 0;
+}
+
+static bool usart_host_needed(void *opaque) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	return p->tx_host->len || p->rx_host->len || timer_pending(p->tx_timer) || timer_pending(p->rx_timer);
+}
+
+static int usart_host_pre_save(void *opaque) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	p->tx_host_len = p->tx_host->len;
+	p->tx_host_data = p->tx_host->data;
+	p->rx_host_len = p->rx_host->len;
+	p->rx_host_data = p->rx_host->data;
+	return 0;
+}
+
+static bool usart_host_len_valid(void *opaque, int version_id) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	return p->tx_host_len <= USART_HOST_BUFFER && p->rx_host_len <= USART_HOST_BUFFER;
+}
+
+static int usart_host_post_load(void *opaque, int version_id) {
+	struct pmb887x_usart_t *p = (struct pmb887x_usart_t *) opaque;
+	
+	g_byte_array_set_size(p->tx_host, 0);
+	g_byte_array_append(p->tx_host, p->tx_host_data, p->tx_host_len);
+	g_free(p->tx_host_data);
+	p->tx_host_data = NULL;
+	
+	g_byte_array_set_size(p->rx_host, 0);
+	g_byte_array_append(p->rx_host, p->rx_host_data, p->rx_host_len);
+	g_free(p->rx_host_data);
+	p->rx_host_data = NULL;
+	
+	return 0;
+}
+
+static const VMStateDescription usart_host_vmstate = {
+	.name = TYPE_PMB887X_USART "/host",
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.needed = usart_host_needed,
+	.pre_save = usart_host_pre_save,
+	.post_load = usart_host_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_UINT32(tx_host_len, struct pmb887x_usart_t),
+		VMSTATE_UINT32(rx_host_len, struct pmb887x_usart_t),
+		VMSTATE_VALIDATE("host buffer overflow", usart_host_len_valid),
+		VMSTATE_VBUFFER_ALLOC_UINT32(tx_host_data, struct pmb887x_usart_t, 0, NULL, tx_host_len),
+		VMSTATE_VBUFFER_ALLOC_UINT32(rx_host_data, struct pmb887x_usart_t, 0, NULL, rx_host_len),
+		VMSTATE_INT64(tx_last, struct pmb887x_usart_t),
+		VMSTATE_INT64(rx_last, struct pmb887x_usart_t),
+		VMSTATE_TIMER_PTR(tx_timer, struct pmb887x_usart_t),
+		VMSTATE_TIMER_PTR(rx_timer, struct pmb887x_usart_t),
+		VMSTATE_END_OF_LIST()
+	}
+};
+
+static const VMStateDescription usart_vmstate = {
+	.name = TYPE_PMB887X_USART,
+	.version_id = 1,
+	.minimum_version_id = 1,
+	.post_load = usart_post_load,
+	.fields = (const VMStateField[]) {
+		VMSTATE_PMB887X_CLC(clc, struct pmb887x_usart_t),
+		VMSTATE_PMB887X_SRB(srb, struct pmb887x_usart_t),
+		VMSTATE_PMB887X_FIFO8(tx_fifo_buffered, struct pmb887x_usart_t),
+		VMSTATE_PMB887X_FIFO8(rx_fifo_buffered, struct pmb887x_usart_t),
+		VMSTATE_PMB887X_FIFO8(tx_fifo_single, struct pmb887x_usart_t),
+		VMSTATE_PMB887X_FIFO8(rx_fifo_single, struct pmb887x_usart_t),
+		VMSTATE_BOOL(last_is_icr_tx, struct pmb887x_usart_t),
+		VMSTATE_UINT32(con, struct pmb887x_usart_t),
+		VMSTATE_UINT32(bg, struct pmb887x_usart_t),
+		VMSTATE_UINT32(fdv, struct pmb887x_usart_t),
+		VMSTATE_UINT32(pmw, struct pmb887x_usart_t),
+		VMSTATE_UINT8(txb, struct pmb887x_usart_t),
+		VMSTATE_UINT32(abcon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(abstat, struct pmb887x_usart_t),
+		VMSTATE_UINT32(rxfcon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(txfcon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(fstat, struct pmb887x_usart_t),
+		VMSTATE_UINT32(whbcon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(whbabcon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(whbabstat, struct pmb887x_usart_t),
+		VMSTATE_UINT32(fccon, struct pmb887x_usart_t),
+		VMSTATE_UINT32(fcstat, struct pmb887x_usart_t),
+		VMSTATE_UINT32(tmo, struct pmb887x_usart_t),
+		VMSTATE_END_OF_LIST()
+	},
+	.subsections = (const VMStateDescription * const []) {
+		&usart_host_vmstate,
+		NULL
+	}
+};
+
 static Property usart_properties[] = {
     DEFINE_PROP_CHR("chardev", struct pmb887x_usart_t, chr),
     DEFINE_PROP_BOOL("apply-workarounds", struct pmb887x_usart_t, apply_workarounds, true),
+	DEFINE_PROP_BOOL("turbo", struct pmb887x_usart_t, turbo, false),
+	DEFINE_PROP_LINK("pll", struct pmb887x_usart_t, pll, "pmb887x-pll", struct pmb887x_pll_t *),
 	DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -546,6 +811,7 @@ static void usart_class_init(ObjectClass *klass, void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, usart_properties);
 	dc->realize = usart_realize;
+	dc->vmsd = &usart_vmstate;
 }
 
 static const TypeInfo usart_info = {
@@ -1417,6 +1417,39 @@ bool memory_region_init_ram_from_fd(MemoryRegion *mr,
                                     int fd,
                                     ram_addr_t offset,
                                     Error **errp);
+
+/**
+ * memory_region_init_rom_device_from_fd:  Initialize a ROM device memory
+ *                                         region backed by a private
+ *                                         mapping of a file.
+ *
+ * Same as memory_region_init_rom_device(), but the RAM backing is a
+ * MAP_PRIVATE mapping of @fd at @offset, so it is populated on demand
+ * and pages which are never written stay shared with the page cache.
+ * Changes are never written back to the file.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @owner: the object that tracks the region's reference count
+ * @ops: callbacks for write access handling (must not be NULL).
+ * @opaque: passed to the read and write callbacks of the @ops structure.
+ * @name: Region name, becomes part of RAMBlock name used in migration stream
+ *        must be unique within any device
+ * @size: size of the region.
+ * @fd: the fd to mmap.
+ * @offset: offset within the file referenced by fd, must be page aligned
+ * @errp: pointer to Error*, to store an error if it happens.
+ *
+ * Return: true on success, else false setting @errp with error.
+ */
+bool memory_region_init_rom_device_from_fd(MemoryRegion *mr,
+                                           Object *owner,
+                                           const MemoryRegionOps *ops,
+                                           void *opaque,
+                                           const char *name,
+                                           uint64_t size,
+                                           int fd,
+                                           ram_addr_t offset,
+                                           Error **errp);
 #endif
 
 /**
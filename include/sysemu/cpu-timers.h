@@ -118,4 +118,5 @@ int64_t icount2_get(void);
 void icount2_enter_sleep(void);
 void icount2_exit_sleep(void);
 void icount2_set_ns_per_tick(int64_t ns_per_tick);
+int64_t icount2_skip(int64_t max_ns);
 #endif /* SYSEMU_CPU_TIMERS_H */
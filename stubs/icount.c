@@ -65,3 +65,9 @@ void icount2_set_ns_per_tick(int64_t ns_per_tick)
 {
 	abort();
 }
+
+int64_t icount2_skip(int64_t max_ns)
+{
+	abort();
+	return 0;
+}
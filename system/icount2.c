@@ -17,6 +17,7 @@
 #include "sysemu/cpu-timers-internal.h"
 
 bool use_icount2 = false;
+static bool icount2_sleep = true;
 
 static void icount2_idle_timer(void *opaque) {
 	if (timers_state.icount2_idle_deadline) {
@@ -34,11 +35,14 @@ static void icount2_idle_timer(void *opaque) {
 		deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL, QEMU_TIMER_ATTR_ALL);
 	}
 	
+	// sleep=off: jump to the next deadline without waiting, but only when something is scheduled
+	bool warp = !icount2_sleep && deadline > 0;
+	
 	if (deadline < 0 || deadline > 1000000)
 		deadline = 1000000;
 	
 	timers_state.icount2_idle_deadline = deadline;
-	timer_mod(timers_state.icount2_idle_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + deadline);
+	timer_mod(timers_state.icount2_idle_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + (warp ? 0 : deadline));
 }
 
 void icount2_sync(void) {
@@ -97,6 +101,30 @@ int64_t icount2_get(void) {
 	return time;
 }
 
+/*
+ * Advance virtual clock by up to max_ns, but not past the nearest QEMU_CLOCK_VIRTUAL deadline.
+ * Used for busy-wait loops which only poll time source. Must be called with BQL.
+ * */
+int64_t icount2_skip(int64_t max_ns) {
+	if (icount2_sleep || timers_state.icount2_idle)
+		return 0;
+	
+	int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL, QEMU_TIMER_ATTR_ALL);
+	if (deadline < 0 || deadline > max_ns)
+		deadline = max_ns;
+	
+	if (deadline <= 0)
+		return 0;
+	
+	seqlock_write_lock(&timers_state.vm_clock_seqlock, &timers_state.vm_clock_lock);
+	int64_t bias = qatomic_read_i64(&timers_state.icount2_bias);
+	qatomic_set_i64(&timers_state.icount2_bias, bias + deadline);
+	seqlock_write_unlock(&timers_state.vm_clock_seqlock, &timers_state.vm_clock_lock);
+	
+	icount2_sync();
+	return deadline;
+}
+
 void icount2_set_ns_per_tick(int64_t ns_per_tick) {
 	seqlock_write_lock(&timers_state.vm_clock_seqlock, &timers_state.vm_clock_lock);
 	int64_t ticks = qatomic_read_i64(&timers_state.icount2_ticks);
@@ -125,6 +153,7 @@ void icount2_exit_sleep(void) {
 
 void icount2_configure(QemuOpts *opts, Error **errp) {
 	use_icount2 = true;
+	icount2_sleep = qemu_opt_get_bool(opts, "sleep", true);
 	qatomic_set_i64(&timers_state.icount2_ns_per_tick, 1);
 	
 	timers_state.icount2_idle_timer = timer_new_ns(QEMU_CLOCK_REALTIME, icount2_idle_timer, NULL);
@@ -1658,6 +1658,37 @@ bool memory_region_init_ram_from_fd(MemoryRegion *mr,
     }
     return true;
 }
+
+bool memory_region_init_rom_device_from_fd(MemoryRegion *mr,
+                                           Object *owner,
+                                           const MemoryRegionOps *ops,
+                                           void *opaque,
+                                           const char *name,
+                                           uint64_t size,
+                                           int fd,
+                                           ram_addr_t offset,
+                                           Error **errp)
+{
+    Error *err = NULL;
+    assert(ops);
+    memory_region_init(mr, owner, name, size);
+    mr->ops = ops;
+    mr->opaque = opaque;
+    mr->terminates = true;
+    mr->rom_device = true;
+    mr->destructor = memory_region_destructor_ram;
+    /* No RAM_SHARED: private copy-on-write mapping */
+    mr->ram_block = qemu_ram_alloc_from_fd(size, mr, 0, fd, offset, &err);
+    if (err) {
+        mr->size = int128_zero();
+        object_unparent(OBJECT(mr));
+        error_propagate(errp, err);
+        return false;
+    }
+    /* See memory_region_init_rom_device() */
+    vmstate_register_ram(mr, DEVICE(owner));
+    return true;
+}
 #endif
 
 void memory_region_init_ram_ptr(MemoryRegion *mr,
@@ -3408,4 +3408,17 @@ static inline target_ulong cpu_untagged_addr(CPUState *cs, target_ulong x)
 }
 #endif
 
+/*
+ * PMB887X: high-level emulation of guest routines (hw/arm/pmb887x/hle.c).
+ * is_hooked() is checked when an A32/T32 insn is translated, @pc has bit 0
+ * set for Thumb. call() runs before the hooked insn and returns true when
+ * the routine was emulated and PC/Thumb state are set to its return address.
+ */
+typedef struct ARMHLEOps {
+    bool (*is_hooked)(uint32_t pc);
+    bool (*call)(CPUARMState *env, uint32_t pc, uintptr_t ra);
+} ARMHLEOps;
+
+extern const ARMHLEOps *arm_hle_ops;
+
 #endif
@@ -456,6 +456,14 @@ void HELPER(instructions_counter)(CPUARMState *env)
     icount2_on_tick();
 }
 
+/* High-level emulation hooks, set by board */
+const ARMHLEOps *arm_hle_ops;
+
+uint32_t HELPER(hle_call)(CPUARMState *env, uint32_t pc)
+{
+    return arm_hle_ops->call(env, pc, GETPC());
+}
+
 /* Raise an exception with the specified syndrome register value */
 void HELPER(exception_with_syndrome_el)(CPUARMState *env, uint32_t excp,
                                         uint32_t syndrome, uint32_t target_el)
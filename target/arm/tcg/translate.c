@@ -9326,6 +9326,30 @@ static bool arm_check_ss_active(DisasContext *dc)
     return false;
 }
 
+/*
+ * Native replacement of a guest routine: if the hook handled the call,
+ * PC already points to the return address, otherwise the insn is executed.
+ */
+static void arm_check_hle(DisasContext *dc, uint32_t pc)
+{
+    TCGv_i32 handled;
+    TCGLabel *fallback;
+
+    if (!arm_hle_ops || !arm_hle_ops->is_hooked(pc | dc->thumb)) {
+        return;
+    }
+
+    dc->pc_curr = pc;
+    gen_update_pc(dc, 0);
+
+    handled = tcg_temp_new_i32();
+    fallback = gen_new_label();
+    gen_helper_hle_call(handled, tcg_env, tcg_constant_i32(pc | dc->thumb));
+    tcg_gen_brcondi_i32(TCG_COND_EQ, handled, 0, fallback);
+    tcg_gen_lookup_and_goto_ptr();
+    gen_set_label(fallback);
+}
+
 static void arm_post_translate_insn(DisasContext *dc)
 {
     if (dc->condjmp && dc->base.is_jmp == DISAS_NEXT) {
@@ -9369,6 +9393,8 @@ static void arm_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         return;
     }
 
+    arm_check_hle(dc, pc);
+
     dc->pc_curr = pc;
     insn = arm_ldl_code(env, &dc->base, pc, dc->sctlr_b);
     dc->insn = insn;
@@ -9446,6 +9472,11 @@ static void thumb_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         return;
     }
 
+    /* Routine entries and return addresses are never inside IT block */
+    if (!dc->condexec_mask) {
+        arm_check_hle(dc, pc);
+    }
+
     dc->pc_curr = pc;
     insn = arm_lduw_code(env, &dc->base, pc, dc->sctlr_b);
     is_16bit = thumb_insn_is_16bit(dc, dc->base.pc_next, insn);
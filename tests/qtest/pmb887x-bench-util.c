@@ -0,0 +1,106 @@
+/*
+ * PMB887X qtest benchmark helpers
+ * */
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "pmb887x-bench-util.h"
+
+#define EBU_BASE			0xF0000000
+#define EBU_CLC				0x00
+#define EBU_ADDRSEL0		0x80
+#define EBU_ADDRSEL1		0x88
+#define EBU_BUSCON0			0xC0
+#define EBU_BUSCON1			0xC8
+
+static const char board_cfg[] =
+	"[device]\n"
+	"cpu = pmb8876\n"
+	"vendor = QEMU\n"
+	"model = BENCH\n"
+	"\n"
+	"[memory]\n"
+	"cs0 = flash:0089:881c\n"
+	"cs1 = ram:16m\n"
+	"\n"
+	"[display]\n"
+	"type = jbt6k71\n"
+	"width = 176\n"
+	"height = 220\n"
+	"\n"
+	"[keyboard]\n"
+	"NAV_UP = 0:0\n";
+
+void pmb887x_bench_init(pmb887x_bench_t *b) {
+	int fd;
+	
+	fd = g_file_open_tmp("qtest-pmb887x-flash.XXXXXX", &b->image_path, NULL);
+	g_assert(fd >= 0);
+	g_assert(ftruncate(fd, PMB887X_BENCH_FLASH_SIZE) == 0);
+	close(fd);
+	
+	fd = g_file_open_tmp("qtest-pmb887x-board.XXXXXX", &b->board_path, NULL);
+	g_assert(fd >= 0);
+	g_assert(write(fd, board_cfg, strlen(board_cfg)) == strlen(board_cfg));
+	close(fd);
+	
+	// Inherited by QEMU process, USART0 is connected to serial_fd
+	g_setenv("PMB887X_BOARD", b->board_path, true);
+	g_autofree char *args = g_strdup_printf("-machine pmb887x -drive if=pflash,format=raw,file=%s", b->image_path);
+	b->qts = qtest_init_with_serial(args, &b->serial_fd);
+	
+	// Enable EBU, map CS0 at FLASH_BASE (32M, writable) and CS1 at RAM_BASE (16M)
+	qtest_writel(b->qts, EBU_BASE + EBU_CLC, 0x100);
+	qtest_writel(b->qts, EBU_BASE + EBU_BUSCON0, 0);
+	qtest_writel(b->qts, EBU_BASE + EBU_ADDRSEL0, PMB887X_BENCH_FLASH_BASE | (2 << 4) | 1);
+	qtest_writel(b->qts, EBU_BASE + EBU_BUSCON1, 0);
+	qtest_writel(b->qts, EBU_BASE + EBU_ADDRSEL1, PMB887X_BENCH_RAM_BASE | (3 << 4) | 1);
+}
+
+void pmb887x_bench_free(pmb887x_bench_t *b) {
+	qtest_quit(b->qts);
+	close(b->serial_fd);
+	unlink(b->image_path);
+	unlink(b->board_path);
+	g_free(b->image_path);
+	g_free(b->board_path);
+}
+
+uint32_t pmb887x_bench_iterations(uint32_t quick, uint32_t perf) {
+	return g_test_perf() ? perf : quick;
+}
+
+void pmb887x_bench_report(const char *name, uint64_t ops, double elapsed) {
+	double ops_per_sec = elapsed > 0 ? ops / elapsed : 0;
+	double ns_per_op = ops ? elapsed * 1e9 / ops : 0;
+	uint64_t elapsed_ns = elapsed * 1e9;
+	
+	g_test_message("pmb887x-bench: name=%s ops=%"PRIu64" elapsed_ns=%"PRIu64" ops_per_sec=%.0f ns_per_op=%.1f",
+		name, ops, elapsed_ns, ops_per_sec, ns_per_op);
+	g_test_maximized_result(ops_per_sec, "%s: %.0f ops/s, %.1f ns/op", name, ops_per_sec, ns_per_op);
+	
+	const char *results = getenv("PMB887X_BENCH_RESULTS");
+	if (results) {
+		FILE *fp = fopen(results, "a");
+		g_assert(fp);
+		fprintf(fp, "{\"name\": \"%s\", \"ops\": %"PRIu64", \"elapsed_ns\": %"PRIu64", \"ops_per_sec\": %.0f, \"ns_per_op\": %.1f}\n",
+			name, ops, elapsed_ns, ops_per_sec, ns_per_op);
+		fclose(fp);
+	}
+}
+
+void pmb887x_bench_poll_start(pmb887x_bench_poll_t *poll, const char *name, uint32_t max_polls) {
+	poll->name = name;
+	poll->polls = 0;
+	poll->max_polls = max_polls;
+	poll->deadline = g_get_monotonic_time() + PMB887X_BENCH_POLL_TIMEOUT_SEC * G_USEC_PER_SEC;
+}
+
+void pmb887x_bench_poll_next(pmb887x_bench_poll_t *poll) {
+	poll->polls++;
+	
+	if (poll->max_polls && poll->polls >= poll->max_polls)
+		g_error("%s: not ready after %u reads", poll->name, poll->polls);
+	
+	if (g_get_monotonic_time() > poll->deadline)
+		g_error("%s: not ready after %u reads in %d s", poll->name, poll->polls, PMB887X_BENCH_POLL_TIMEOUT_SEC);
+}
@@ -0,0 +1,55 @@
+/*
+ * PMB887X qtest benchmark helpers
+ *
+ * Boots pmb887x machine with synthetic board config and blank fullflash, device models
+ * are driven directly over qtest (no guest code is executed).
+ *
+ * Every result is reported as:
+ *   - g_test_message() line: "pmb887x-bench: name=... ops=... elapsed_ns=... ops_per_sec=... ns_per_op=..."
+ *   - g_test_maximized_result() with ops/s
+ *   - JSON line appended to env PMB887X_BENCH_RESULTS=path/to/results.jsonl (if set)
+ * */
+#ifndef PMB887X_BENCH_UTIL_H
+#define PMB887X_BENCH_UTIL_H
+
+#include "libqtest.h"
+
+// Intel 0089:881C, 4x32K + 255x128K sectors
+#define PMB887X_BENCH_FLASH_SIZE	0x2000000
+#define PMB887X_BENCH_FLASH_BASE	0xA0000000
+
+// EBU CS1, 16M
+#define PMB887X_BENCH_RAM_SIZE		0x1000000
+#define PMB887X_BENCH_RAM_BASE		0xA8000000
+
+// Wall time limit for any busy-wait on device state
+#define PMB887X_BENCH_POLL_TIMEOUT_SEC	10
+
+typedef struct {
+	const char *name;
+	uint32_t polls;
+	uint32_t max_polls;
+	int64_t deadline;
+} pmb887x_bench_poll_t;
+
+typedef struct {
+	QTestState *qts;
+	int serial_fd;
+	char *image_path;
+	char *board_path;
+} pmb887x_bench_t;
+
+void pmb887x_bench_init(pmb887x_bench_t *b);
+void pmb887x_bench_free(pmb887x_bench_t *b);
+
+// Iterations for quick (CI) and -m perf runs
+uint32_t pmb887x_bench_iterations(uint32_t quick, uint32_t perf);
+
+void pmb887x_bench_report(const char *name, uint64_t ops, double elapsed);
+
+// Bounded busy-wait: call poll_next() after each read which did not see expected state,
+// test fails after max_polls such reads (0 - no limit) or PMB887X_BENCH_POLL_TIMEOUT_SEC
+void pmb887x_bench_poll_start(pmb887x_bench_poll_t *poll, const char *name, uint32_t max_polls);
+void pmb887x_bench_poll_next(pmb887x_bench_poll_t *poll);
+
+#endif
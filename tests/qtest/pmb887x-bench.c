@@ -0,0 +1,204 @@
+/*
+ * PMB887X device models benchmark
+ *
+ * Drives hot I/O paths of pmb887x peripherals over qtest and reports ops/s and ns/op:
+ *   dif-fifo		32-bit DIF FIFO writes in LCD RAM write mode (2 RGB565 pixels per op)
+ *   dmac-mem2per	full frame RAM -> DIF FIFO DMA transfers
+ *   nvic-irq-storm	GPTU SRC set -> NVIC CURRENT_IRQ -> SRC clear -> IRQ_ACK cycles
+ *   usart-rx-flood	host -> USART0 RX FIFO -> RXB bytes
+ * See pmb887x-bench-util.h for result format.
+ * */
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "pmb887x-bench-util.h"
+#include "hw/arm/pmb887x/regs.h"
+
+#define LCD_WIDTH			176
+#define LCD_HEIGHT			220
+#define LCD_FRAME_SIZE		(LCD_WIDTH * LCD_HEIGHT * 2)
+
+#define DIF_DMAC_PERIPH		4
+#define DMAC_BENCH_CH		0
+
+static void dif_fifo_write(pmb887x_bench_t *b, uint32_t value) {
+	qtest_writel(b->qts, PMB8876_DIF_BASE + DIF_FIFO, value);
+}
+
+// JBT6K71: command 0x202 starts GRAM write, then every DATA mode burst is pixels
+static void dif_start_ram_write(pmb887x_bench_t *b) {
+	qtest_writel(b->qts, PMB8876_DIF_BASE + DIF_CLC, 0x100);
+	qtest_writel(b->qts, PMB8876_DIF_BASE + DIF_RUNCTRL, 1);
+	
+	qtest_writel(b->qts, PMB8876_DIF_BASE + DIF_FIFOCFG, DIF_FIFOCFG_MODE_CMD | (1 << DIF_FIFOCFG_BS_SHIFT));
+	dif_fifo_write(b, 0x0202);
+	
+	qtest_writel(b->qts, PMB8876_DIF_BASE + DIF_FIFOCFG, DIF_FIFOCFG_MODE_DATA | (3 << DIF_FIFOCFG_BS_SHIFT));
+}
+
+// Pixels must reach the display surface, it is black after reset
+static bool lcd_is_blank(pmb887x_bench_t *b) {
+	g_autofree char *path = NULL;
+	g_autofree char *data = NULL;
+	gsize size;
+	
+	int fd = g_file_open_tmp("qtest-pmb887x-screen.XXXXXX", &path, NULL);
+	g_assert(fd >= 0);
+	close(fd);
+	
+	g_free(qtest_hmp(b->qts, "screendump %s", path));
+	g_assert(g_file_get_contents(path, &data, &size, NULL));
+	unlink(path);
+	
+	// PPM: "P6\n<w> <h>\n255\n" + RGB data
+	g_assert(size > 2 && memcmp(data, "P6", 2) == 0);
+	gsize offset = 0;
+	for (int lines = 0; lines < 3 && offset < size; offset++) {
+		if (data[offset] == '\n')
+			lines++;
+	}
+	
+	for (gsize i = offset; i < size; i++) {
+		if (data[i])
+			return false;
+	}
+	return true;
+}
+
+static void test_dif_fifo(void) {
+	pmb887x_bench_t b = {};
+	pmb887x_bench_init(&b);
+	dif_start_ram_write(&b);
+	
+	uint32_t frames = pmb887x_bench_iterations(2, 50);
+	uint64_t ops = 0;
+	
+	g_test_timer_start();
+	for (uint32_t i = 0; i < frames; i++) {
+		for (uint32_t j = 0; j < LCD_FRAME_SIZE / 4; j++)
+			dif_fifo_write(&b, (i << 24) | j);
+		ops += LCD_FRAME_SIZE / 4;
+	}
+	double elapsed = g_test_timer_elapsed();
+	
+	g_assert_false(lcd_is_blank(&b));
+	
+	pmb887x_bench_report("pmb887x/dif-fifo", ops, elapsed);
+	
+	pmb887x_bench_free(&b);
+}
+
+static void test_dmac_mem2per(void) {
+	pmb887x_bench_t b = {};
+	pmb887x_bench_init(&b);
+	dif_start_ram_write(&b);
+	
+	g_autofree uint8_t *frame = g_malloc(LCD_FRAME_SIZE);
+	for (uint32_t i = 0; i < LCD_FRAME_SIZE; i++)
+		frame[i] = g_test_rand_int();
+	qtest_memwrite(b.qts, PMB887X_BENCH_RAM_BASE, frame, LCD_FRAME_SIZE);
+	
+	uint32_t ch = PMB8876_DMAC_BASE + DMAC_BENCH_CH * 0x20;
+	qtest_writel(b.qts, PMB8876_DMAC_BASE + DMAC_CONFIG, DMAC_CONFIG_ENABLE);
+	qtest_writel(b.qts, ch + DMAC_CH_DST_ADDR0, PMB8876_DIF_BASE + DIF_FIFO);
+	qtest_writel(b.qts, ch + DMAC_CH_LLI0, 0);
+	qtest_writel(b.qts, ch + DMAC_CH_CONTROL0, DMAC_CH_CONTROL_S_WIDTH_WORD | DMAC_CH_CONTROL_D_WIDTH_WORD | DMAC_CH_CONTROL_SI);
+	
+	uint32_t frames = pmb887x_bench_iterations(20, 1000);
+	
+	// Peripheral controlled transfer, DIF TX_SIZE starts it
+	g_test_timer_start();
+	for (uint32_t i = 0; i < frames; i++) {
+		qtest_writel(b.qts, ch + DMAC_CH_SRC_ADDR0, PMB887X_BENCH_RAM_BASE);
+		qtest_writel(b.qts, ch + DMAC_CH_CONFIG0, DMAC_CH_CONFIG_ENABLE | DMAC_CH_CONFIG_FLOW_CTRL_MEM2PER_PER |
+			(DIF_DMAC_PERIPH << DMAC_CH_CONFIG_DST_PERIPH_SHIFT));
+		qtest_writel(b.qts, PMB8876_DIF_BASE + DIF_TX_SIZE, LCD_FRAME_SIZE / 4);
+	}
+	double elapsed = g_test_timer_elapsed();
+	
+	// Channel is disabled on terminal count
+	g_assert_cmphex(qtest_readl(b.qts, ch + DMAC_CH_CONFIG0) & DMAC_CH_CONFIG_ENABLE, ==, 0);
+	g_assert_cmphex(qtest_readl(b.qts, ch + DMAC_CH_SRC_ADDR0), ==, PMB887X_BENCH_RAM_BASE + LCD_FRAME_SIZE);
+	
+	pmb887x_bench_report("pmb887x/dmac-mem2per", frames, elapsed);
+	pmb887x_bench_report("pmb887x/dmac-mem2per-bytes", (uint64_t) frames * LCD_FRAME_SIZE, elapsed);
+	
+	pmb887x_bench_free(&b);
+}
+
+static void test_nvic_irq_storm(void) {
+	pmb887x_bench_t b = {};
+	pmb887x_bench_init(&b);
+	
+	// GPTU0 SRC0..SRC7 with different priorities
+	for (uint32_t i = 0; i < 8; i++) {
+		uint32_t irq = PMB8876_GPTU0_SRC0_IRQ - i;
+		qtest_writel(b.qts, PMB8876_NVIC_BASE + NVIC_CON0 + irq * 4, i + 1);
+	}
+	
+	uint32_t ops = pmb887x_bench_iterations(20000, 1000000);
+	
+	g_test_timer_start();
+	for (uint32_t i = 0; i < ops; i++) {
+		uint32_t src = PMB8876_GPTU0_BASE + GPTU_SRC0 + (i % 8) * 4;
+		uint32_t irq = PMB8876_GPTU0_SRC0_IRQ - (i % 8);
+		
+		qtest_writel(b.qts, src, MOD_SRC_SRE | MOD_SRC_SETR);
+		g_assert_cmpuint(qtest_readl(b.qts, PMB8876_NVIC_BASE + NVIC_CURRENT_IRQ), ==, irq);
+		qtest_writel(b.qts, src, MOD_SRC_SRE | MOD_SRC_CLRR);
+		qtest_writel(b.qts, PMB8876_NVIC_BASE + NVIC_IRQ_ACK, 1);
+	}
+	pmb887x_bench_report("pmb887x/nvic-irq-storm", ops, g_test_timer_elapsed());
+	
+	pmb887x_bench_free(&b);
+}
+
+static void test_usart_rx_flood(void) {
+	pmb887x_bench_t b = {};
+	pmb887x_bench_init(&b);
+	
+	// No baudrate generator: RX is not paced by virtual time
+	qtest_writel(b.qts, PMB8876_USART0_BASE + USART_CLC, 0x100);
+	qtest_writel(b.qts, PMB8876_USART0_BASE + USART_CON, USART_CON_REN);
+	qtest_writel(b.qts, PMB8876_USART0_BASE + USART_RXFCON, USART_RXFCON_RXFEN);
+	qtest_writel(b.qts, PMB8876_USART0_BASE + USART_TXFCON, USART_TXFCON_TXFEN);
+	
+	uint32_t total = pmb887x_bench_iterations(64 * 1024, 4 * 1024 * 1024);
+	uint8_t chunk[1024];
+	uint32_t received = 0;
+	pmb887x_bench_poll_t poll;
+	
+	g_test_timer_start();
+	while (received < total) {
+		uint32_t chunk_size = MIN(sizeof(chunk), total - received);
+		for (uint32_t i = 0; i < chunk_size; i++)
+			chunk[i] = received + i;
+		g_assert_cmpint(write(b.serial_fd, chunk, chunk_size), ==, chunk_size);
+		
+		// Like firmware RX handler: drain FIFO by RXFFL, chardev delivers data asynchronously
+		pmb887x_bench_poll_start(&poll, "USART0 RXFFL", 0);
+		for (uint32_t i = 0; i < chunk_size; ) {
+			uint32_t fstat = qtest_readl(b.qts, PMB8876_USART0_BASE + USART_FSTAT);
+			uint32_t level = (fstat & USART_FSTAT_RXFFL) >> USART_FSTAT_RXFFL_SHIFT;
+			if (!level) {
+				pmb887x_bench_poll_next(&poll);
+				continue;
+			}
+			
+			for (uint32_t j = 0; j < level; j++, i++)
+				g_assert_cmphex(qtest_readl(b.qts, PMB8876_USART0_BASE + USART_RXB) & 0xFF, ==, chunk[i]);
+		}
+		received += chunk_size;
+	}
+	pmb887x_bench_report("pmb887x/usart-rx-flood", received, g_test_timer_elapsed());
+	
+	pmb887x_bench_free(&b);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	qtest_add_func("pmb887x/bench/dif-fifo", test_dif_fifo);
+	qtest_add_func("pmb887x/bench/dmac-mem2per", test_dmac_mem2per);
+	qtest_add_func("pmb887x/bench/nvic-irq-storm", test_nvic_irq_storm);
+	qtest_add_func("pmb887x/bench/usart-rx-flood", test_usart_rx_flood);
+	return g_test_run();
+}
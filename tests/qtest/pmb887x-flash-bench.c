@@ -0,0 +1,252 @@
+/*
+ * PMB887X flash command stream benchmark
+ *
+ * Replays erase/program command stream against pmb887x-flash and reports commands per second.
+ *
+ * By default a synthetic FFS garbage collection pattern is used. Recorded stream can be
+ * passed with env PMB887X_FLASH_BENCH_STREAM=path/to/stream.txt, one command per line:
+ *   U <addr>				unlock block
+ *   L <addr>				lock block
+ *   E <addr>				erase block
+ *   P <addr> <value>		program word
+ *   B <addr> <v0> ... <vN>	buffered program
+ * Addresses are flash offsets in hex.
+ * */
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "pmb887x-bench-util.h"
+
+#define FLASH_SIZE			PMB887X_BENCH_FLASH_SIZE
+#define FLASH_BASE			PMB887X_BENCH_FLASH_BASE
+
+#define FLASH_SECTOR_SIZE(addr)	((addr) < 0x20000 ? 0x8000 : 0x20000)
+
+// Commands complete instantly, SR.7 must be set on first reads
+#define FLASH_READY_MAX_POLLS	1000
+
+enum {
+	CMD_UNLOCK,
+	CMD_LOCK,
+	CMD_ERASE,
+	CMD_PROGRAM,
+	CMD_BUFFERED,
+};
+
+typedef struct {
+	int type;
+	uint32_t addr;
+	uint32_t count;
+	uint16_t *values;
+} flash_cmd_t;
+
+typedef struct {
+	pmb887x_bench_t bench;
+	QTestState *qts;
+	GArray *cmds;
+} flash_bench_t;
+
+static void flash_cmd(flash_bench_t *b, uint32_t addr, uint16_t cmd) {
+	qtest_writew(b->qts, FLASH_BASE + addr, cmd);
+}
+
+static void flash_wait_ready(flash_bench_t *b, uint32_t addr) {
+	// Like firmware does: poll SR.7 and back to read array
+	pmb887x_bench_poll_t poll;
+	pmb887x_bench_poll_start(&poll, "flash SR.7", FLASH_READY_MAX_POLLS);
+	while (!(qtest_readw(b->qts, FLASH_BASE + addr) & 0x80))
+		pmb887x_bench_poll_next(&poll);
+	flash_cmd(b, addr, 0xFF);
+}
+
+static void flash_exec(flash_bench_t *b, const flash_cmd_t *cmd) {
+	switch (cmd->type) {
+		case CMD_UNLOCK:
+			flash_cmd(b, cmd->addr, 0x60);
+			flash_cmd(b, cmd->addr, 0xD0);
+			flash_wait_ready(b, cmd->addr);
+		break;
+		
+		case CMD_LOCK:
+			flash_cmd(b, cmd->addr, 0x60);
+			flash_cmd(b, cmd->addr, 0x01);
+			flash_wait_ready(b, cmd->addr);
+		break;
+		
+		case CMD_ERASE:
+			flash_cmd(b, cmd->addr, 0x20);
+			flash_cmd(b, cmd->addr, 0xD0);
+			flash_wait_ready(b, cmd->addr);
+		break;
+		
+		case CMD_PROGRAM:
+			flash_cmd(b, cmd->addr, 0x40);
+			flash_cmd(b, cmd->addr, cmd->values[0]);
+			flash_wait_ready(b, cmd->addr);
+		break;
+		
+		case CMD_BUFFERED:
+			flash_cmd(b, cmd->addr, 0xE8);
+			flash_cmd(b, cmd->addr, cmd->count - 1);
+			for (uint32_t i = 0; i < cmd->count; i++)
+				flash_cmd(b, cmd->addr + i * 2, cmd->values[i]);
+			flash_cmd(b, cmd->addr, 0xD0);
+			flash_wait_ready(b, cmd->addr);
+		break;
+	}
+}
+
+// Expected content: erase fills sector with 0xFF, program can only clear bits
+static void flash_shadow_exec(uint16_t *shadow, const flash_cmd_t *cmd) {
+	switch (cmd->type) {
+		case CMD_ERASE:
+		{
+			uint32_t sector_size = FLASH_SECTOR_SIZE(cmd->addr);
+			uint32_t base = cmd->addr & ~(sector_size - 1);
+			memset(&shadow[base / 2], 0xFF, sector_size);
+		}
+		break;
+		
+		case CMD_PROGRAM:
+		case CMD_BUFFERED:
+			for (uint32_t i = 0; i < cmd->count; i++)
+				shadow[cmd->addr / 2 + i] &= cmd->values[i];
+		break;
+	}
+}
+
+// Every erased or programmed word must be read back as expected
+static void flash_verify(flash_bench_t *b) {
+	g_autofree uint16_t *shadow = g_new0(uint16_t, FLASH_SIZE / 2);
+	
+	for (guint i = 0; i < b->cmds->len; i++)
+		flash_shadow_exec(shadow, &g_array_index(b->cmds, flash_cmd_t, i));
+	
+	for (guint i = 0; i < b->cmds->len; i++) {
+		const flash_cmd_t *cmd = &g_array_index(b->cmds, flash_cmd_t, i);
+		uint32_t addr = cmd->addr & ~1;
+		
+		if (cmd->type == CMD_ERASE) {
+			g_assert_cmphex(qtest_readw(b->qts, FLASH_BASE + addr), ==, shadow[addr / 2]);
+		} else if (cmd->type == CMD_PROGRAM || cmd->type == CMD_BUFFERED) {
+			for (uint32_t j = 0; j < cmd->count; j++)
+				g_assert_cmphex(qtest_readw(b->qts, FLASH_BASE + addr + j * 2), ==, shadow[addr / 2 + j]);
+		}
+	}
+}
+
+static void flash_add_cmd(flash_bench_t *b, int type, uint32_t addr, uint32_t count, const uint16_t *values) {
+	flash_cmd_t cmd = {
+		.type = type,
+		.addr = addr,
+		.count = count,
+		.values = count ? g_memdup2(values, count * sizeof(uint16_t)) : NULL,
+	};
+	g_array_append_val(b->cmds, cmd);
+}
+
+static void flash_gen_stream(flash_bench_t *b, uint32_t rounds) {
+	uint16_t values[32];
+	
+	// FFS garbage collection: move a few records to a fresh sector, then erase the old one
+	for (uint32_t i = 0; i < rounds; i++) {
+		uint32_t sector = g_test_rand_int_range(0, FLASH_SIZE / 0x20000) * 0x20000;
+		uint32_t sector_size = FLASH_SECTOR_SIZE(sector);
+		
+		flash_add_cmd(b, CMD_UNLOCK, sector, 0, NULL);
+		flash_add_cmd(b, CMD_ERASE, sector, 0, NULL);
+		
+		for (uint32_t j = 0; j < 16; j++) {
+			uint32_t addr = sector + g_test_rand_int_range(0, sector_size / sizeof(values)) * sizeof(values);
+			for (uint32_t k = 0; k < ARRAY_SIZE(values); k++)
+				values[k] = g_test_rand_int();
+			flash_add_cmd(b, CMD_BUFFERED, addr, ARRAY_SIZE(values), values);
+		}
+		
+		for (uint32_t j = 0; j < 16; j++) {
+			uint32_t addr = sector + g_test_rand_int_range(0, sector_size / 2) * 2;
+			values[0] = g_test_rand_int();
+			flash_add_cmd(b, CMD_PROGRAM, addr, 1, values);
+		}
+		
+		flash_add_cmd(b, CMD_LOCK, sector, 0, NULL);
+	}
+}
+
+static void flash_load_stream(flash_bench_t *b, const char *file) {
+	g_autofree char *text = NULL;
+	g_autoptr(GError) err = NULL;
+	
+	if (!g_file_get_contents(file, &text, NULL, &err))
+		g_error("%s", err->message);
+	
+	g_auto(GStrv) lines = g_strsplit(text, "\n", -1);
+	for (int i = 0; lines[i]; i++) {
+		g_auto(GStrv) args = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+		uint32_t args_n = g_strv_length(args);
+		uint16_t values[256];
+		
+		if (args_n < 2 || args[0][0] == '#')
+			continue;
+		
+		uint32_t addr = strtoul(args[1], NULL, 16);
+		g_assert_cmpuint(addr, <, FLASH_SIZE);
+		g_assert_cmpuint(args_n - 2, <=, ARRAY_SIZE(values));
+		
+		for (uint32_t j = 2; j < args_n; j++)
+			values[j - 2] = strtoul(args[j], NULL, 16);
+		
+		switch (args[0][0]) {
+			case 'U':	flash_add_cmd(b, CMD_UNLOCK, addr, 0, NULL); break;
+			case 'L':	flash_add_cmd(b, CMD_LOCK, addr, 0, NULL); break;
+			case 'E':	flash_add_cmd(b, CMD_ERASE, addr, 0, NULL); break;
+			case 'P':	flash_add_cmd(b, CMD_PROGRAM, addr, 1, values); break;
+			case 'B':	flash_add_cmd(b, CMD_BUFFERED, addr, args_n - 2, values); break;
+			default:
+				g_error("%s:%d: unknown command '%s'", file, i + 1, args[0]);
+			break;
+		}
+	}
+}
+
+static void flash_bench_init(flash_bench_t *b) {
+	pmb887x_bench_init(&b->bench);
+	b->qts = b->bench.qts;
+	b->cmds = g_array_new(false, true, sizeof(flash_cmd_t));
+}
+
+static void flash_bench_free(flash_bench_t *b) {
+	for (guint i = 0; i < b->cmds->len; i++)
+		g_free(g_array_index(b->cmds, flash_cmd_t, i).values);
+	g_array_free(b->cmds, true);
+	pmb887x_bench_free(&b->bench);
+}
+
+static void test_flash_stream(void) {
+	flash_bench_t b = {};
+	
+	flash_bench_init(&b);
+	
+	const char *stream = getenv("PMB887X_FLASH_BENCH_STREAM");
+	if (stream) {
+		flash_load_stream(&b, stream);
+	} else {
+		flash_gen_stream(&b, pmb887x_bench_iterations(50, 2000));
+	}
+	
+	g_test_timer_start();
+	for (guint i = 0; i < b.cmds->len; i++)
+		flash_exec(&b, &g_array_index(b.cmds, flash_cmd_t, i));
+	double elapsed = g_test_timer_elapsed();
+	
+	flash_verify(&b);
+	
+	pmb887x_bench_report("pmb887x/flash-stream", b.cmds->len, elapsed);
+	
+	flash_bench_free(&b);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	qtest_add_func("pmb887x/flash/stream", test_flash_stream);
+	return g_test_run();
+}
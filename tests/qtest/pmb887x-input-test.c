@@ -0,0 +1,45 @@
+/*
+ * PMB887X scripted input (pmb887x-input HMP command) test
+ * */
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "pmb887x-bench-util.h"
+#include "hw/arm/pmb887x/regs.h"
+
+// NAV_UP = 0:0 in bench board config
+#define NAV_UP_MASK		(1 << 0)
+
+static void test_same_time_order(void) {
+	pmb887x_bench_t b = {};
+	pmb887x_bench_init(&b);
+	
+	g_assert_cmphex(qtest_readl(b.qts, PMB8876_KEYPAD_BASE + KEYPAD_PORT0) & NAV_UP_MASK, ==, NAV_UP_MASK);
+	
+	// Both events at the same time, must be replayed in script order
+	g_free(qtest_hmp(b.qts, "pmb887x-input 10 key up down; 10 key up up"));
+	
+	g_autofree char *info = qtest_hmp(b.qts, "info pmb887x-input");
+	const char *down = strstr(info, "key up down");
+	const char *up = strstr(info, "key up up");
+	g_assert_nonnull(down);
+	g_assert_nonnull(up);
+	g_assert(down < up);
+	
+	qtest_clock_step(b.qts, 20 * 1000 * 1000);
+	
+	// Reversed order leaves key stuck: "up" is ignored for released key, then "down"
+	g_assert_cmphex(qtest_readl(b.qts, PMB8876_KEYPAD_BASE + KEYPAD_PORT0) & NAV_UP_MASK, ==, NAV_UP_MASK);
+	g_assert_cmphex(qtest_readl(b.qts, PMB8876_KEYPAD_BASE + KEYPAD_PRESS_SRC) & MOD_SRC_SRR, ==, MOD_SRC_SRR);
+	g_assert_cmphex(qtest_readl(b.qts, PMB8876_KEYPAD_BASE + KEYPAD_RELEASE_SRC) & MOD_SRC_SRR, ==, MOD_SRC_SRR);
+	
+	g_autofree char *done = qtest_hmp(b.qts, "info pmb887x-input");
+	g_assert_nonnull(strstr(done, "executed: 2, pending: 0"));
+	
+	pmb887x_bench_free(&b);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	qtest_add_func("pmb887x/input/same-time-order", test_same_time_order);
+	return g_test_run();
+}